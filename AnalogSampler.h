@@ -0,0 +1,241 @@
+#ifndef __ANALOG_SAMPLER_H__
+#define __ANALOG_SAMPLER_H__
+
+#include <stdint.h>
+
+enum GamepadAnalogAxis
+{
+    GAMEPAD_ANALOG_LEFT_X,        // left stick, -127..127
+    GAMEPAD_ANALOG_LEFT_Y,
+    GAMEPAD_ANALOG_RIGHT_X,       // right stick, -127..127
+    GAMEPAD_ANALOG_RIGHT_Y,
+    GAMEPAD_ANALOG_LEFT_TRIGGER,  // 0..255
+    GAMEPAD_ANALOG_RIGHT_TRIGGER,
+};
+
+/**
+ * Oversamples analog inputs and turns them into stick and trigger axes.
+ *
+ * A burst converts every mapped input `oversampling` times, round-robin, one conversion
+ * per add(). Once it completes, the averages(0..1023) are calibrated and shaped: each stick
+ * gets a radial deadzone, so that it reads 0 near the center in every direction and its
+ * direction is kept outside of it; each trigger gets a deadzone above its rest position.
+ *
+ * Inputs are changed from fibers, only while no burst runs; begin() and add() run in interrupts.
+ */
+class AnalogSampler
+{
+  public:
+    static const uint8_t AXES = 6;
+    static const uint8_t NONE = 0xff;
+    static const uint16_t FULL_SCALE = 1023;
+
+    AnalogSampler() : inputCount(0), oversampling(1), deadzone(0), position(0), round(0)
+    {
+        for (uint8_t i = 0; i < AXES; i++)
+        {
+            inputs[i] = NONE;
+            inverted[i] = false;
+            sums[i] = 0;
+            averages[i] = isStick(i) ? FULL_SCALE / 2 : 0;
+            centers[i] = averages[i];
+        }
+    }
+
+    /**
+     * Map an analog input to an axis, replacing the axis' previous input
+     * @param axis the GamepadAnalogAxis
+     * @param input ADC input(0..7), NONE to unmap the axis
+     * @param invert true if the input reads higher toward the left, the top, or the rest position of a trigger
+     */
+    void setInput(uint8_t axis, uint8_t input, bool invert)
+    {
+        if (axis >= AXES)
+        {
+            return;
+        }
+        inputs[axis] = input;
+        inverted[axis] = invert;
+        averages[axis] = isStick(axis) ? FULL_SCALE / 2 : 0;
+        centers[axis] = averages[axis];
+
+        inputCount = 0;
+        for (uint8_t i = 0; i < AXES; i++)
+        {
+            if (inputs[i] != NONE)
+            {
+                order[inputCount++] = i;
+            }
+        }
+    }
+
+    /**
+     * @param samples conversions averaged per axis(1..64)
+     */
+    void setOversampling(uint8_t samples)
+    {
+        oversampling = samples == 0 ? 1 : (samples > 64 ? 64 : samples);
+    }
+
+    /**
+     * @param value deadzone as a fraction of a stick's radius or of a trigger's travel, out of 127
+     */
+    void setDeadzone(uint8_t value)
+    {
+        deadzone = value > 126 ? 126 : value;
+    }
+
+    bool isEmpty() const
+    {
+        return inputCount == 0;
+    }
+
+    /**
+     * Start a burst
+     * @return the ADC input to convert first
+     */
+    uint8_t begin()
+    {
+        position = 0;
+        round = 0;
+        for (uint8_t i = 0; i < AXES; i++)
+        {
+            sums[i] = 0;
+        }
+        return inputs[order[0]];
+    }
+
+    /**
+     * Add the conversion of the current input
+     * @param sample the conversion(0..1023)
+     * @param next set to the ADC input to convert next
+     * @return true when the burst is complete
+     */
+    bool add(uint16_t sample, uint8_t &next)
+    {
+        uint8_t axis = order[position];
+        sums[axis] += inverted[axis] ? FULL_SCALE - sample : sample;
+
+        if (++position == inputCount)
+        {
+            position = 0;
+            if (++round == oversampling)
+            {
+                for (uint8_t i = 0; i < inputCount; i++)
+                {
+                    averages[order[i]] = (sums[order[i]] + oversampling / 2) / oversampling;
+                }
+                return true;
+            }
+        }
+        next = inputs[order[position]];
+        return false;
+    }
+
+    /**
+     * Use the averages of the last burst as the centers of the sticks and the rest positions of the triggers
+     */
+    void calibrate()
+    {
+        for (uint8_t i = 0; i < AXES; i++)
+        {
+            centers[i] = averages[i];
+        }
+    }
+
+    /**
+     * Shape the averages of the last burst into axes
+     * @param axes set to the sticks(-127..127) and the triggers(0..255), in GamepadAnalogAxis order
+     */
+    void getAxes(int16_t *axes) const
+    {
+        getStick(GAMEPAD_ANALOG_LEFT_X, axes);
+        getStick(GAMEPAD_ANALOG_RIGHT_X, axes);
+        getTrigger(GAMEPAD_ANALOG_LEFT_TRIGGER, axes);
+        getTrigger(GAMEPAD_ANALOG_RIGHT_TRIGGER, axes);
+    }
+
+  private:
+    static bool isStick(uint8_t axis)
+    {
+        return axis < GAMEPAD_ANALOG_LEFT_TRIGGER;
+    }
+
+    static uint32_t squareRoot(uint32_t value)
+    {
+        uint32_t root = 0;
+        uint32_t bit = 1UL << 30;
+        while (bit > value)
+        {
+            bit >>= 2;
+        }
+        while (bit != 0)
+        {
+            if (value >= root + bit)
+            {
+                value -= root + bit;
+                root = (root >> 1) + bit;
+            }
+            else
+            {
+                root >>= 1;
+            }
+            bit >>= 2;
+        }
+        return root;
+    }
+
+    /**
+     * X and Y of a stick, scaled from the end of the deadzone to the edge of the unit circle
+     */
+    void getStick(uint8_t xAxis, int16_t *axes) const
+    {
+        int32_t x = inputs[xAxis] == NONE ? 0 : (int32_t)averages[xAxis] - centers[xAxis];
+        int32_t y = inputs[xAxis + 1] == NONE ? 0 : (int32_t)averages[xAxis + 1] - centers[xAxis + 1];
+        int32_t radius = FULL_SCALE / 2;
+        int32_t dead = (int32_t)deadzone * radius / 127;
+
+        int32_t distance = squareRoot(x * x + y * y);
+        if (distance <= dead)
+        {
+            axes[xAxis] = 0;
+            axes[xAxis + 1] = 0;
+            return;
+        }
+
+        int32_t scaled = ((distance < radius ? distance : radius) - dead) * 127 / (radius - dead);
+        axes[xAxis] = x * scaled / distance;
+        axes[xAxis + 1] = y * scaled / distance;
+    }
+
+    /**
+     * A trigger, scaled from the end of the deadzone to the end of its travel
+     */
+    void getTrigger(uint8_t axis, int16_t *axes) const
+    {
+        int32_t travel = FULL_SCALE - centers[axis];
+        int32_t dead = (int32_t)deadzone * travel / 127;
+        int32_t pressed = inputs[axis] == NONE ? 0 : (int32_t)averages[axis] - centers[axis];
+        if (pressed <= dead)
+        {
+            axes[axis] = 0;
+            return;
+        }
+        axes[axis] = (pressed - dead) * 255 / (travel - dead);
+    }
+
+    uint8_t inputs[AXES];
+    bool inverted[AXES];
+    uint8_t order[AXES];
+    uint8_t inputCount;
+    uint8_t oversampling;
+    uint8_t deadzone;
+
+    uint8_t position;
+    uint8_t round;
+    uint16_t sums[AXES];
+    uint16_t averages[AXES];
+    uint16_t centers[AXES];
+};
+
+#endif /* __ANALOG_SAMPLER_H__ */
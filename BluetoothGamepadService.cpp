@@ -1,15 +1,12 @@
 /** 
  * A class to communicate a BLE Gamepad device
  */
-#include "MicroBit.h"
-#include "pxt.h"
-#include "ble/GapAdvertisingData.h"
-#include "ble/GattService.h"
-#include "ble/GattCharacteristic.h"
-#if !CONFIG_ENABLED(MICROBIT_BLE_DEVICE_INFORMATION_SERVICE)
+#include <new>
+#include "GamepadHal.h"
+#include "BluetoothGamepadService.h"
+#if GAMEPAD_DEVICE_INFORMATION_SERVICE && !GAMEPAD_DAL_DEVICE_INFORMATION
 #include "HIDDeviceInformationService.h"
 #endif
-#include "BluetoothGamepadService.h"
 #include "USBHID_Types.h"
 
 namespace
@@ -17,56 +14,407 @@ namespace
 
 static const uint8_t RESPONSE_HID_INFORMATION[] = {0x11, 0x01, 0x00, 0x03};
 
+#if GAMEPAD_DEVICE_INFORMATION_SERVICE && !GAMEPAD_DAL_DEVICE_INFORMATION
+#define GAMEPAD_ADDS_DEVICE_INFORMATION 1
+static const char DEVICE_MANUFACTURER[] = "BBC";
+static const char DEVICE_MODEL[] = "uBit";
+static const PnPID_t DEVICE_PNP_ID = {0x2,     // USB vendor ID
+                                      0x0D28,  // ARM
+                                      0x0204,  // micro:bit
+                                      0x0100};
+#else
+#define GAMEPAD_ADDS_DEVICE_INFORMATION 0
+#endif
+
 static const uint16_t uuid16_list[] = {GattService::UUID_HUMAN_INTERFACE_DEVICE_SERVICE,
                                        GattService::UUID_DEVICE_INFORMATION_SERVICE};
 
 /**
  * Characteristic Data(Report Map)
  */
-static const uint8_t REPORT_MAP[] = {
-    USAGE_PAGE(1), 0x01,                // Generic Desktop
-    USAGE(1), 0x05,                     // Game Pad
-    COLLECTION(1), 0x01,                // Collection: Application
-        COLLECTION(1), 0x00,            // Collection: Physical
-            REPORT_ID(1), 0x01,             // Report ID 1
-
-            // axes
-            USAGE_PAGE(1), 0x01,            // Generic Desktop
-            USAGE(1), 0x30,                 // X
-            USAGE(1), 0x31,                 // Y
-            LOGICAL_MINIMUM(1), 0xff,       // Logical Min: -1
-            LOGICAL_MAXIMUM(1), 0x01,       // Logical Max: 1
-            REPORT_SIZE(1), 0x02,           // 1 Bit per axis
-            REPORT_COUNT(1), 0x02,          // 2 axes
-            INPUT(1), 0x02,                 // Data, Variable, Absolute
-
-            // buttons
-            USAGE_PAGE(1), 0x09,            // Button
-            USAGE(1), 0x01,                 // Button A
-            USAGE(1), 0x02,                 // Button B
-            USAGE(1), 0x0b,                 // Select
-            USAGE(1), 0x0c,                 // Start
-            LOGICAL_MINIMUM(1), 0x00,       // Logical Min: 0
-            LOGICAL_MAXIMUM(1), 0x01,       // Logical Max: 1
-            REPORT_SIZE(1), 0x01,           // 1 Bit per button
-            REPORT_COUNT(1), 0x04,          // 4 Buttons
-            INPUT(1), 0x02,                 // Data, Variable, Absolute
-        END_COLLECTION(0),
-    END_COLLECTION(0),
+#if GAMEPAD_OUTPUT_REPORT
+typedef HIDApplication<0x01,                  // Generic Desktop
+                       0x05,                  // Game Pad
+                       GamepadInputReport,
+                       GamepadOutputReport> GamepadApplication;
+#else
+typedef HIDApplication<0x01,                  // Generic Desktop
+                       0x05,                  // Game Pad
+                       GamepadInputReport> GamepadApplication;
+#endif
+#if GAMEPAD_TILT_REPORT
+typedef HIDApplication<0x01,                  // Generic Desktop
+                       0x08,                  // Multi-axis Controller
+                       GamepadTiltReport>::descriptor TiltApplication;
+#else
+typedef HIDBytes<> TiltApplication;
+#endif
+#if GAMEPAD_KEYBOARD_REPORT
+typedef HIDApplication<0x01,                  // Generic Desktop
+                       0x06,                  // Keyboard
+                       GamepadKeyboardReport>::descriptor KeyboardApplication;
+#else
+typedef HIDBytes<> KeyboardApplication;
+#endif
+#if GAMEPAD_CONSUMER_REPORT
+typedef HIDApplication<0x0c,                  // Consumer
+                       0x01,                  // Consumer Control
+                       GamepadConsumerReport>::descriptor ConsumerApplication;
+#else
+typedef HIDBytes<> ConsumerApplication;
+#endif
+
+static_assert(GAMEPAD_HUB_PLAYERS <= HUB_LINK_MAX_PLAYERS, "The hub reports up to 4 satellite players");
+
+/**
+ * One gamepad application per satellite player
+ */
+template <uint8_t Players>
+struct HubApplications
+{
+    typedef typename HIDConcat<typename HubApplications<Players - 1>::type,
+                               typename HIDApplication<0x01,  // Generic Desktop
+                                                       0x05,  // Game Pad
+                                                       GamepadPlayerReport<Players - 1>>::descriptor>::type type;
+};
+
+template <>
+struct HubApplications<0>
+{
+    typedef HIDBytes<> type;
 };
 
-static const uint8_t INPUT_DESCRIPTOR_REPORT[] = {0x01, 0x01};
+typedef HIDConcat<GamepadApplication::descriptor,
+                  TiltApplication,
+                  KeyboardApplication,
+                  ConsumerApplication,
+                  HubApplications<GAMEPAD_HUB_PLAYERS>::type>::type ReportMap;
+
+static const Gap::ConnectionParams_t ACTIVE_CONNECTION_PARAMS = {GAMEPAD_ACTIVE_CONNECTION_MIN_INTERVAL,
+                                                                  GAMEPAD_ACTIVE_CONNECTION_MAX_INTERVAL,
+                                                                  GAMEPAD_ACTIVE_CONNECTION_SLAVE_LATENCY,
+                                                                  GAMEPAD_SUPERVISION_TIMEOUT};
+static const Gap::ConnectionParams_t IDLE_CONNECTION_PARAMS = {GAMEPAD_IDLE_CONNECTION_MIN_INTERVAL,
+                                                                GAMEPAD_IDLE_CONNECTION_MAX_INTERVAL,
+                                                                GAMEPAD_IDLE_CONNECTION_SLAVE_LATENCY,
+                                                                GAMEPAD_SUPERVISION_TIMEOUT};
+
+#if GAMEPAD_DIAGNOSTICS
+static const UUID DIAGNOSTICS_CHARACTERISTIC_UUID("7d3a0001-0f6a-4c2e-9a47-6d6f8e1b2c3d");
+#endif
+
+#if GAMEPAD_PROFILE
+static const UUID PROFILE_CHARACTERISTIC_UUID("7d3a0002-0f6a-4c2e-9a47-6d6f8e1b2c3d");
+
+static bool isProfilePin(uint8_t pin)
+{
+    return pin < GAMEPAD_PROFILE_PINS || pin == GAMEPAD_PROFILE_NO_PIN;
+}
+
+/**
+ * @return true if every field of a valid profile is in range, and the profile can be used as it is
+ */
+static bool profileIsInRange(const GamepadProfile *profile)
+{
+    for (uint8_t i = 0; i < sizeof(profile->buttonPins); i++)
+    {
+        if (!isProfilePin(profile->buttonPins[i]))
+        {
+            return false;
+        }
+    }
+    for (uint8_t i = 0; i < sizeof(profile->analogPins); i++)
+    {
+        if (!isProfilePin(profile->analogPins[i]))
+        {
+            return false;
+        }
+    }
+    return profile->scanPeriod >= GAMEPAD_PROFILE_MIN_SCAN_PERIOD_US && profile->scanPeriod <= GAMEPAD_PROFILE_MAX_SCAN_PERIOD_US &&
+           profile->idleTimeout <= GAMEPAD_PROFILE_MAX_IDLE_TIMEOUT_MS && profile->reportMode <= GAMEPAD_REPORT_ON_RADIO;
+}
+#endif
+
+#if GAMEPAD_TILT_REPORT || GAMEPAD_ANALOG_AXES
+/**
+ * Whether an axis moved further than `threshold` from the reference, which then moves to the axes
+ */
+static bool isAxisActivity(int16_t *reference, const int16_t *axes, uint8_t count, int16_t threshold)
+{
+    bool moved = false;
+    for (uint8_t i = 0; i < count; i++)
+    {
+        int32_t distance = (int32_t)axes[i] - reference[i];
+        moved = moved || distance > threshold || distance < -threshold;
+    }
+    if (moved)
+    {
+        memcpy(reference, axes, count * sizeof(int16_t));
+    }
+    return moved;
+}
+#endif
+
+static const char PEER_STORAGE_KEY[] = "gamepadPeer";
+static const char LAYOUT_STORAGE_KEY[] = "gamepadGatt";
+
+/**
+ * Add bytes to a FNV-1a hash
+ */
+static uint32_t layoutHash(uint32_t hash, const uint8_t *data, uint16_t length)
+{
+    for (uint16_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ data[i]) * 16777619UL;
+    }
+    return hash;
+}
+
+static const uint8_t INPUT_DESCRIPTOR_REPORT[] = {GamepadInputReport::id, INPUT_REPORT};
 static const uint8_t REPORT_MAP_EXTERNAL_REPORT[] = {0x2A, 0x19};
+#if GAMEPAD_KEYBOARD_REPORT
+static const uint8_t KEYBOARD_DESCRIPTOR_REPORT[] = {GamepadKeyboardReport::id, INPUT_REPORT};
+#endif
+#if GAMEPAD_CONSUMER_REPORT
+static const uint8_t CONSUMER_DESCRIPTOR_REPORT[] = {GamepadConsumerReport::id, INPUT_REPORT};
+#endif
+#if GAMEPAD_OUTPUT_REPORT
+static const uint8_t OUTPUT_DESCRIPTOR_REPORT[] = {GamepadOutputReport::id, OUTPUT_REPORT};
+static const uint8_t OUTPUT_REPORT_INITIAL[GamepadOutputReport::size] = {0};
+#endif
+#if GAMEPAD_HUB_PLAYERS
+static uint8_t hubDescriptorReports[GAMEPAD_HUB_PLAYERS][2];
+#endif
+#if GAMEPAD_TILT_REPORT
+static const uint8_t TILT_DESCRIPTOR_REPORT[] = {GamepadTiltReport::id, INPUT_REPORT};
+
+/**
+ * Scale a filtered tilt value(milli-g) to the tilt report range
+ */
+static int32_t tiltAxisValue(int16_t milliG)
+{
+    int32_t value = milliG >> GAMEPAD_TILT_AXIS_SHIFT;
+    if (value < GamepadTiltAxes::minimum)
+    {
+        return GamepadTiltAxes::minimum;
+    }
+    if (value > GamepadTiltAxes::maximum)
+    {
+        return GamepadTiltAxes::maximum;
+    }
+    return value;
+}
+#endif
+
+/**
+ * Estimated attribute table bytes of one attribute: a fixed header and its value, word aligned
+ */
+static constexpr uint16_t gattAttributeBytes(uint16_t valueLength)
+{
+    return GAMEPAD_GATT_ATTRIBUTE_BYTES + ((valueLength + 3) & ~3);
+}
+
+/**
+ * Estimated attribute table bytes of one characteristic: its declaration, value, CCCD and descriptors
+ */
+static constexpr uint16_t gattCharacteristicBytes(uint16_t valueLength, bool notify, uint8_t descriptors, uint8_t uuidLength = 2)
+{
+    return gattAttributeBytes(3 + uuidLength) + gattAttributeBytes(valueLength) +
+           (notify ? gattAttributeBytes(2) : 0) + descriptors * gattAttributeBytes(2);
+}
+
+/**
+ * Estimated attribute table bytes the services added here take. The DAL's own services(GAP and GATT,
+ * and DFU, Event and Device Information unless removed) are not counted: they need room on top of these.
+ */
+static const uint16_t GATT_TABLE_BYTES =
+    gattAttributeBytes(2) +                                               // HID service
+    gattCharacteristicBytes(ReportMap::size, false, 1) +
+    gattCharacteristicBytes(1, false, 0) +                                // protocol mode
+    gattCharacteristicBytes(1, false, 0) +                                // control point
+    gattCharacteristicBytes(sizeof(RESPONSE_HID_INFORMATION), false, 0) +
+    gattCharacteristicBytes(GamepadInputReport::size, true, 1) +
+#if GAMEPAD_TILT_REPORT
+    gattCharacteristicBytes(GamepadTiltReport::size, true, 1) +
+#endif
+#if GAMEPAD_DIAGNOSTICS
+    gattCharacteristicBytes(sizeof(GamepadDiagnostics), false, 0, 16) +
+#endif
+#if GAMEPAD_KEYBOARD_REPORT
+    gattCharacteristicBytes(GamepadKeyboardReport::size, true, 1) +
+#endif
+#if GAMEPAD_CONSUMER_REPORT
+    gattCharacteristicBytes(GamepadConsumerReport::size, true, 1) +
+#endif
+#if GAMEPAD_OUTPUT_REPORT
+    gattCharacteristicBytes(GamepadOutputReport::size, false, 1) +
+#endif
+#if GAMEPAD_PROFILE
+    gattCharacteristicBytes(GAMEPAD_PROFILE_CHUNK_BYTES, false, 0, 16) +
+#endif
+    GAMEPAD_HUB_PLAYERS * gattCharacteristicBytes(GamepadPlayerReport<0>::size, true, 1) +
+#if GAMEPAD_BATTERY_SERVICE
+    gattAttributeBytes(2) + gattCharacteristicBytes(1, true, 0) +
+#endif
+#if GAMEPAD_ADDS_DEVICE_INFORMATION
+    gattAttributeBytes(2) + gattCharacteristicBytes(sizeof(DEVICE_MANUFACTURER) - 1, false, 0) +
+    gattCharacteristicBytes(sizeof(DEVICE_MODEL) - 1, false, 0) + gattCharacteristicBytes(sizeof(PnPID_t), false, 0) +
+#endif
+    0;
+
+#ifdef GAMEPAD_GATT_TABLE_SIZE
+static_assert(GATT_TABLE_BYTES <= GAMEPAD_GATT_TABLE_SIZE,
+              "The Gamepad services alone do not fit the GATT table: raise gatt_table_size, or remove reports or services");
+#endif
+
+#if GAMEPAD_PROFILE
+// erasing the profile page must not take the DAL's storage or the bonds with it
+#ifdef GAMEPAD_DAL_STORAGE_PAGE
+static_assert(GAMEPAD_PROFILE_PAGE != GAMEPAD_DAL_STORAGE_PAGE, "GAMEPAD_PROFILE_PAGE is the page of MicroBitStorage");
+#endif
+#ifdef GAMEPAD_DAL_SCRATCH_PAGE
+static_assert(GAMEPAD_PROFILE_PAGE != GAMEPAD_DAL_SCRATCH_PAGE, "GAMEPAD_PROFILE_PAGE is the scratch page of MicroBitStorage");
+#endif
+#ifdef GAMEPAD_BOND_PAGES
+static_assert(GAMEPAD_PROFILE_PAGE > GAMEPAD_BOND_PAGES, "GAMEPAD_PROFILE_PAGE is a page of the bond storage");
+#endif
+#endif
+
+#if GAMEPAD_BATTERY_SERVICE
+/**
+ * Storage of the battery service, constructed once the BLE stack is initialized
+ */
+alignas(HIDBatteryService) static uint8_t batteryServiceStorage[sizeof(HIDBatteryService)];
+#endif
+
+#if GAMEPAD_ADDS_DEVICE_INFORMATION
+/**
+ * Storage of the Device Information Service, constructed once the BLE stack is initialized
+ */
+alignas(HIDDeviceInformationService) static uint8_t deviceInformationServiceStorage[sizeof(HIDDeviceInformationService)];
+#endif
+
+/**
+ * Storage of one GATT object, which has no default constructor: it is constructed in place once
+ */
+template <typename T>
+struct GattStorage
+{
+    alignas(T) uint8_t bytes[sizeof(T)];
+
+    template <typename... Args>
+    T &construct(Args... args)
+    {
+        return *new (bytes) T(args...);
+    }
+};
+
+/**
+ * Characteristics of the HID service, at most
+ */
+static const uint8_t HID_CHARACTERISTICS = 5 + (GAMEPAD_TILT_REPORT ? 1 : 0) + (GAMEPAD_DIAGNOSTICS ? 1 : 0) +
+                                           (GAMEPAD_KEYBOARD_REPORT ? 1 : 0) + (GAMEPAD_CONSUMER_REPORT ? 1 : 0) +
+                                           (GAMEPAD_OUTPUT_REPORT ? 1 : 0) + (GAMEPAD_PROFILE ? 1 : 0) + GAMEPAD_HUB_PLAYERS;
+
+/**
+ * Storage of the HID service. The GATT server keeps pointers to the characteristics and their descriptors
+ * once they are added, so they live as long as the service, constructed once the BLE stack is initialized.
+ */
+struct HidServiceStorage
+{
+    GattStorage<GattCharacteristic> protocolMode;
+    GattStorage<GattAttribute> inputReportDescriptor;
+    GattAttribute *inputReportDescriptors[1];
+    GattStorage<GattCharacteristic> inputReport;
+#if GAMEPAD_TILT_REPORT
+    GattStorage<GattAttribute> tiltReportDescriptor;
+    GattAttribute *tiltReportDescriptors[1];
+    GattStorage<GattCharacteristic> tiltReport;
+#endif
+    GattStorage<GattAttribute> reportMapDescriptor;
+    GattAttribute *reportMapDescriptors[1];
+    GattStorage<GattCharacteristic> reportMap;
+    GattStorage<GattCharacteristic> hidInformation;
+    GattStorage<GattCharacteristic> hidControlPoint;
+#if GAMEPAD_KEYBOARD_REPORT
+    GattStorage<GattAttribute> keyboardReportDescriptor;
+    GattAttribute *keyboardReportDescriptors[1];
+    GattStorage<GattCharacteristic> keyboardReport;
+#endif
+#if GAMEPAD_CONSUMER_REPORT
+    GattStorage<GattAttribute> consumerReportDescriptor;
+    GattAttribute *consumerReportDescriptors[1];
+    GattStorage<GattCharacteristic> consumerReport;
+#endif
+#if GAMEPAD_DIAGNOSTICS
+    GattStorage<GattCharacteristic> diagnostics;
+#endif
+#if GAMEPAD_OUTPUT_REPORT
+    GattStorage<GattAttribute> outputReportDescriptor;
+    GattAttribute *outputReportDescriptors[1];
+    GattStorage<GattCharacteristic> outputReport;
+#endif
+#if GAMEPAD_PROFILE
+    GattStorage<GattCharacteristic> profile;
+#endif
+#if GAMEPAD_HUB_PLAYERS
+    GattStorage<GattAttribute> hubReportDescriptor[GAMEPAD_HUB_PLAYERS];
+    GattAttribute *hubReportDescriptors[GAMEPAD_HUB_PLAYERS][1];
+    GattStorage<GattCharacteristic> hubReport[GAMEPAD_HUB_PLAYERS];
+#endif
+    GattCharacteristic *characteristics[HID_CHARACTERISTICS];
+    GattStorage<GattService> service;
+};
+
+static HidServiceStorage hidServiceStorage;
+
+const uint32_t SERVICE_RAM_BYTES = sizeof(BluetoothGamepadService) + sizeof(HidServiceStorage)
+#if GAMEPAD_BATTERY_SERVICE
+    + sizeof(HIDBatteryService)
+#endif
+#if GAMEPAD_ADDS_DEVICE_INFORMATION
+    + sizeof(HIDDeviceInformationService)
+#endif
+    ;
+
+static_assert(SERVICE_RAM_BYTES <= GAMEPAD_RAM_BUDGET,
+              "The Gamepad services take more RAM than GAMEPAD_RAM_BUDGET: remove the input scanner, the sequencer, "
+              "reports or services, or shorten the queues and the trace");
 }
 
 static bool isInitializedService = false;
 
+/**
+ * The service instance, for the report interrupt and the BLE callbacks that take plain functions
+ */
+static BluetoothGamepadService *serviceInstance = NULL;
+
+extern "C" void SWI3_IRQHandler(void)
+{
+    if (serviceInstance != NULL)
+    {
+        serviceInstance->sendCallback();
+    }
+}
+
+#if GAMEPAD_ANALOG_AXES
+extern "C" void ADC_IRQHandler(void)
+{
+    if (serviceInstance != NULL)
+    {
+        serviceInstance->onAnalogSample();
+    }
+}
+#endif
+
 /**
  * Constructor
  * @param dev BLE device
  */
 BluetoothGamepadService::BluetoothGamepadService(BLEDevice *dev) : ble(*dev)
 {
+    memset(startupTimes, 0, sizeof(startupTimes));
+    markStartup(GAMEPAD_STARTUP_BEGIN);
     if (isInitializedService == false)
     {
         startService();
@@ -79,61 +427,232 @@ void BluetoothGamepadService::startService()
 {
     memset(inputReportData, 0, sizeof(inputReportData));
     connected = false;
+    memset(&connectionParams, 0, sizeof(connectionParams));
+    activeConnectionParams = &ACTIVE_CONNECTION_PARAMS;
+    idleConnectionParams = &IDLE_CONNECTION_PARAMS;
+    idleTimeoutPeriod = GAMEPAD_IDLE_TIMEOUT_MS;
+    lastInputTime = 0;
+    connectionIsIdle = false;
+    wakeups = 0;
+    wakeupsCounted = 0;
+    wakeupsCountTime = gamepadClockMs();
+    wakeupRate = 0;
+    advertisingPhase = ADVERTISING_GENERAL;
+    generalAdvertisingTime = 0;
+    disconnectionTime = 0;
+    reconnectTime = 0;
+    memset(&connectionPeer, 0, sizeof(connectionPeer));
+    peerIsStored = gamepadStorageGet(PEER_STORAGE_KEY, &bondedPeer, sizeof(bondedPeer));
     protocolMode = REPORT_PROTOCOL;
     reportTickerIsActive = false;
+    reportIsScheduled = false;
+    lastReportTime = gamepadClockUs();
+    reportMinInterval = GAMEPAD_REPORT_MIN_INTERVAL_US;
+    reportKeepAlive = GAMEPAD_REPORT_KEEP_ALIVE_US;
+    reportIsBlocked = false;
+    reportIsPending = false;
+    keepAliveIsDue = false;
+    reportMode = GAMEPAD_REPORT_ON_CHANGE;
+    radioNotificationIsActive = false;
+    txQueued = 0;
+    txCompleted = 0;
+    buttonsState = 0;
+    updateIsOpen = false;
+    updatedButtonsState = 0;
+    sentButtons = 0;
+#if GAMEPAD_INPUT_SCANNER
+    scanPeriod = GAMEPAD_SCAN_PERIOD_US;
+    scannedButtonsState = 0;
+    sentScannedButtons = 0;
+    inputScanner.setDebounce(GAMEPAD_DEBOUNCE_SCANS);
+#endif
+#if GAMEPAD_SEQUENCER
+    sequencerIsRunning = false;
+    sequencedButtons = 0;
+    sequencedSuppressed = 0;
+    sentSequencedButtons = 0;
+    sentSequencedSuppressed = 0;
+#endif
+#if GAMEPAD_ANALOG_AXES
+    analogPeriod = GAMEPAD_ANALOG_PERIOD_US;
+    analogBurstIsRunning = false;
+    adcIsReserved = false;
+    for (uint8_t i = 0; i < AnalogSampler::AXES; i++)
+    {
+        analogAxes[i] = 0;
+    }
+    memset(analogActivityAxes, 0, sizeof(analogActivityAxes));
+    analogSampler.setOversampling(GAMEPAD_ANALOG_OVERSAMPLING);
+    analogSampler.setDeadzone(GAMEPAD_ANALOG_DEADZONE);
+#endif
+#if GAMEPAD_TRACE_EVENTS
+    traceIsRecording = false;
+    traceIsPlaying = false;
+#endif
+#if GAMEPAD_TILT_REPORT
+    tiltSamplingPeriod = 0;
+    tiltSamplerIsRunning = false;
+    memset(tiltActivity, 0, sizeof(tiltActivity));
+#endif
+#if GAMEPAD_KEYBOARD_REPORT
+    keyboardModifiers = 0;
+    memset(keyboardKeys, 0, sizeof(keyboardKeys));
+#endif
+#if GAMEPAD_PROFILE
+    profileIsLoaded = false;
+    profileCommitIsPending = false;
+#endif
+#if GAMEPAD_HUB_PLAYERS
+    memset(hubSentReports, 0, sizeof(hubSentReports));
+    hubDirtyPlayers = 0;
+    hubLatencyMax = 0;
+    hubLatencyTotal = 0;
+    hubLatencyCount = 0;
+#endif
+#if GAMEPAD_OUTPUT_REPORT
+    rumblePin = 0xff;
+    ledFeedbackIsEnabled = false;
+    outputRumble = 0;
+    outputRumbleDuration = 0;
+    outputLeds = 0;
+#endif
 
     ble.init();
+    markStartup(GAMEPAD_STARTUP_BLE_INIT);
     ble.securityManager().init(true, false, SecurityManager::IO_CAPS_NONE);
+    markStartup(GAMEPAD_STARTUP_SECURITY);
 
-#if !CONFIG_ENABLED(MICROBIT_BLE_DEVICE_INFORMATION_SERVICE)
-    // Device Information Service
-    PnPID_t pnpID;
-    pnpID.vendorID_source = 0x2;
-    pnpID.vendorID = 0x0D28;
-    pnpID.productID = 0x0204;
-    pnpID.productVersion = 0x0100;
+    txCapacity = GAMEPAD_TX_BUFFERS;
+    if (txCapacity == 0 && !gamepadTxBufferCount(txCapacity))
+    {
+        txCapacity = 1;
+    }
 
-    HIDDeviceInformationService hidDeviceInformationService(ble, "BBC", "uBit", &pnpID);
+#if GAMEPAD_ADDS_DEVICE_INFORMATION
+    // Device Information Service
+    new (deviceInformationServiceStorage) HIDDeviceInformationService(ble, DEVICE_MANUFACTURER, DEVICE_MODEL, const_cast<PnPID_t *>(&DEVICE_PNP_ID));
 #endif
 
     // Gamepad Service
-    GattCharacteristic protocolModeCharacteristic(GattCharacteristic::UUID_PROTOCOL_MODE_CHAR,
-                                                                          &protocolMode, 1, 1,
-                                                                          GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE_WITHOUT_RESPONSE);
-
-    GattAttribute inputReportDescriptor(BLE_UUID_DESCRIPTOR_REPORT_REFERENCE, const_cast<uint8_t *>(INPUT_DESCRIPTOR_REPORT), 2, 2, false);
-    GattAttribute *inputReportDescriptors[] = { &inputReportDescriptor };
-    GattCharacteristic inputReportCharacteristic(GattCharacteristic::UUID_REPORT_CHAR,
-                                                 inputReportData, sizeof(inputReportData), sizeof(inputReportData),
-                                                 GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ |
-                                                     GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY |
-                                                     GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE,
-                                                 inputReportDescriptors, 1);
-
-    GattAttribute reportMapExternalReportDescriptor(BLE_UUID_DESCRIPTOR_EXTERNAL_REPORT_REFERENCE, const_cast<uint8_t *>(REPORT_MAP_EXTERNAL_REPORT), 2, 2, false);
-    GattAttribute *reportMapDescriptors[] = { &reportMapExternalReportDescriptor };
-    GattCharacteristic reportMapCharacteristic(GattCharacteristic::UUID_REPORT_MAP_CHAR,
-                                                const_cast<uint8_t *>(REPORT_MAP), sizeof(REPORT_MAP), sizeof(REPORT_MAP),
-                                                GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ,
-                                                reportMapDescriptors, 1);
-
-    GattCharacteristic hidInformationCharacteristic(GattCharacteristic::UUID_HID_INFORMATION_CHAR,
-                                                                             const_cast<uint8_t *>(RESPONSE_HID_INFORMATION), sizeof(RESPONSE_HID_INFORMATION), sizeof(RESPONSE_HID_INFORMATION),
-                                                                             GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ);
-
-    GattCharacteristic hidControlPointCharacteristic(GattCharacteristic::UUID_HID_CONTROL_POINT_CHAR,
-                                                                              &controlPointCommand, 1, 1,
-                                                                              GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE_WITHOUT_RESPONSE);
-
-    GattCharacteristic *gamepadCharacteristics[]{
-        &reportMapCharacteristic,
-        &protocolModeCharacteristic,
-        &hidControlPointCharacteristic,
-        &hidInformationCharacteristic,
-        &inputReportCharacteristic,
-    };
-
-    GattService gamepadService(GattService::UUID_HUMAN_INTERFACE_DEVICE_SERVICE, gamepadCharacteristics, sizeof(gamepadCharacteristics) / sizeof(GattCharacteristic *));
+    HidServiceStorage &gatt = hidServiceStorage;
+    GattCharacteristic &protocolModeCharacteristic = gatt.protocolMode.construct(GattCharacteristic::UUID_PROTOCOL_MODE_CHAR,
+                                                                                &protocolMode, 1, 1,
+                                                                                GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE_WITHOUT_RESPONSE);
+
+    gatt.inputReportDescriptors[0] = &gatt.inputReportDescriptor.construct(BLE_UUID_DESCRIPTOR_REPORT_REFERENCE, const_cast<uint8_t *>(INPUT_DESCRIPTOR_REPORT), 2, 2, false);
+    GattCharacteristic &inputReportCharacteristic = gatt.inputReport.construct(GattCharacteristic::UUID_REPORT_CHAR,
+                                                                              inputReportData, sizeof(inputReportData), sizeof(inputReportData),
+                                                                              GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ |
+                                                                                  GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY,
+                                                                              gatt.inputReportDescriptors, 1);
+
+#if GAMEPAD_TILT_REPORT
+    gatt.tiltReportDescriptors[0] = &gatt.tiltReportDescriptor.construct(BLE_UUID_DESCRIPTOR_REPORT_REFERENCE, const_cast<uint8_t *>(TILT_DESCRIPTOR_REPORT), 2, 2, false);
+    GattCharacteristic &tiltReportCharacteristic = gatt.tiltReport.construct(GattCharacteristic::UUID_REPORT_CHAR,
+                                                                            tiltReport.value, sizeof(tiltReport.value), sizeof(tiltReport.value),
+                                                                            GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ |
+                                                                                GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY,
+                                                                            gatt.tiltReportDescriptors, 1);
+#endif
+
+    gatt.reportMapDescriptors[0] = &gatt.reportMapDescriptor.construct(BLE_UUID_DESCRIPTOR_EXTERNAL_REPORT_REFERENCE, const_cast<uint8_t *>(REPORT_MAP_EXTERNAL_REPORT), 2, 2, false);
+    GattCharacteristic &reportMapCharacteristic = gatt.reportMap.construct(GattCharacteristic::UUID_REPORT_MAP_CHAR,
+                                                                          const_cast<uint8_t *>(ReportMap::data), ReportMap::size, ReportMap::size,
+                                                                          GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ,
+                                                                          gatt.reportMapDescriptors, 1);
+
+    GattCharacteristic &hidInformationCharacteristic = gatt.hidInformation.construct(GattCharacteristic::UUID_HID_INFORMATION_CHAR,
+                                                                                    const_cast<uint8_t *>(RESPONSE_HID_INFORMATION), sizeof(RESPONSE_HID_INFORMATION), sizeof(RESPONSE_HID_INFORMATION),
+                                                                                    GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ);
+
+    GattCharacteristic &hidControlPointCharacteristic = gatt.hidControlPoint.construct(GattCharacteristic::UUID_HID_CONTROL_POINT_CHAR,
+                                                                                      &controlPointCommand, 1, 1,
+                                                                                      GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE_WITHOUT_RESPONSE);
+
+#if GAMEPAD_KEYBOARD_REPORT
+    gatt.keyboardReportDescriptors[0] = &gatt.keyboardReportDescriptor.construct(BLE_UUID_DESCRIPTOR_REPORT_REFERENCE, const_cast<uint8_t *>(KEYBOARD_DESCRIPTOR_REPORT), 2, 2, false);
+    GattCharacteristic &keyboardReportCharacteristic = gatt.keyboardReport.construct(GattCharacteristic::UUID_REPORT_CHAR,
+                                                                                    keyboardReport.value, sizeof(keyboardReport.value), sizeof(keyboardReport.value),
+                                                                                    GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ |
+                                                                                        GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY,
+                                                                                    gatt.keyboardReportDescriptors, 1);
+#endif
+
+#if GAMEPAD_CONSUMER_REPORT
+    gatt.consumerReportDescriptors[0] = &gatt.consumerReportDescriptor.construct(BLE_UUID_DESCRIPTOR_REPORT_REFERENCE, const_cast<uint8_t *>(CONSUMER_DESCRIPTOR_REPORT), 2, 2, false);
+    GattCharacteristic &consumerReportCharacteristic = gatt.consumerReport.construct(GattCharacteristic::UUID_REPORT_CHAR,
+                                                                                    consumerReport.value, sizeof(consumerReport.value), sizeof(consumerReport.value),
+                                                                                    GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ |
+                                                                                        GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY,
+                                                                                    gatt.consumerReportDescriptors, 1);
+#endif
+
+#if GAMEPAD_DIAGNOSTICS
+    memset(&diagnostics, 0, sizeof(diagnostics));
+    GattCharacteristic &diagnosticsCharacteristic = gatt.diagnostics.construct(DIAGNOSTICS_CHARACTERISTIC_UUID,
+                                                                              reinterpret_cast<uint8_t *>(&diagnostics), sizeof(diagnostics), sizeof(diagnostics),
+                                                                              GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ);
+#endif
+
+#if GAMEPAD_OUTPUT_REPORT
+    gatt.outputReportDescriptors[0] = &gatt.outputReportDescriptor.construct(BLE_UUID_DESCRIPTOR_REPORT_REFERENCE, const_cast<uint8_t *>(OUTPUT_DESCRIPTOR_REPORT), 2, 2, false);
+    GattCharacteristic &outputReportCharacteristic = gatt.outputReport.construct(GattCharacteristic::UUID_REPORT_CHAR,
+                                                                                const_cast<uint8_t *>(OUTPUT_REPORT_INITIAL), sizeof(OUTPUT_REPORT_INITIAL), sizeof(OUTPUT_REPORT_INITIAL),
+                                                                                GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ |
+                                                                                    GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE |
+                                                                                    GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE_WITHOUT_RESPONSE,
+                                                                                gatt.outputReportDescriptors, 1);
+#endif
+
+#if GAMEPAD_PROFILE
+    // written in chunks: the offset in the profile, then its bytes
+    GattCharacteristic &profileCharacteristic = gatt.profile.construct(PROFILE_CHARACTERISTIC_UUID,
+                                                                      reinterpret_cast<uint8_t *>(&stagedProfile), 0, GAMEPAD_PROFILE_CHUNK_BYTES,
+                                                                      GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE);
+#endif
+
+    // Handles are assigned in this order. Keep it stable, and append new characteristics at the end,
+    // so that bonded hosts can keep using their cached attribute table across builds.
+    uint8_t characteristicCount = 0;
+    gatt.characteristics[characteristicCount++] = &reportMapCharacteristic;
+    gatt.characteristics[characteristicCount++] = &protocolModeCharacteristic;
+    gatt.characteristics[characteristicCount++] = &hidControlPointCharacteristic;
+    gatt.characteristics[characteristicCount++] = &hidInformationCharacteristic;
+    gatt.characteristics[characteristicCount++] = &inputReportCharacteristic;
+#if GAMEPAD_TILT_REPORT
+    gatt.characteristics[characteristicCount++] = &tiltReportCharacteristic;
+#endif
+#if GAMEPAD_DIAGNOSTICS
+    gatt.characteristics[characteristicCount++] = &diagnosticsCharacteristic;
+#endif
+#if GAMEPAD_KEYBOARD_REPORT
+    gatt.characteristics[characteristicCount++] = &keyboardReportCharacteristic;
+#endif
+#if GAMEPAD_CONSUMER_REPORT
+    gatt.characteristics[characteristicCount++] = &consumerReportCharacteristic;
+#endif
+#if GAMEPAD_OUTPUT_REPORT
+    gatt.characteristics[characteristicCount++] = &outputReportCharacteristic;
+#endif
+#if GAMEPAD_PROFILE
+    gatt.characteristics[characteristicCount++] = &profileCharacteristic;
+#endif
+#if GAMEPAD_HUB_PLAYERS
+    // one report per satellite player
+    for (uint8_t i = 0; i < GAMEPAD_HUB_PLAYERS; i++)
+    {
+        hubDescriptorReports[i][0] = GAMEPAD_HUB_REPORT_ID + i;
+        hubDescriptorReports[i][1] = INPUT_REPORT;
+        gatt.hubReportDescriptors[i][0] = &gatt.hubReportDescriptor[i].construct(BLE_UUID_DESCRIPTOR_REPORT_REFERENCE, hubDescriptorReports[i], 2, 2, false);
+        gatt.characteristics[characteristicCount++] = &gatt.hubReport[i].construct(GattCharacteristic::UUID_REPORT_CHAR,
+                                                                                   hubSentReports[i], sizeof(hubSentReports[i]), sizeof(hubSentReports[i]),
+                                                                                   GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ |
+                                                                                       GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY,
+                                                                                   gatt.hubReportDescriptors[i], 1);
+    }
+#endif
+
+    GattService &gamepadService = gatt.service.construct(GattService::UUID_HUMAN_INTERFACE_DEVICE_SERVICE, gatt.characteristics, characteristicCount);
 
     ble.gattServer().addService(gamepadService);
 
@@ -142,17 +661,115 @@ void BluetoothGamepadService::startService()
     reportMapCharacteristic.requireSecurity(SecurityManager::SECURITY_MODE_ENCRYPTION_NO_MITM);
     hidInformationCharacteristic.requireSecurity(SecurityManager::SECURITY_MODE_ENCRYPTION_NO_MITM);
     hidControlPointCharacteristic.requireSecurity(SecurityManager::SECURITY_MODE_ENCRYPTION_NO_MITM);
+#if GAMEPAD_TILT_REPORT
+    tiltReportCharacteristic.requireSecurity(SecurityManager::SECURITY_MODE_ENCRYPTION_NO_MITM);
+#endif
+#if GAMEPAD_KEYBOARD_REPORT
+    keyboardReportCharacteristic.requireSecurity(SecurityManager::SECURITY_MODE_ENCRYPTION_NO_MITM);
+#endif
+#if GAMEPAD_CONSUMER_REPORT
+    consumerReportCharacteristic.requireSecurity(SecurityManager::SECURITY_MODE_ENCRYPTION_NO_MITM);
+#endif
+#if GAMEPAD_OUTPUT_REPORT
+    outputReportCharacteristic.requireSecurity(SecurityManager::SECURITY_MODE_ENCRYPTION_NO_MITM);
+#endif
+#if GAMEPAD_PROFILE
+    profileCharacteristic.requireSecurity(SecurityManager::SECURITY_MODE_ENCRYPTION_NO_MITM);
+#endif
+#if GAMEPAD_HUB_PLAYERS
+    for (uint8_t i = 0; i < GAMEPAD_HUB_PLAYERS; i++)
+    {
+        // the hub reports are the last characteristics
+        GattCharacteristic *hubReportCharacteristic = gatt.characteristics[characteristicCount - GAMEPAD_HUB_PLAYERS + i];
+        hubReportCharacteristic->requireSecurity(SecurityManager::SECURITY_MODE_ENCRYPTION_NO_MITM);
+        hubValueHandles[i] = hubReportCharacteristic->getValueHandle();
+    }
+#endif
 
     inputReportValueHandle = inputReportCharacteristic.getValueHandle();
+    protocolModeValueHandle = protocolModeCharacteristic.getValueHandle();
+    controlPointValueHandle = hidControlPointCharacteristic.getValueHandle();
+#if GAMEPAD_OUTPUT_REPORT
+    outputReportValueHandle = outputReportCharacteristic.getValueHandle();
+#endif
+#if GAMEPAD_TILT_REPORT
+    tiltReport.valueHandle = tiltReportCharacteristic.getValueHandle();
+#endif
+#if GAMEPAD_KEYBOARD_REPORT
+    keyboardReport.valueHandle = keyboardReportCharacteristic.getValueHandle();
+#endif
+#if GAMEPAD_CONSUMER_REPORT
+    consumerReport.valueHandle = consumerReportCharacteristic.getValueHandle();
+#endif
+#if GAMEPAD_DIAGNOSTICS
+    diagnosticsValueHandle = diagnosticsCharacteristic.getValueHandle();
+#endif
+#if GAMEPAD_PROFILE
+    profileValueHandle = profileCharacteristic.getValueHandle();
+#endif
+
+    // the layout signature covers everything a host caches: handles, properties and the report map
+    uint32_t layout = layoutHash(2166136261UL, ReportMap::data, ReportMap::size);
+    uint16_t serviceHandle = gamepadService.getHandle();
+    layout = layoutHash(layout, reinterpret_cast<const uint8_t *>(&serviceHandle), sizeof(serviceHandle));
+#if GAMEPAD_BATTERY_SERVICE
+    // after the HID service, so that its handles do not move
+    batteryService = new (batteryServiceStorage) HIDBatteryService(ble, 100);
+    batteryLevelIsDirty = false;
+    GattAttribute::Handle_t batteryHandle = batteryService->getValueHandle();
+    layout = layoutHash(layout, reinterpret_cast<const uint8_t *>(&batteryHandle), sizeof(batteryHandle));
+    gamepadStartFiber(&BluetoothGamepadService::batteryMonitorEntry, this);
+#endif
+    for (uint8_t i = 0; i < characteristicCount; i++)
+    {
+        uint8_t attributes[] = {(uint8_t)gatt.characteristics[i]->getValueHandle(),
+                                (uint8_t)(gatt.characteristics[i]->getValueHandle() >> 8),
+                                gatt.characteristics[i]->getProperties(),
+                                gatt.characteristics[i]->getDescriptorCount()};
+        layout = layoutHash(layout, attributes, sizeof(attributes));
+    }
+    gattLayout = layout;
+    uint32_t storedLayout;
+    layoutIsChanged = !gamepadStorageGet(LAYOUT_STORAGE_KEY, &storedLayout, sizeof(storedLayout)) || storedLayout != gattLayout;
 
     ble.gap().onConnection(this, &BluetoothGamepadService::onConnection);
     ble.gap().onDisconnection(this, &BluetoothGamepadService::onDisconnection);
+    ble.gattServer().onDataSent(this, &BluetoothGamepadService::onDataSent);
+    ble.gattServer().onDataWritten(this, &BluetoothGamepadService::onDataWritten);
+    ble.gap().onTimeout(&BluetoothGamepadService::onGapTimeout);
+    ble.securityManager().onLinkSecured(&BluetoothGamepadService::onLinkSecured);
+    gamepadListen(GAMEPAD_EVT_ID, GAMEPAD_EVT_PEER_CHANGED, this, &BluetoothGamepadService::onPeerChanged);
+    gamepadListen(GAMEPAD_EVT_ID, GAMEPAD_EVT_LAYOUT_CHANGED, this, &BluetoothGamepadService::onLayoutChanged);
+#if GAMEPAD_PROFILE
+    gamepadListen(GAMEPAD_EVT_ID, GAMEPAD_EVT_PROFILE_WRITTEN, this, &BluetoothGamepadService::onProfileWritten);
+#endif
 
-    startReportTicker();
+    serviceInstance = this;
+    gamepadReportIrqEnable();
+#if GAMEPAD_ANALOG_AXES
+    gamepadAdcIrqEnable();
+#endif
+    markStartup(GAMEPAD_STARTUP_GATT);
+
+#if GAMEPAD_PROFILE
+    // read in place: no copy and no script
+    const GamepadProfile *profile = reinterpret_cast<const GamepadProfile *>(gamepadFlashPage(GAMEPAD_PROFILE_PAGE));
+    if (gamepadProfileIsValid(profile) && profileIsInRange(profile))
+    {
+        applyProfile(profile);
+        profileIsLoaded = true;
+    }
+#endif
+
+    setupAdvertising();
 }
 
-void BluetoothGamepadService::startAdvertise()
+/**
+ * Set the advertising payload and the preferred connection parameters, once: they do not change between connections
+ */
+void BluetoothGamepadService::setupAdvertising()
 {
+    // replaces the advertising the DAL may have started
     ble.gap().stopAdvertising();
     ble.gap().clearAdvertisingPayload();
 
@@ -163,116 +780,2080 @@ void BluetoothGamepadService::startAdvertise()
 
     ble.gap().accumulateAdvertisingPayload(GapAdvertisingData::GAMEPAD);
 
-    uint16_t minInterval = Gap::MSEC_TO_GAP_DURATION_UNITS(25);
-    if (minInterval < 6)
-    {
-        minInterval = 6;
-    }
-    uint16_t maxInterval = minInterval * 2;
-    Gap::ConnectionParams_t params = {minInterval, maxInterval, 0, 3200}; // timeout in 32 seconds
-    ble.gap().setPreferredConnectionParams(&params);
-
-    ble.gap().setAdvertisingType(GapAdvertisingParams::ADV_CONNECTABLE_UNDIRECTED);
-    ble.gap().setAdvertisingInterval(50);
-    ble.gap().setAdvertisingPolicyMode(Gap::ADV_POLICY_IGNORE_WHITELIST);
-    ble.gap().startAdvertising();
-}
-
-void BluetoothGamepadService::startReportTicker()
-{
-    if (reportTickerIsActive)
-    {
-        return;
-    }
-    reportTicker.attach_us(this, &BluetoothGamepadService::sendCallback, 24000);
-    reportTickerIsActive = true;
+    // connections start with the active parameters
+    ble.gap().setPreferredConnectionParams(activeConnectionParams);
 }
 
-void BluetoothGamepadService::stopReportTicker()
+/**
+ * Start advertising, after the service started or a host disconnected: advertising is stopped in both cases
+ */
+void BluetoothGamepadService::startAdvertise()
 {
-    if (!reportTickerIsActive)
-    {
-        return;
-    }
-    reportTicker.detach();
-    reportTickerIsActive = false;
+    startAdvertisingPhase(peerIsStored ? ADVERTISING_DIRECTED : ADVERTISING_WHITELIST);
+    markStartup(GAMEPAD_STARTUP_ADVERTISING);
 }
 
-void BluetoothGamepadService::onConnection(const Gap::ConnectionCallbackParams_t *params)
+uint32_t BluetoothGamepadService::getStartupTime(GamepadStartupStage stage)
 {
-    ble.gap().stopAdvertising();
-    buttonsState = 0;
-    connected = true;
+    return stage < GAMEPAD_STARTUP_STAGES ? startupTimes[stage] : 0;
 }
 
-void BluetoothGamepadService::onDisconnection(const Gap::DisconnectionCallbackParams_t *params)
+/**
+ * Record the time of a stage, the first time it completes
+ */
+void BluetoothGamepadService::markStartup(GamepadStartupStage stage)
 {
-    connected = false;
-    startAdvertise();
+    if (startupTimes[stage] == 0)
+    {
+        startupTimes[stage] = gamepadClockUs();
+    }
 }
 
 /**
- * Toggle the state of one button
+ * Start one phase of advertising. Each phase falls back to the next one when it can not start, or on timeout.
+ *  - ADVERTISING_DIRECTED: high duty directed advertising to the last bonded host, for 1.28 seconds
+ *  - ADVERTISING_WHITELIST: fast advertising accepting bonded hosts only
+ *  - ADVERTISING_GENERAL: a burst of advertising accepting any host
+ *  - ADVERTISING_SLOW: slow advertising accepting any host, until connected or woken up by input
  */
-void BluetoothGamepadService::setButton(GamepadButton button, ButtonState state)
+void BluetoothGamepadService::startAdvertisingPhase(AdvertisingPhase phase)
 {
-    if (state == BUTTON_UP)
+    advertisingPhase = phase;
+
+    if (advertisingPhase == ADVERTISING_DIRECTED)
     {
-        buttonsState &= ~(button);
+        if (gamepadAdvertiseDirected(bondedPeer))
+        {
+            return;
+        }
+        advertisingPhase = ADVERTISING_WHITELIST;
     }
-    else
+
+    if (advertisingPhase == ADVERTISING_WHITELIST)
     {
-        buttonsState |= button;
+        BLEProtocol::Address_t bondedAddresses[GAMEPAD_MAXIMUM_BONDS];
+        Gap::Whitelist_t whitelist;
+        whitelist.addresses = bondedAddresses;
+        whitelist.size = 0;
+        whitelist.capacity = GAMEPAD_MAXIMUM_BONDS;
+        ble.securityManager().getAddressesFromBondTable(whitelist);
+
+        if (whitelist.size > 0 && ble.gap().setWhitelist(whitelist) == BLE_ERROR_NONE)
+        {
+            ble.gap().setAdvertisingType(GapAdvertisingParams::ADV_CONNECTABLE_UNDIRECTED);
+            ble.gap().setAdvertisingInterval(GAMEPAD_FAST_ADVERTISING_INTERVAL);
+            ble.gap().setAdvertisingTimeout(GAMEPAD_WHITELIST_ADVERTISING_TIMEOUT);
+            ble.gap().setAdvertisingPolicyMode(Gap::ADV_POLICY_FILTER_CONN_REQS);
+            ble.gap().startAdvertising();
+            return;
+        }
+        advertisingPhase = ADVERTISING_GENERAL;
+    }
+
+    bool isSlow = advertisingPhase == ADVERTISING_SLOW;
+    if (!isSlow)
+    {
+        generalAdvertisingTime = gamepadClockMs();
+    }
+    ble.gap().setAdvertisingType(GapAdvertisingParams::ADV_CONNECTABLE_UNDIRECTED);
+    ble.gap().setAdvertisingInterval(isSlow ? GAMEPAD_SLOW_ADVERTISING_INTERVAL : GAMEPAD_GENERAL_ADVERTISING_INTERVAL);
+    ble.gap().setAdvertisingTimeout(isSlow ? 0 : GAMEPAD_GENERAL_ADVERTISING_TIMEOUT);
+    ble.gap().setAdvertisingPolicyMode(Gap::ADV_POLICY_IGNORE_WHITELIST);
+    ble.gap().startAdvertising();
+}
+
+void BluetoothGamepadService::onGapTimeout(Gap::TimeoutSource_t source)
+{
+    if (serviceInstance == NULL || source != Gap::TIMEOUT_SRC_ADVERTISING || serviceInstance->connected)
+    {
+        return;
+    }
+
+    if (serviceInstance->advertisingPhase == ADVERTISING_DIRECTED)
+    {
+        serviceInstance->startAdvertisingPhase(ADVERTISING_WHITELIST);
+    }
+    else if (serviceInstance->advertisingPhase == ADVERTISING_WHITELIST)
+    {
+        serviceInstance->startAdvertisingPhase(ADVERTISING_GENERAL);
+    }
+    else if (serviceInstance->advertisingPhase == ADVERTISING_GENERAL)
+    {
+        serviceInstance->startAdvertisingPhase(ADVERTISING_SLOW);
+    }
+}
+
+/**
+ * Once a link with a bonded host is encrypted:
+ *  - tell a host with a cached attribute table that the layout changed, if it did since the last build
+ *  - remember the host, the target of directed advertising after a disconnection
+ * A link only encrypted, without a bond, changes neither: the host keeps nothing for the next connection.
+ */
+void BluetoothGamepadService::onLinkSecured(Gap::Handle_t handle, SecurityManager::SecurityMode_t securityMode)
+{
+    if (serviceInstance == NULL)
+    {
+        return;
+    }
+    if (securityMode != SecurityManager::SECURITY_MODE_ENCRYPTION_NO_MITM &&
+        securityMode != SecurityManager::SECURITY_MODE_ENCRYPTION_WITH_MITM)
+    {
+        return;
+    }
+    if (!serviceInstance->isPeerBonded())
+    {
+        return;
+    }
+
+    // fails unless the host subscribed to Service Changed, i.e. caches the attribute table
+    if (serviceInstance->layoutIsChanged && gamepadServiceChanged(handle))
+    {
+        serviceInstance->layoutIsChanged = false;
+        gamepadRaiseEvent(GAMEPAD_EVT_ID, GAMEPAD_EVT_LAYOUT_CHANGED);
+    }
+
+    if (serviceInstance->peerIsStored && memcmp(&serviceInstance->bondedPeer, &serviceInstance->connectionPeer, sizeof(GamepadPeerAddress)) == 0)
+    {
+        return;
+    }
+
+    // flash can not be written from the BLE event handler
+    gamepadRaiseEvent(GAMEPAD_EVT_ID, GAMEPAD_EVT_PEER_CHANGED);
+}
+
+/**
+ * @return true if the connected host is in the bond table.
+ * A host connecting with a resolvable private address is not found: it is reconnected by whitelist advertising only.
+ */
+bool BluetoothGamepadService::isPeerBonded()
+{
+    BLEProtocol::Address_t bondedAddresses[GAMEPAD_MAXIMUM_BONDS];
+    Gap::Whitelist_t bonds;
+    bonds.addresses = bondedAddresses;
+    bonds.size = 0;
+    bonds.capacity = GAMEPAD_MAXIMUM_BONDS;
+    if (ble.securityManager().getAddressesFromBondTable(bonds) != BLE_ERROR_NONE)
+    {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < bonds.size; i++)
+    {
+        if (memcmp(bondedAddresses[i].address, connectionPeer.addr, sizeof(connectionPeer.addr)) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void BluetoothGamepadService::onPeerChanged(GamepadEvent)
+{
+    bondedPeer = connectionPeer;
+    peerIsStored = true;
+    gamepadStoragePut(PEER_STORAGE_KEY, &bondedPeer, sizeof(bondedPeer));
+}
+
+void BluetoothGamepadService::onLayoutChanged(GamepadEvent)
+{
+    gamepadStoragePut(LAYOUT_STORAGE_KEY, &gattLayout, sizeof(gattLayout));
+}
+
+uint32_t BluetoothGamepadService::getReconnectTime()
+{
+    return reconnectTime;
+}
+
+uint32_t BluetoothGamepadService::getPowerStat(GamepadPowerStat stat)
+{
+    uint32_t now = gamepadClockMs();
+    uint32_t elapsed = now - wakeupsCountTime;
+    if (elapsed >= 1000)
+    {
+        uint32_t counted = wakeups;
+        wakeupRate = (uint32_t)((uint64_t)(counted - wakeupsCounted) * 1000 / elapsed);
+        wakeupsCounted = counted;
+        wakeupsCountTime = now;
+    }
+
+    uint32_t radioEventRate = getRadioEventRate();
+    switch (stat)
+    {
+        case GAMEPAD_POWER_WAKEUPS:
+            return wakeupRate;
+        case GAMEPAD_POWER_RADIO_EVENTS:
+            return (radioEventRate + 500) / 1000;
+        case GAMEPAD_POWER_CURRENT:
+        {
+            // charge per event(nC) * events per second = nA
+            uint32_t eventCharge = connected ? GAMEPAD_CONNECTION_EVENT_NC : GAMEPAD_ADVERTISING_EVENT_NC;
+            uint64_t nanoamperes = (uint64_t)radioEventRate * eventCharge / 1000 + (uint64_t)wakeupRate * GAMEPAD_WAKEUP_NC;
+            return GAMEPAD_SLEEP_UA + (uint32_t)(nanoamperes / 1000);
+        }
+    }
+    return 0;
+}
+
+void BluetoothGamepadService::countWakeup()
+{
+    // counted from interrupts of different priorities
+    __disable_irq();
+    wakeups++;
+    __enable_irq();
+}
+
+uint32_t BluetoothGamepadService::getRadioEventRate()
+{
+    if (connected)
+    {
+        // while idle, the gamepad skips the connection events allowed by the slave latency
+        uint32_t interval = connectionParams.maxConnectionInterval;
+        uint32_t latency = connectionIsIdle ? connectionParams.slaveLatency : 0;
+        return interval == 0 ? 0 : 800000 / (interval * (latency + 1));
+    }
+
+    switch (advertisingPhase)
+    {
+        case ADVERTISING_DIRECTED:
+            // high duty cycle: an event every 3.75 milliseconds
+            return 266667;
+        case ADVERTISING_WHITELIST:
+            return 1000000 / GAMEPAD_FAST_ADVERTISING_INTERVAL;
+        case ADVERTISING_GENERAL:
+            return 1000000 / GAMEPAD_GENERAL_ADVERTISING_INTERVAL;
+        case ADVERTISING_SLOW:
+            return 1000000 / GAMEPAD_SLOW_ADVERTISING_INTERVAL;
+    }
+    return 0;
+}
+
+void BluetoothGamepadService::startReportTicker()
+{
+    // the keep-alive only runs while a host listens to a busy connection
+    if (reportTickerIsActive || reportKeepAlive == 0 || !connected || connectionIsIdle)
+    {
+        return;
+    }
+    reportTicker.attach_us(this, &BluetoothGamepadService::keepAliveCallback, reportKeepAlive);
+    reportTickerIsActive = true;
+}
+
+void BluetoothGamepadService::stopReportTicker()
+{
+    if (!reportTickerIsActive)
+    {
+        return;
+    }
+    reportTicker.detach();
+    reportTickerIsActive = false;
+}
+
+void BluetoothGamepadService::onConnection(const Gap::ConnectionCallbackParams_t *params)
+{
+    // the connection has already stopped advertising
+    if (disconnectionTime != 0)
+    {
+        reconnectTime = gamepadClockMs() - disconnectionTime;
+        disconnectionTime = 0;
+    }
+    connectionPeer.addr_type = params->peerAddrType;
+    memcpy(connectionPeer.addr, params->peerAddr, sizeof(connectionPeer.addr));
+    connectionHandle = params->handle;
+    connectionParams = *params->connectionParams;
+    connectionIsIdle = false;
+    lastInputTime = gamepadClockUs();
+    buttonsState = 0;
+    sentButtons = 0;
+#if GAMEPAD_INPUT_SCANNER
+    sentScannedButtons = 0;
+#endif
+#if GAMEPAD_SEQUENCER
+    sentSequencedButtons = 0;
+    sentSequencedSuppressed = 0;
+#endif
+    memset(inputReportData, 0, sizeof(inputReportData));
+#if GAMEPAD_HUB_PLAYERS
+    memset(hubSentReports, 0, sizeof(hubSentReports));
+    hubDirtyPlayers = (1 << GAMEPAD_HUB_PLAYERS) - 1;
+#endif
+    // TX buffers of the previous connection are flushed
+    txCompleted = txQueued;
+    // the host does not know the current state of the other reports yet
+#if GAMEPAD_TILT_REPORT
+    tiltReport.invalidate();
+#endif
+#if GAMEPAD_KEYBOARD_REPORT
+    keyboardReport.invalidate();
+#endif
+#if GAMEPAD_CONSUMER_REPORT
+    consumerReport.invalidate();
+#endif
+#if GAMEPAD_BATTERY_SERVICE
+    batteryLevelIsDirty = true;
+#endif
+    connected = true;
+    markStartup(GAMEPAD_STARTUP_CONNECTED);
+    startIdleTimeout();
+    startReportTicker();
+    startInputScanner();
+    startAnalogSampler();
+}
+
+void BluetoothGamepadService::onDisconnection(const Gap::DisconnectionCallbackParams_t *params)
+{
+    connected = false;
+    disconnectionTime = gamepadClockMs();
+    idleTimeout.detach();
+    stopReportTicker();
+    startInputScanner();
+    startAnalogSampler();
+#if GAMEPAD_OUTPUT_REPORT
+    stopRumble();
+#endif
+    memset(&connectionParams, 0, sizeof(connectionParams));
+    startAdvertise();
+}
+
+/**
+ * Toggle the state of one button
+ */
+void BluetoothGamepadService::setButton(GamepadButton button, ButtonState state)
+{
+    changeButtons(button, state == BUTTON_DOWN ? button : 0);
+}
+
+void BluetoothGamepadService::setButtons(uint8_t buttons)
+{
+    changeButtons(0xff, buttons);
+}
+
+void BluetoothGamepadService::pressButtons(uint8_t buttons)
+{
+    changeButtons(0, buttons);
+}
+
+void BluetoothGamepadService::releaseButtons(uint8_t buttons)
+{
+    changeButtons(buttons, 0);
+}
+
+void BluetoothGamepadService::beginUpdate()
+{
+    if (!updateIsOpen)
+    {
+        updatedButtonsState = buttonsState;
+        updateIsOpen = true;
+    }
+}
+
+void BluetoothGamepadService::commitUpdate()
+{
+    if (updateIsOpen)
+    {
+        updateIsOpen = false;
+        updateButtons(updatedButtonsState);
+    }
+}
+
+void BluetoothGamepadService::setKey(uint8_t key, ButtonState state)
+{
+#if GAMEPAD_KEYBOARD_REPORT
+    if (key >= 0xe0 && key <= 0xe7)
+    {
+        uint8_t modifier = 1 << (key - 0xe0);
+        keyboardModifiers = state == BUTTON_DOWN ? (keyboardModifiers | modifier) : (keyboardModifiers & ~modifier);
+    }
+    else if (key != 0 && key <= GamepadKeyboardKeys::maximum)
+    {
+        uint8_t slot = GamepadKeyboardKeys::count;
+        uint8_t freeSlot = GamepadKeyboardKeys::count;
+        for (uint8_t i = 0; i < GamepadKeyboardKeys::count; i++)
+        {
+            if (keyboardKeys[i] == key)
+            {
+                slot = i;
+            }
+            else if (keyboardKeys[i] == 0 && freeSlot == GamepadKeyboardKeys::count)
+            {
+                freeSlot = i;
+            }
+        }
+
+        if (state == BUTTON_DOWN && slot == GamepadKeyboardKeys::count)
+        {
+            // keys pressed beyond the 6 slots are ignored
+            if (freeSlot == GamepadKeyboardKeys::count)
+            {
+                return;
+            }
+            keyboardKeys[freeSlot] = key;
+        }
+        else if (state == BUTTON_UP && slot != GamepadKeyboardKeys::count)
+        {
+            keyboardKeys[slot] = 0;
+        }
+    }
+    else
+    {
+        return;
+    }
+
+    uint8_t report[GamepadKeyboardReport::size] = {0};
+    GamepadKeyboardReport::put<0>(report, keyboardModifiers);
+    GamepadKeyboardReport::putElement<2, 0>(report, keyboardKeys[0]);
+    GamepadKeyboardReport::putElement<2, 1>(report, keyboardKeys[1]);
+    GamepadKeyboardReport::putElement<2, 2>(report, keyboardKeys[2]);
+    GamepadKeyboardReport::putElement<2, 3>(report, keyboardKeys[3]);
+    GamepadKeyboardReport::putElement<2, 4>(report, keyboardKeys[4]);
+    GamepadKeyboardReport::putElement<2, 5>(report, keyboardKeys[5]);
+    if (keyboardReport.put(report))
+    {
+        scheduleReport();
+        onInputActivity();
+    }
+#endif
+}
+
+void BluetoothGamepadService::setConsumerControl(uint16_t usage)
+{
+#if GAMEPAD_CONSUMER_REPORT
+    if (usage > GamepadConsumerUsage::maximum)
+    {
+        return;
+    }
+
+    uint8_t report[GamepadConsumerReport::size] = {0};
+    GamepadConsumerReport::put<0>(report, usage);
+    if (consumerReport.put(report))
+    {
+        scheduleReport();
+        onInputActivity();
+    }
+#endif
+}
+
+uint8_t BluetoothGamepadService::getBatteryLevel()
+{
+#if GAMEPAD_BATTERY_SERVICE
+    return batteryService->getBatteryLevel();
+#else
+    return 0;
+#endif
+}
+
+uint32_t BluetoothGamepadService::getOutput(GamepadOutput output)
+{
+#if GAMEPAD_OUTPUT_REPORT
+    switch (output)
+    {
+        case GAMEPAD_OUTPUT_RUMBLE:
+            return outputRumble;
+        case GAMEPAD_OUTPUT_RUMBLE_DURATION:
+            return outputRumbleDuration * 10;
+        case GAMEPAD_OUTPUT_LEDS:
+            return outputLeds;
+    }
+#endif
+    return 0;
+}
+
+void BluetoothGamepadService::setRumblePin(uint8_t pin)
+{
+#if GAMEPAD_OUTPUT_REPORT
+    if (rumblePin < 32)
+    {
+        gamepadWritePin(rumblePin, false);
+    }
+    rumblePin = pin;
+    if (pin < 32)
+    {
+        gamepadWritePin(pin, outputRumble > 0);
+    }
+#endif
+}
+
+void BluetoothGamepadService::setLedFeedback(bool enabled)
+{
+#if GAMEPAD_OUTPUT_REPORT
+    ledFeedbackIsEnabled = enabled;
+#endif
+}
+
+/**
+ * Host writes: the output report, HID control point commands and the protocol mode.
+ * Called from the BLE event interrupt, as soon as the SoftDevice has received the write.
+ */
+void BluetoothGamepadService::onDataWritten(const GattWriteCallbackParams *params)
+{
+#if GAMEPAD_OUTPUT_REPORT
+    if (params->handle == outputReportValueHandle)
+    {
+        if (params->len == GamepadOutputReport::size)
+        {
+            applyOutputReport(params->data);
+        }
+        return;
+    }
+#endif
+
+#if GAMEPAD_PROFILE
+    if (params->handle == profileValueHandle && params->len >= 1)
+    {
+        // the fiber storing a committed profile reads it in place: writes wait for it to finish
+        uint8_t offset = params->data[0];
+        if (profileCommitIsPending)
+        {
+            return;
+        }
+        if (offset == GAMEPAD_PROFILE_COMMIT)
+        {
+            // flash is written from a fiber, never from the BLE event handler
+            if (gamepadProfileIsValid(&stagedProfile) && profileIsInRange(&stagedProfile))
+            {
+                profileCommitIsPending = true;
+                gamepadRaiseEvent(GAMEPAD_EVT_ID, GAMEPAD_EVT_PROFILE_WRITTEN);
+            }
+        }
+        else if ((uint32_t)offset + params->len - 1 <= sizeof(stagedProfile))
+        {
+            memcpy(reinterpret_cast<uint8_t *>(&stagedProfile) + offset, params->data + 1, params->len - 1);
+        }
+        return;
+    }
+#endif
+
+    if (params->handle == controlPointValueHandle && params->len == 1)
+    {
+        controlPointCommand = params->data[0];
+        if (controlPointCommand == HID_CONTROL_POINT_SUSPEND && connected)
+        {
+            // the host is going to sleep: stop feedback and save power until input comes
+#if GAMEPAD_OUTPUT_REPORT
+            stopRumble();
+#endif
+            if (!connectionIsIdle)
+            {
+                idleTimeout.detach();
+                enterIdle();
+            }
+        }
+    }
+    else if (params->handle == protocolModeValueHandle && params->len == 1)
+    {
+        // kept for reads only: a gamepad has no boot reports, so reports are sent the same way in both modes
+        protocolMode = params->data[0];
+    }
+}
+
+#if GAMEPAD_OUTPUT_REPORT
+/**
+ * Decode an output report in the SoftDevice's write buffer, and drive the feedback right away
+ */
+void BluetoothGamepadService::applyOutputReport(const uint8_t *report)
+{
+    int32_t rumble = GamepadOutputReport::getElement<0, 0>(report);
+    outputRumble = rumble > GamepadRumbleIntensity::maximum ? GamepadRumbleIntensity::maximum : rumble;
+    outputRumbleDuration = GamepadOutputReport::getElement<1, 0>(report);
+    uint32_t leds = GamepadOutputReport::get<2>(report);
+
+    if (rumblePin < 32)
+    {
+        gamepadWritePin(rumblePin, outputRumble > 0);
+    }
+    if (outputRumble > 0 && outputRumbleDuration > 0)
+    {
+        rumbleTimeout.attach_us(this, &BluetoothGamepadService::stopRumble, outputRumbleDuration * 10000UL);
+    }
+    else
+    {
+        rumbleTimeout.detach();
+    }
+
+    if (ledFeedbackIsEnabled)
+    {
+        for (int16_t y = 0; y < GamepadLeds::count; y++)
+        {
+            uint32_t row = leds >> (y * GamepadLeds::size);
+            for (int16_t x = 0; x < 5; x++)
+            {
+                gamepadDisplayPixel(x, y, (row >> x) & 1);
+            }
+        }
+    }
+    outputLeds = leds;
+
+    gamepadRaiseEvent(GAMEPAD_EVT_ID, GAMEPAD_EVT_OUTPUT);
+}
+
+void BluetoothGamepadService::stopRumble()
+{
+    rumbleTimeout.detach();
+    outputRumble = 0;
+    if (rumblePin < 32)
+    {
+        gamepadWritePin(rumblePin, false);
+    }
+}
+#endif
+
+bool BluetoothGamepadService::isProfileLoaded()
+{
+#if GAMEPAD_PROFILE
+    return profileIsLoaded;
+#else
+    return false;
+#endif
+}
+
+void BluetoothGamepadService::clearProfile()
+{
+#if GAMEPAD_PROFILE
+    // the connection parameters may be read from the page
+    activeConnectionParams = &ACTIVE_CONNECTION_PARAMS;
+    idleConnectionParams = &IDLE_CONNECTION_PARAMS;
+    gamepadFlashErase(gamepadFlashPage(GAMEPAD_PROFILE_PAGE));
+#endif
+}
+
+#if GAMEPAD_PROFILE
+/**
+ * Configure the service from a profile checked whole and in range, at startup, then start the input scanner
+ * and the analog sampler with it. The connection parameters are used from the profile itself.
+ */
+void BluetoothGamepadService::applyProfile(const GamepadProfile *profile)
+{
+    for (uint8_t i = 0; i < 8; i++)
+    {
+        uint8_t pin = profile->buttonPins[i];
+        if (pin != GAMEPAD_PROFILE_NO_PIN)
+        {
+            bool activeLow = (profile->activeLowButtons & (1 << i)) != 0;
+            gamepadPinInput(pin, activeLow);
+#if GAMEPAD_INPUT_SCANNER
+            inputScanner.setPin(pin, 1 << i, activeLow);
+#endif
+        }
+    }
+#if GAMEPAD_INPUT_SCANNER
+    inputScanner.setDebounce(profile->debounceScans);
+    scanPeriod = profile->scanPeriod;
+#endif
+
+    reportMinInterval = profile->reportMinInterval;
+    reportKeepAlive = profile->reportKeepAlive;
+    setReportMode((GamepadReportMode)profile->reportMode);
+    idleTimeoutPeriod = profile->idleTimeout;
+    activeConnectionParams = &profile->activeConnection;
+    idleConnectionParams = &profile->idleConnection;
+
+#if GAMEPAD_ANALOG_AXES
+    analogPeriod = profile->analogPeriod;
+    analogSampler.setOversampling(profile->analogOversampling);
+    analogSampler.setDeadzone(profile->analogDeadzone);
+    for (uint8_t i = 0; i < AnalogSampler::AXES; i++)
+    {
+        uint8_t pin = profile->analogPins[i];
+        uint8_t input = pin != GAMEPAD_PROFILE_NO_PIN ? gamepadAnalogInput(pin) : AnalogSampler::NONE;
+        if (input != AnalogSampler::NONE)
+        {
+            gamepadPinAnalog(pin);
+            analogSampler.setInput(i, input, (profile->invertedAxes & (1 << i)) != 0);
+        }
+    }
+#endif
+#if GAMEPAD_TILT_REPORT
+    tiltFilter.setSmoothing(profile->tiltSmoothing);
+    tiltFilter.setDeadzone(profile->tiltDeadzone);
+#endif
+
+    startInputScanner();
+    startAnalogSampler();
+}
+
+/**
+ * Store the profile the host committed, in a fiber.
+ * Its connection parameters are used from the next request, the rest from the next boot.
+ * Writes to the profile characteristic are ignored until it is stored.
+ */
+void BluetoothGamepadService::onProfileWritten(GamepadEvent)
+{
+    clearProfile();
+    uint32_t *page = gamepadFlashPage(GAMEPAD_PROFILE_PAGE);
+    if (gamepadFlashWrite(page, &stagedProfile, sizeof(stagedProfile)))
+    {
+        const GamepadProfile *stored = reinterpret_cast<const GamepadProfile *>(page);
+        activeConnectionParams = &stored->activeConnection;
+        idleConnectionParams = &stored->idleConnection;
+    }
+    profileCommitIsPending = false;
+}
+#endif
+
+void BluetoothGamepadService::startHub(PinName tx, PinName rx, uint32_t baud)
+{
+#if GAMEPAD_HUB_PLAYERS
+    gamepadLinkStart(this, &BluetoothGamepadService::onHubReceived, tx, rx, baud);
+    hubLinkTx.start();
+    hubPollTicker.attach_us(this, &BluetoothGamepadService::pollHub, GAMEPAD_HUB_POLL_US);
+#endif
+}
+
+uint32_t BluetoothGamepadService::getHubStat(GamepadHubStat stat)
+{
+#if GAMEPAD_HUB_PLAYERS
+    switch (stat)
+    {
+    case GAMEPAD_HUB_FRAMES:
+        return hubLink.getFrames();
+    case GAMEPAD_HUB_ERRORS:
+        return hubLink.getErrors();
+    case GAMEPAD_HUB_LOST:
+        return hubLink.getLost();
+    case GAMEPAD_HUB_LATENCY_MAX_US:
+        return hubLatencyMax;
+    case GAMEPAD_HUB_LATENCY_AVG_US:
+        return hubLatencyCount == 0 ? 0 : hubLatencyTotal / hubLatencyCount;
+    }
+#endif
+    return 0;
+}
+
+#if GAMEPAD_HUB_PLAYERS
+/**
+ * Poll the next satellite, in the poll timer interrupt: it answers in its time slot, alone on the line.
+ * The poll is queued, and goes out from the UART interrupt.
+ */
+void BluetoothGamepadService::pollHub()
+{
+    countWakeup();
+    uint8_t poll = hubLink.poll();
+    hubLinkTx.write(&poll, 1);
+}
+
+/**
+ * Take the bytes received from the satellites, in the UART interrupt.
+ * A complete frame already sits in its player's report: a changed one only has to be scheduled.
+ */
+void BluetoothGamepadService::onHubReceived()
+{
+    countWakeup();
+    uint8_t byte;
+    while (gamepadLinkRead(byte))
+    {
+        uint8_t player = hubLink.receive(byte, gamepadClockUs());
+        if (player == hubLink.NONE)
+        {
+            continue;
+        }
+
+        hubDirtyPlayers |= 1 << player;
+        if (connected)
+        {
+            scheduleReport();
+        }
+        onInputActivity();
+    }
+}
+
+/**
+ * Send the reports of the satellite players that changed, straight from the link's buffers
+ * @return false if they must be sent again later
+ */
+bool BluetoothGamepadService::sendHubReports()
+{
+    for (uint8_t i = 0; i < GAMEPAD_HUB_PLAYERS; i++)
+    {
+        uint8_t bit = 1 << i;
+        if (!(hubDirtyPlayers & bit))
+        {
+            continue;
+        }
+        // a frame arriving while this one is sent marks the player again
+        __disable_irq();
+        hubDirtyPlayers &= ~bit;
+        __enable_irq();
+
+        const uint8_t *report = hubLink.report(i);
+        if (memcmp(report, hubSentReports[i], sizeof(hubSentReports[i])) == 0)
+        {
+            GAMEPAD_DIAG_COUNT(duplicatesSuppressed);
+            continue;
+        }
+        if (!notify(hubValueHandles[i], report, sizeof(hubSentReports[i])))
+        {
+            __disable_irq();
+            hubDirtyPlayers |= bit;
+            __enable_irq();
+            return false;
+        }
+        memcpy(hubSentReports[i], report, sizeof(hubSentReports[i]));
+
+        // the hop through the hub: from the first byte of the frame to the report queued
+        uint32_t latency = gamepadClockUs() - hubLink.frameTime(i);
+        hubLatencyMax = latency > hubLatencyMax ? latency : hubLatencyMax;
+        hubLatencyTotal += latency;
+        hubLatencyCount++;
+    }
+    return true;
+}
+#endif
+
+#if GAMEPAD_BATTERY_SERVICE
+void BluetoothGamepadService::batteryMonitorEntry(void *param)
+{
+    static_cast<BluetoothGamepadService *>(param)->monitorBattery();
+}
+
+/**
+ * Measure the battery level every GAMEPAD_BATTERY_PERIOD_MS, in its own fiber.
+ * Changes smaller than GAMEPAD_BATTERY_HYSTERESIS are not reported, except reaching 0% or 100%.
+ */
+void BluetoothGamepadService::monitorBattery()
+{
+    for (;;)
+    {
+        uint32_t voltage = 0;
+#if GAMEPAD_ANALOG_AXES
+        // the analog sampler shares the ADC
+        reserveAdc();
+#endif
+        for (uint8_t i = 0; i < 4; i++)
+        {
+            voltage += gamepadSupplyVoltage();
+        }
+        voltage /= 4;
+#if GAMEPAD_ANALOG_AXES
+        adcIsReserved = false;
+#endif
+
+        int32_t level = ((int32_t)voltage - GAMEPAD_BATTERY_EMPTY_MV) * 100 / (GAMEPAD_BATTERY_FULL_MV - GAMEPAD_BATTERY_EMPTY_MV);
+        level = level < 0 ? 0 : level > 100 ? 100 : level;
+
+        int32_t change = level - batteryService->getBatteryLevel();
+        if (change >= GAMEPAD_BATTERY_HYSTERESIS || change <= -GAMEPAD_BATTERY_HYSTERESIS ||
+            (change != 0 && (level == 0 || level == 100)))
+        {
+            batteryService->updateBatteryLevel(level);
+            batteryLevelIsDirty = true;
+            // sent as soon as a report cycle has TX buffers to spare, idle or not
+            if (connected)
+            {
+                scheduleReport();
+            }
+        }
+
+        gamepadSleep(GAMEPAD_BATTERY_PERIOD_MS);
+    }
+}
+
+/**
+ * Notify the battery level, if it changed and a TX buffer is left over
+ * @return false if it must be sent later
+ */
+bool BluetoothGamepadService::sendBatteryLevel()
+{
+    if (!batteryLevelIsDirty)
+    {
+        return true;
+    }
+
+    uint8_t level = batteryService->getBatteryLevel();
+    if (txCredits() <= GAMEPAD_TX_RESERVED || !notify(batteryService->getValueHandle(), &level, sizeof(level)))
+    {
+        return false;
+    }
+    batteryLevelIsDirty = false;
+    return true;
+}
+#endif
+
+/**
+ * Release then press buttons, or collect the change until commitUpdate()
+ */
+void BluetoothGamepadService::changeButtons(uint8_t released, uint8_t pressed)
+{
+#if GAMEPAD_TRACE_EVENTS
+    if (traceIsPlaying)
+    {
+        return;
+    }
+#endif
+
+    if (updateIsOpen)
+    {
+        updatedButtonsState = (updatedButtonsState & ~released) | pressed;
+        return;
+    }
+    updateButtons((buttonsState & ~released) | pressed);
+}
+
+void BluetoothGamepadService::updateButtons(uint8_t newButtonsState)
+{
+    if (newButtonsState == buttonsState)
+    {
+        return;
+    }
+
+#if GAMEPAD_TRACE_EVENTS
+    if (traceIsRecording)
+    {
+        inputTrace.record(gamepadClockUs(), INPUT_TRACE_BUTTONS, newButtonsState);
+    }
+#endif
+
+    // buttonsState is updated before the edge is queued, so the report path never sends a state older than a queued edge
+    buttonsState = newButtonsState;
+    if (!connected)
+    {
+        // input while disconnected still restarts a burst of advertising
+        onInputActivity();
+        return;
+    }
+
+    GAMEPAD_DIAG_TIME_BEGIN(start);
+    // on overflow the edge is lost, but the latest state is still sent once the queue drains
+    if (!buttonEdges.push(newButtonsState, gamepadClockUs()))
+    {
+        GAMEPAD_DIAG_COUNT(edgesOverflowed);
+    }
+    scheduleReport();
+    onInputActivity();
+    GAMEPAD_DIAG_TIME_END(setButtonTime, start);
+}
+
+void BluetoothGamepadService::setInputPin(GamepadButton button, PinName pin, bool activeLow)
+{
+#if GAMEPAD_INPUT_SCANNER
+    // the scanner interrupt must not run while its pins change
+    scanTicker.detach();
+    inputScanner.setPin((uint8_t)pin, button, activeLow);
+    startInputScanner();
+#endif
+}
+
+void BluetoothGamepadService::setInputScanning(uint32_t period, uint8_t samples)
+{
+#if GAMEPAD_INPUT_SCANNER
+    scanTicker.detach();
+    scanPeriod = period;
+    inputScanner.setDebounce(samples);
+    startInputScanner();
+#endif
+}
+
+/**
+ * Buttons held through setButton() and the input pins, before turbo and macros
+ */
+uint8_t BluetoothGamepadService::heldButtons()
+{
+#if GAMEPAD_INPUT_SCANNER
+    return buttonsState | scannedButtonsState;
+#else
+    return buttonsState;
+#endif
+}
+
+void BluetoothGamepadService::setTurbo(GamepadButton button, uint8_t rate)
+{
+#if GAMEPAD_SEQUENCER
+    uint32_t ticks = 0;
+    if (rate > 0)
+    {
+        // pressed for half of the period, released for the other half
+        ticks = 1000000UL / ((uint32_t)rate * 2 * GAMEPAD_SEQUENCER_TICK_US);
+        ticks = ticks == 0 ? 1 : (ticks > 255 ? 255 : ticks);
+    }
+
+    // the sequencer timer reads the turbo settings
+    __disable_irq();
+    sequencer.setTurbo(button, (uint8_t)ticks);
+    __enable_irq();
+
+    if (sequencer.isActive(heldButtons()))
+    {
+        startSequencer();
+    }
+#endif
+}
+
+bool BluetoothGamepadService::addMacroStep(GamepadMacroOp op, uint8_t arg)
+{
+#if GAMEPAD_SEQUENCER
+    return sequencer.addStep(op, arg);
+#else
+    return false;
+#endif
+}
+
+void BluetoothGamepadService::clearMacro()
+{
+#if GAMEPAD_SEQUENCER
+    __disable_irq();
+    sequencer.stop();
+    sequencer.clear();
+    __enable_irq();
+#endif
+}
+
+void BluetoothGamepadService::playMacro(bool loop)
+{
+#if GAMEPAD_SEQUENCER
+    __disable_irq();
+    sequencer.play(loop);
+    __enable_irq();
+    startSequencer();
+#endif
+}
+
+void BluetoothGamepadService::stopMacro()
+{
+#if GAMEPAD_SEQUENCER
+    sequencer.stop();
+#endif
+}
+
+bool BluetoothGamepadService::isMacroPlaying()
+{
+#if GAMEPAD_SEQUENCER
+    return sequencer.isPlaying();
+#else
+    return false;
+#endif
+}
+
+#if GAMEPAD_SEQUENCER
+/**
+ * Run the sequencer timer, unless it runs already. Called by every producer of input.
+ */
+void BluetoothGamepadService::startSequencer()
+{
+    __disable_irq();
+    bool wasRunning = sequencerIsRunning;
+    sequencerIsRunning = true;
+    __enable_irq();
+
+    if (!wasRunning)
+    {
+        sequencerTicker.attach_us(this, &BluetoothGamepadService::sequencerTick, GAMEPAD_SEQUENCER_TICK_US);
+    }
+}
+
+/**
+ * One sequencer step, in the timer interrupt: each change is queued as an edge, so that
+ * every turbo and macro state is sent in a report of its own
+ */
+void BluetoothGamepadService::sequencerTick()
+{
+    countWakeup();
+    uint8_t held = heldButtons();
+    uint8_t suppressed;
+    uint8_t macroButtons = sequencer.tick(held, suppressed);
+
+    if (macroButtons != sequencedButtons || suppressed != sequencedSuppressed)
+    {
+        sequencedButtons = macroButtons;
+        sequencedSuppressed = suppressed;
+        if (connected)
+        {
+            if (!sequencedButtonEdges.push(macroButtons, gamepadClockUs(), suppressed))
+            {
+                GAMEPAD_DIAG_COUNT(edgesOverflowed);
+            }
+            scheduleReport();
+            onInputActivity();
+        }
+    }
+
+    // nothing held and nothing playing: the timer stops until the next input
+    if (!sequencer.isActive(held))
+    {
+        sequencerTicker.detach();
+        sequencerIsRunning = false;
+    }
+}
+#endif
+
+void BluetoothGamepadService::startInputScanner()
+{
+#if GAMEPAD_INPUT_SCANNER
+    if (inputScanner.isEmpty() || scanPeriod == 0)
+    {
+        return;
+    }
+
+    uint32_t period = scanPeriod;
+    if ((!connected || connectionIsIdle) && period < GAMEPAD_IDLE_SCAN_PERIOD_US)
+    {
+        period = GAMEPAD_IDLE_SCAN_PERIOD_US;
+    }
+    scanTicker.attach_us(this, &BluetoothGamepadService::scanInputs, period);
+#endif
+}
+
+#if GAMEPAD_INPUT_SCANNER
+/**
+ * Sample all mapped pins at once, and queue an edge when a debounced button changes.
+ * Runs in the scanner's timer interrupt.
+ */
+void BluetoothGamepadService::scanInputs()
+{
+    countWakeup();
+    uint8_t newButtonsState = inputScanner.scan(gamepadReadPins());
+    if (newButtonsState == scannedButtonsState)
+    {
+        return;
+    }
+
+    scannedButtonsState = newButtonsState;
+    if (!connected)
+    {
+        onInputActivity();
+        return;
+    }
+
+    if (!scannedButtonEdges.push(newButtonsState, gamepadClockUs()))
+    {
+        GAMEPAD_DIAG_COUNT(edgesOverflowed);
+    }
+    scheduleReport();
+    onInputActivity();
+}
+#endif
+
+bool BluetoothGamepadService::setAnalogPin(GamepadAnalogAxis axis, PinName pin, bool inverted)
+{
+#if GAMEPAD_ANALOG_AXES
+    uint8_t input = AnalogSampler::NONE;
+    if (pin != NC)
+    {
+        input = gamepadAnalogInput((uint8_t)pin);
+        if (input == AnalogSampler::NONE)
+        {
+            return false;
+        }
+    }
+
+    // the sampler must not run while its inputs change
+    analogTicker.detach();
+    reserveAdc();
+    if (pin != NC)
+    {
+        gamepadPinAnalog((uint8_t)pin);
+    }
+    analogSampler.setInput(axis, input, inverted);
+    adcIsReserved = false;
+
+    if (analogSampler.isEmpty())
+    {
+        for (uint8_t i = 0; i < AnalogSampler::AXES; i++)
+        {
+            analogAxes[i] = 0;
+        }
+        scheduleReport();
+    }
+    startAnalogSampler();
+    return true;
+#else
+    return false;
+#endif
+}
+
+void BluetoothGamepadService::setAnalogSampling(uint32_t period, uint8_t oversampling, uint8_t deadzone)
+{
+#if GAMEPAD_ANALOG_AXES
+    analogTicker.detach();
+    reserveAdc();
+    analogPeriod = period;
+    analogSampler.setOversampling(oversampling);
+    analogSampler.setDeadzone(deadzone);
+    adcIsReserved = false;
+    startAnalogSampler();
+#endif
+}
+
+void BluetoothGamepadService::calibrateAnalog()
+{
+#if GAMEPAD_ANALOG_AXES
+    // the ADC interrupt updates the averages
+    __disable_irq();
+    analogSampler.calibrate();
+    __enable_irq();
+#endif
+}
+
+int32_t BluetoothGamepadService::getAnalogAxis(GamepadAnalogAxis axis)
+{
+#if GAMEPAD_ANALOG_AXES
+    if ((uint8_t)axis < AnalogSampler::AXES)
+    {
+        return analogAxes[axis];
+    }
+#endif
+    return 0;
+}
+
+void BluetoothGamepadService::startAnalogSampler()
+{
+#if GAMEPAD_ANALOG_AXES
+    if (analogSampler.isEmpty() || analogPeriod == 0)
+    {
+        return;
+    }
+
+    uint32_t period = analogPeriod;
+    if ((!connected || connectionIsIdle) && period < GAMEPAD_IDLE_SCAN_PERIOD_US)
+    {
+        period = GAMEPAD_IDLE_SCAN_PERIOD_US;
+    }
+    analogTicker.attach_us(this, &BluetoothGamepadService::startAnalogBurst, period);
+#endif
+}
+
+#if GAMEPAD_ANALOG_AXES
+/**
+ * Start a burst of conversions, in the sampler's timer interrupt.
+ * The ADC interrupt chains the rest, so neither interrupt waits for a conversion.
+ * The burst owns the ADC: fibers of the service wait for it in reserveAdc(), and the configuration
+ * of other users is restored at its end.
+ */
+void BluetoothGamepadService::startAnalogBurst()
+{
+    countWakeup();
+    // the previous burst is still converting, or a fiber uses the ADC
+    if (analogBurstIsRunning || adcIsReserved)
+    {
+        return;
+    }
+    analogBurstIsRunning = true;
+    gamepadAdcSave(adcSaved);
+    gamepadAdcStart(analogSampler.begin());
+}
+
+/**
+ * One conversion ended: start the next one, or publish the axes at the end of the burst.
+ * Runs in the ADC interrupt.
+ */
+void BluetoothGamepadService::onAnalogSample()
+{
+    countWakeup();
+    uint8_t next;
+    if (!analogSampler.add(gamepadAdcResult(), next))
+    {
+        gamepadAdcStart(next);
+        return;
+    }
+    gamepadAdcStop(adcSaved);
+    analogBurstIsRunning = false;
+
+    int16_t axes[AnalogSampler::AXES];
+    analogSampler.getAxes(axes);
+    bool changed = false;
+    for (uint8_t i = 0; i < AnalogSampler::AXES; i++)
+    {
+        if (axes[i] != analogAxes[i])
+        {
+            analogAxes[i] = axes[i];
+            changed = true;
+        }
+    }
+    if (!changed)
+    {
+        return;
+    }
+
+    if (connected)
+    {
+        scheduleReport();
+    }
+    if (isAxisActivity(analogActivityAxes, axes, AnalogSampler::AXES, GAMEPAD_ANALOG_ACTIVITY_THRESHOLD))
+    {
+        onInputActivity();
+    }
+}
+
+/**
+ * Keep bursts from starting, and wait for the current one to end, in a fiber.
+ * Clearing adcIsReserved releases the ADC.
+ */
+void BluetoothGamepadService::reserveAdc()
+{
+    adcIsReserved = true;
+    while (analogBurstIsRunning)
+    {
+        gamepadSleep(1);
+    }
+}
+#endif
+
+void BluetoothGamepadService::setReportInterval(uint32_t minInterval, uint32_t keepAlive)
+{
+    reportMinInterval = minInterval;
+
+    stopReportTicker();
+    reportKeepAlive = keepAlive;
+    startReportTicker();
+}
+
+void BluetoothGamepadService::setIdleTimeout(uint32_t timeout)
+{
+    idleTimeoutPeriod = timeout;
+    idleTimeout.detach();
+    if (connected && !connectionIsIdle)
+    {
+        lastInputTime = gamepadClockUs();
+        startIdleTimeout();
+    }
+    onInputActivity();
+}
+
+uint32_t BluetoothGamepadService::getConnectionParameter(GamepadConnectionParameter parameter)
+{
+    if (!connected)
+    {
+        return 0;
+    }
+
+    switch (parameter)
+    {
+        case GAMEPAD_CONNECTION_INTERVAL:
+            // the host picks one interval within the requested range
+            return connectionParams.maxConnectionInterval * 1250;
+        case GAMEPAD_CONNECTION_SLAVE_LATENCY:
+            return connectionParams.slaveLatency;
+        case GAMEPAD_CONNECTION_SUPERVISION_TIMEOUT:
+            return connectionParams.connectionSupervisionTimeout * 10;
+    }
+    return 0;
+}
+
+/**
+ * Input changed: use the active connection parameters, and restart the idle timeout
+ */
+void BluetoothGamepadService::onInputActivity()
+{
+    lastInputTime = gamepadClockUs();
+#if GAMEPAD_SEQUENCER
+    if (!sequencerIsRunning && sequencer.isActive(heldButtons()))
+    {
+        startSequencer();
+    }
+#endif
+    if (!connected)
+    {
+        // input while advertising slowly starts a new burst, so that a host finds the gamepad quickly,
+        // but not more often than every GAMEPAD_ADVERTISING_RESTART_INTERVAL: input that never stops would keep it fast
+        __disable_irq();
+        bool wasSlow = advertisingPhase == ADVERTISING_SLOW &&
+                       gamepadClockMs() - generalAdvertisingTime >= GAMEPAD_ADVERTISING_RESTART_INTERVAL * 1000UL;
+        if (wasSlow)
+        {
+            advertisingPhase = ADVERTISING_GENERAL;
+        }
+        __enable_irq();
+
+        if (wasSlow)
+        {
+            ble.gap().stopAdvertising();
+            startAdvertisingPhase(ADVERTISING_GENERAL);
+        }
+        return;
+    }
+
+    // input comes from fibers and from the scanner interrupt: only the one waking the connection re-arms the timeout
+    __disable_irq();
+    bool wasIdle = connectionIsIdle;
+    connectionIsIdle = false;
+    __enable_irq();
+
+    if (wasIdle)
+    {
+        requestConnectionParams(false);
+        startIdleTimeout();
+        startReportTicker();
+        startInputScanner();
+        startAnalogSampler();
+    }
+}
+
+void BluetoothGamepadService::startIdleTimeout()
+{
+    if (idleTimeoutPeriod != 0)
+    {
+        idleTimeout.attach_us(this, &BluetoothGamepadService::onIdleTimeout, idleTimeoutPeriod * 1000);
+    }
+}
+
+/**
+ * Switch to the idle connection parameters, or wait for the rest of the timeout after the last input
+ */
+void BluetoothGamepadService::onIdleTimeout()
+{
+    countWakeup();
+    if (!connected || connectionIsIdle || idleTimeoutPeriod == 0)
+    {
+        return;
+    }
+
+    uint32_t idleTime = gamepadClockUs() - lastInputTime;
+    if (idleTime < idleTimeoutPeriod * 1000)
+    {
+        idleTimeout.attach_us(this, &BluetoothGamepadService::onIdleTimeout, idleTimeoutPeriod * 1000 - idleTime);
+        return;
+    }
+
+    enterIdle();
+}
+
+void BluetoothGamepadService::enterIdle()
+{
+    connectionIsIdle = true;
+    requestConnectionParams(true);
+    stopReportTicker();
+    startInputScanner();
+    startAnalogSampler();
+}
+
+/**
+ * Ask the host for the active or idle connection parameters.
+ * The host may refuse, or grant other values within the range.
+ */
+void BluetoothGamepadService::requestConnectionParams(bool idle)
+{
+    ble.gap().updateConnectionParams(connectionHandle, idle ? idleConnectionParams : activeConnectionParams);
+}
+
+void BluetoothGamepadService::setReportMode(GamepadReportMode mode)
+{
+    if (mode == GAMEPAD_REPORT_ON_RADIO && !radioNotificationIsActive)
+    {
+        ble.gap().initRadioNotification();
+        ble.gap().onRadioNotification(this, &BluetoothGamepadService::onRadioNotification);
+        radioNotificationIsActive = true;
+    }
+    reportMode = mode;
+}
+
+/**
+ * Send the report as soon as the minimum spacing from the last report allows,
+ * or just before the next connection event in GAMEPAD_REPORT_ON_RADIO mode
+ */
+void BluetoothGamepadService::scheduleReport()
+{
+    reportIsPending = true;
+
+    // with slave latency the radio skips connection events, so idle connections send on change
+    if (reportMode == GAMEPAD_REPORT_ON_RADIO && !connectionIsIdle)
+    {
+        return;
+    }
+
+    // scheduleReport is called from fibers and interrupts, so checking and arming must not be interrupted
+    __disable_irq();
+    if (!connected || reportIsScheduled)
+    {
+        __enable_irq();
+        return;
+    }
+
+    uint32_t elapsed = gamepadClockUs() - lastReportTime;
+    uint32_t delay = elapsed < reportMinInterval ? reportMinInterval - elapsed : 0;
+
+    reportIsScheduled = true;
+    reportTimeout.attach_us(this, &BluetoothGamepadService::reportTimeoutCallback, delay);
+    __enable_irq();
+}
+
+void BluetoothGamepadService::reportTimeoutCallback()
+{
+    countWakeup();
+    reportIsScheduled = false;
+    gamepadReportIrqPend();
+}
+
+void BluetoothGamepadService::keepAliveCallback()
+{
+    countWakeup();
+    keepAliveIsDue = true;
+    gamepadReportIrqPend();
+}
+
+/**
+ * Called about 800 microseconds before, and just after, each radio event, from the radio notification interrupt.
+ * The reports are written once it returns, from the report interrupt: the 800 microseconds cover
+ * a BLE event or timer handler the report interrupt has to wait for.
+ */
+void BluetoothGamepadService::onRadioNotification(bool radioActive)
+{
+    countWakeup();
+    if (radioActive && connected && reportIsPending && reportMode == GAMEPAD_REPORT_ON_RADIO)
+    {
+        gamepadReportIrqPend();
     }
 }
 
+/**
+ * Send queued edges in order, or the latest state when no edge is queued, then the other reports.
+ * As many reports as there are free TX buffers are sent at once, so a backlog of edges goes out in one connection event.
+ *
+ * Runs in a software interrupt pended by the timers and the radio notification, so it never runs inside
+ * their handlers. It is still interrupt context, at the priority of the BLE event dispatch: it can be
+ * delayed behind a BLE event handler, and never runs while one is running.
+ */
 void BluetoothGamepadService::sendCallback()
 {
+    countWakeup();
+    reportIsPending = false;
+    reportIsBlocked = false;
+    bool force = keepAliveIsDue;
+    keepAliveIsDue = false;
+
+    ButtonEdge edge;
+#if GAMEPAD_INPUT_SCANNER
+    ButtonEdge scannedEdge;
+#endif
+#if GAMEPAD_SEQUENCER
+    ButtonEdge sequencedEdge;
+#endif
     if (!connected)
     {
+        while (buttonEdges.peek(edge))
+        {
+            buttonEdges.pop();
+        }
+#if GAMEPAD_INPUT_SCANNER
+        while (scannedButtonEdges.peek(scannedEdge))
+        {
+            scannedButtonEdges.pop();
+        }
+#endif
+#if GAMEPAD_SEQUENCER
+        while (sequencedButtonEdges.peek(sequencedEdge))
+        {
+            sequencedButtonEdges.pop();
+        }
+#endif
+        return;
+    }
+
+    for (;;)
+    {
+        // the edges of all producers are sent in time order
+        ButtonEdge *next = buttonEdges.peek(edge) ? &edge : NULL;
+#if GAMEPAD_INPUT_SCANNER
+        if (scannedButtonEdges.peek(scannedEdge) && (next == NULL || (int32_t)(scannedEdge.time - next->time) < 0))
+        {
+            next = &scannedEdge;
+        }
+#endif
+#if GAMEPAD_SEQUENCER
+        if (sequencedButtonEdges.peek(sequencedEdge) && (next == NULL || (int32_t)(sequencedEdge.time - next->time) < 0))
+        {
+            next = &sequencedEdge;
+        }
+#endif
+        if (next == NULL)
+        {
+            break;
+        }
+
+        uint8_t buttons = next == &edge ? edge.buttons : sentButtons;
+#if GAMEPAD_INPUT_SCANNER
+        buttons |= next == &scannedEdge ? scannedEdge.buttons : sentScannedButtons;
+#endif
+#if GAMEPAD_SEQUENCER
+        buttons = next == &sequencedEdge ? ((buttons & ~sequencedEdge.suppressed) | sequencedEdge.buttons)
+                                         : ((buttons & ~sentSequencedSuppressed) | sentSequencedButtons);
+#endif
+        if (!sendReport(buttons, false))
+        {
+            // retried from onDataSent
+            reportIsBlocked = true;
+            updateDiagnostics();
+            return;
+        }
+
+        if (next == &edge)
+        {
+            buttonEdges.pop();
+            sentButtons = edge.buttons;
+            GAMEPAD_DIAG_LATENCY(edge.time);
+        }
+#if GAMEPAD_INPUT_SCANNER
+        else if (next == &scannedEdge)
+        {
+            scannedButtonEdges.pop();
+            sentScannedButtons = scannedEdge.buttons;
+            GAMEPAD_DIAG_LATENCY(scannedEdge.time);
+        }
+#endif
+#if GAMEPAD_SEQUENCER
+        else
+        {
+            sequencedButtonEdges.pop();
+            sentSequencedButtons = sequencedEdge.buttons;
+            sentSequencedSuppressed = sequencedEdge.suppressed;
+        }
+#endif
+        force = false;
+    }
+
+    uint8_t buttons = heldButtons();
+#if GAMEPAD_SEQUENCER
+    buttons = (buttons & ~sequencedSuppressed) | sequencedButtons;
+#endif
+    if (!sendReport(buttons, force))
+    {
+        reportIsBlocked = true;
+        updateDiagnostics();
+        return;
+    }
+
+#if GAMEPAD_HUB_PLAYERS
+    if (!sendHubReports())
+    {
+        reportIsBlocked = true;
+        updateDiagnostics();
         return;
     }
+#endif
 
-    // buttons
-    inputReportData[0] = buttonsState & 0xf0;
+#if GAMEPAD_TILT_REPORT
+    if (!sendPendingReport(tiltReport, 0))
+    {
+        reportIsBlocked = true;
+        updateDiagnostics();
+        return;
+    }
+#endif
 
-    // axis
-    axisX = 0;
-    axisY = 0;
-    if (buttonsState & GAMEPAD_BUTTON_LEFT)
+    // lower priority reports only use the TX buffers left over, so that the next gamepad report finds one free
+#if GAMEPAD_KEYBOARD_REPORT
+    if (!sendPendingReport(keyboardReport, GAMEPAD_TX_RESERVED))
+    {
+        reportIsBlocked = true;
+        updateDiagnostics();
+        return;
+    }
+#endif
+#if GAMEPAD_CONSUMER_REPORT
+    if (!sendPendingReport(consumerReport, GAMEPAD_TX_RESERVED))
+    {
+        reportIsBlocked = true;
+        updateDiagnostics();
+        return;
+    }
+#endif
+#if GAMEPAD_BATTERY_SERVICE
+    // without TX buffers to spare, the battery level is sent again when one is released
+    if (!sendBatteryLevel())
     {
-        axisX--;
+        reportIsBlocked = true;
     }
-    if (buttonsState & GAMEPAD_BUTTON_RIGHT)
+#endif
+    updateDiagnostics();
+}
+
+/**
+ * Update the value of the diagnostics characteristic
+ */
+void BluetoothGamepadService::updateDiagnostics()
+{
+#if GAMEPAD_DIAGNOSTICS
+    gamepadGattWrite(ble, diagnosticsValueHandle, reinterpret_cast<const uint8_t *>(&diagnostics), sizeof(diagnostics), true);
+#endif
+}
+
+uint32_t BluetoothGamepadService::getDiagnostic(GamepadDiagnostic diagnostic)
+{
+#if GAMEPAD_DIAGNOSTICS
+    return gamepadDiagnostic(diagnostics, diagnostic);
+#else
+    return 0;
+#endif
+}
+
+uint32_t BluetoothGamepadService::getLatencyHistogram(uint8_t bucket)
+{
+#if GAMEPAD_DIAGNOSTICS
+    if (bucket < GAMEPAD_LATENCY_BUCKETS)
     {
-        axisX++;
+        return diagnostics.latencyHistogram[bucket];
     }
-    if (buttonsState & GAMEPAD_BUTTON_UP)
+#endif
+    return 0;
+}
+
+void BluetoothGamepadService::resetDiagnostics()
+{
+#if GAMEPAD_DIAGNOSTICS
+    memset(&diagnostics, 0, sizeof(diagnostics));
+#endif
+}
+
+void BluetoothGamepadService::recordTrace(bool record)
+{
+#if GAMEPAD_TRACE_EVENTS
+    if (traceIsPlaying)
     {
-        axisY--;
+        return;
     }
-    if (buttonsState & GAMEPAD_BUTTON_DOWN)
+    if (record && !traceIsRecording)
     {
-        axisY++;
+        inputTrace.clear();
     }
-    switch (axisX)
+    traceIsRecording = record;
+#endif
+}
+
+void BluetoothGamepadService::playTrace()
+{
+#if GAMEPAD_TRACE_EVENTS
+    if (traceIsPlaying || inputTrace.size() == 0)
     {
-        case -1: // left
-            inputReportData[0] |= 0x03;
-            break;
-        case 1: // right
-            inputReportData[0] |= 0x01;
-            break;
+        return;
     }
-    switch (axisY)
+    traceIsRecording = false;
+    traceIsPlaying = true;
+    gamepadStartFiber(&BluetoothGamepadService::tracePlayerEntry, this);
+#endif
+}
+
+void BluetoothGamepadService::sendTrace()
+{
+#if GAMEPAD_TRACE_EVENTS
+    InputTraceHeader header = {{'G', 'T', 'R', 'C'}, 1, sizeof(InputTraceEvent), inputTrace.size()};
+    gamepadSerialSend(reinterpret_cast<uint8_t *>(&header), sizeof(header));
+    for (uint16_t i = 0; i < inputTrace.size(); i++)
     {
-        case -1: // up
-            inputReportData[0] |= 0x0c;
-            break;
-        case 1: // down
-            inputReportData[0] |= 0x04;
-            break;
+        InputTraceEvent event = inputTrace.at(i);
+        gamepadSerialSend(reinterpret_cast<uint8_t *>(&event), sizeof(event));
+    }
+#endif
+}
+
+uint16_t BluetoothGamepadService::receiveTrace()
+{
+#if GAMEPAD_TRACE_EVENTS
+    if (traceIsPlaying)
+    {
+        return 0;
+    }
+    traceIsRecording = false;
+
+    InputTraceHeader header;
+    uint8_t *headerBytes = reinterpret_cast<uint8_t *>(&header);
+    for (uint8_t i = 0; i < sizeof(header); i++)
+    {
+        headerBytes[i] = gamepadSerialRead();
+    }
+    if (memcmp(header.magic, "GTRC", 4) != 0 || header.version != 1 || header.eventSize != sizeof(InputTraceEvent))
+    {
+        return 0;
+    }
+
+    // a trace longer than the recorder keeps its end, as if it had been recorded here
+    inputTrace.clear();
+    for (uint16_t i = 0; i < header.count; i++)
+    {
+        InputTraceEvent event;
+        uint8_t *eventBytes = reinterpret_cast<uint8_t *>(&event);
+        for (uint8_t j = 0; j < sizeof(event); j++)
+        {
+            eventBytes[j] = gamepadSerialRead();
+        }
+        inputTrace.add(event);
+    }
+    return inputTrace.size();
+#else
+    return 0;
+#endif
+}
+
+uint16_t BluetoothGamepadService::getTraceLength()
+{
+#if GAMEPAD_TRACE_EVENTS
+    return inputTrace.size();
+#else
+    return 0;
+#endif
+}
+
+#if GAMEPAD_TRACE_EVENTS
+void BluetoothGamepadService::tracePlayerEntry(void *param)
+{
+    static_cast<BluetoothGamepadService *>(param)->replayTrace();
+}
+
+/**
+ * Feed the trace into the report path.
+ * gamepadSleep() wakes on the scheduler tick, so the last tick before each event is waited yielding to the other fibers.
+ */
+void BluetoothGamepadService::replayTrace()
+{
+#if GAMEPAD_TILT_REPORT
+    int16_t tilt[TiltFilter::AXES] = {0, 0, 0};
+#endif
+    uint32_t time = gamepadClockUs();
+    for (uint16_t i = 0; i < inputTrace.size(); i++)
+    {
+        const InputTraceEvent &event = inputTrace.at(i);
+        if (i > 0)
+        {
+            time += InputTrace<GAMEPAD_TRACE_EVENTS>::delay(event);
+        }
+
+        int32_t remaining;
+        while ((remaining = (int32_t)(time - gamepadClockUs())) > 0)
+        {
+            if (remaining > GAMEPAD_SLEEP_TICK_MS * 1000)
+            {
+                gamepadSleep(remaining / 1000 - GAMEPAD_SLEEP_TICK_MS);
+            }
+            else
+            {
+                gamepadYield();
+            }
+        }
+
+        switch (event.kind)
+        {
+            case INPUT_TRACE_BUTTONS:
+                updateButtons((uint8_t)event.value);
+                break;
+#if GAMEPAD_TILT_REPORT
+            case INPUT_TRACE_TILT_X:
+            case INPUT_TRACE_TILT_Y:
+                tilt[event.kind - INPUT_TRACE_TILT_X] = event.value;
+                break;
+            case INPUT_TRACE_TILT_Z:
+                tilt[2] = event.value;
+                putTilt(tilt);
+                break;
+#endif
+        }
+    }
+    traceIsPlaying = false;
+}
+#endif
+
+/**
+ * Called when the SoftDevice has sent notifications and freed their TX buffers
+ */
+void BluetoothGamepadService::onDataSent(unsigned count)
+{
+    // count includes notifications of the other services, which never took one of our credits
+    uint32_t inFlight = txQueued - txCompleted;
+    txCompleted += count < inFlight ? count : inFlight;
+
+    if (reportIsBlocked)
+    {
+        scheduleReport();
+    }
+}
+
+/**
+ * Number of reports that can be queued in the SoftDevice now
+ */
+uint8_t BluetoothGamepadService::txCredits() const
+{
+    uint32_t inFlight = txQueued - txCompleted;
+    return inFlight < txCapacity ? txCapacity - inFlight : 0;
+}
+
+/**
+ * Notify a report to the host
+ * @return false if no TX buffer is free and the report must be sent again later
+ */
+bool BluetoothGamepadService::notify(GattAttribute::Handle_t handle, const uint8_t *data, uint16_t length)
+{
+    if (txCredits() == 0)
+    {
+        GAMEPAD_DIAG_COUNT(reportsRejected);
+        return false;
+    }
+
+    GAMEPAD_DIAG_TIME_BEGIN(start);
+    ble_error_t error = gamepadGattWrite(ble, handle, data, length);
+    GAMEPAD_DIAG_TIME_END(writeTime, start);
+    if (error == BLE_STACK_BUSY || error == BLE_ERROR_NO_MEM)
+    {
+        // the TX buffers are shared with the other services: the SoftDevice's NO_TX_BUFFERS and BUSY both map to BLE_STACK_BUSY
+        GAMEPAD_DIAG_COUNT(reportsRejected);
+        return false;
+    }
+    if (error == BLE_ERROR_NONE)
+    {
+        txQueued++;
+        GAMEPAD_DIAG_COUNT(reportsSent);
+    }
+    else
+    {
+        // notifications are not enabled, or the connection is not in a state to send: dropped, not retried
+        GAMEPAD_DIAG_COUNT(reportsDropped);
+    }
+    return true;
+}
+
+/**
+ * Send the gamepad report of a button state
+ * @return false if the report must be sent again later
+ */
+bool BluetoothGamepadService::sendReport(uint8_t state, bool force)
+{
+    if (!connected)
+    {
+        return true;
+    }
+
+    GAMEPAD_DIAG_TIME_BEGIN(start);
+    uint8_t report[GamepadInputReport::size] = {0};
+
+    gamepadPutButtons<GamepadInputReport>(report, state);
+
+#if GAMEPAD_ANALOG_AXES
+    // sticks and triggers: the ADC interrupt publishing them does not preempt this one
+    GamepadInputReport::putElement<2, 0>(report, analogAxes[GAMEPAD_ANALOG_LEFT_X]);
+    GamepadInputReport::putElement<2, 1>(report, analogAxes[GAMEPAD_ANALOG_LEFT_Y]);
+    GamepadInputReport::putElement<2, 2>(report, analogAxes[GAMEPAD_ANALOG_RIGHT_X]);
+    GamepadInputReport::putElement<2, 3>(report, analogAxes[GAMEPAD_ANALOG_RIGHT_Y]);
+    GamepadInputReport::putElement<3, 0>(report, analogAxes[GAMEPAD_ANALOG_LEFT_TRIGGER]);
+    GamepadInputReport::putElement<3, 1>(report, analogAxes[GAMEPAD_ANALOG_RIGHT_TRIGGER]);
+#endif
+    GAMEPAD_DIAG_TIME_END(encodeTime, start);
+
+    // duplicated report
+    if (!force && memcmp(report, inputReportData, sizeof(inputReportData)) == 0)
+    {
+        GAMEPAD_DIAG_COUNT(duplicatesSuppressed);
+        return true;
+    }
+
+    if (!notify(inputReportValueHandle, report, sizeof(report)))
+    {
+        return false;
+    }
+
+    // inputReportData holds the last report sent
+    memcpy(inputReportData, report, sizeof(inputReportData));
+    lastReportTime = gamepadClockUs();
+    markStartup(GAMEPAD_STARTUP_FIRST_REPORT);
+    return true;
+}
+
+void BluetoothGamepadService::setTiltSampling(uint16_t period)
+{
+#if GAMEPAD_TILT_REPORT
+    tiltSamplingPeriod = period;
+    if (period == 0)
+    {
+        return;
+    }
+
+    gamepadAccelerometerPeriod(period);
+    if (!tiltSamplerIsRunning)
+    {
+        tiltSamplerIsRunning = true;
+        gamepadStartFiber(&BluetoothGamepadService::tiltSamplerEntry, this);
+    }
+#endif
+}
+
+void BluetoothGamepadService::setTiltFilter(uint8_t smoothing, int16_t deadzone)
+{
+#if GAMEPAD_TILT_REPORT
+    tiltFilter.setSmoothing(smoothing);
+    tiltFilter.setDeadzone(deadzone);
+#endif
+}
+
+void BluetoothGamepadService::calibrateTilt()
+{
+#if GAMEPAD_TILT_REPORT
+    tiltFilter.calibrate();
+#endif
+}
+
+#if GAMEPAD_TILT_REPORT
+void BluetoothGamepadService::tiltSamplerEntry(void *param)
+{
+    static_cast<BluetoothGamepadService *>(param)->sampleTilt();
+}
+
+/**
+ * Sample the accelerometer at its own rate, independent of the report rate.
+ * Runs in its own fiber until the sampling period is set to 0.
+ */
+void BluetoothGamepadService::sampleTilt()
+{
+    while (tiltSamplingPeriod != 0)
+    {
+        int16_t sample[TiltFilter::AXES];
+        gamepadAccelerometerRead(sample);
+        int16_t tilt[TiltFilter::AXES];
+        tiltFilter.update(sample, tilt);
+#if GAMEPAD_TRACE_EVENTS
+        // while a trace is replayed, it provides the tilt
+        if (!traceIsPlaying)
+#endif
+        {
+            putTilt(tilt);
+        }
+
+        gamepadSleep(tiltSamplingPeriod);
+    }
+    tiltSamplerIsRunning = false;
+}
+
+/**
+ * Queue a tilt report of filtered values, if it changed
+ * @param tilt filtered values(milli-g) of X, Y, Z
+ */
+void BluetoothGamepadService::putTilt(const int16_t *tilt)
+{
+    uint8_t report[GamepadTiltReport::size] = {0};
+    GamepadTiltReport::putElement<0, 0>(report, tiltAxisValue(tilt[0]));
+    GamepadTiltReport::putElement<0, 1>(report, tiltAxisValue(tilt[1]));
+    GamepadTiltReport::putElement<0, 2>(report, tiltAxisValue(tilt[2]));
+
+    if (tiltReport.put(report))
+    {
+#if GAMEPAD_TRACE_EVENTS
+        if (traceIsRecording)
+        {
+            uint32_t time = gamepadClockUs();
+            inputTrace.record(time, INPUT_TRACE_TILT_X, tilt[0]);
+            inputTrace.record(time, INPUT_TRACE_TILT_Y, tilt[1]);
+            inputTrace.record(time, INPUT_TRACE_TILT_Z, tilt[2]);
+        }
+#endif
+        scheduleReport();
+        if (isAxisActivity(tiltActivity, tilt, TiltFilter::AXES, GAMEPAD_TILT_ACTIVITY_THRESHOLD))
+        {
+            onInputActivity();
+        }
+    }
+}
+
+/**
+ * Send the latest report, if it changed
+ * @param report the report
+ * @param reservedCredits TX buffers the report must leave free
+ * @return false if the report must be sent again later
+ */
+template <typename Report>
+bool BluetoothGamepadService::sendPendingReport(PendingReport<Report> &report, uint8_t reservedCredits)
+{
+    if (!report.isDirty())
+    {
+        return true;
     }
 
-    ble.gattServer().write(inputReportValueHandle, inputReportData, 1);
+    // the producer may overwrite the report while it waits for a TX buffer: the latest value wins
+    if (txCredits() <= reservedCredits || !notify(report.valueHandle, report.data(), Report::size))
+    {
+        return false;
+    }
+    report.sent();
+    return true;
 }
+#endif
@@ -1,8 +1,19 @@
 #ifndef __BLEGAMEPAD_H__
 #define __BLEGAMEPAD_H__
 
-#include "ble/BLE.h"
-#include "ble/GattAttribute.h"
+#include "GamepadHal.h"
+#include "ButtonEdgeQueue.h"
+#include "HIDReportDescriptor.h"
+#include "TiltFilter.h"
+#include "GamepadDiagnostics.h"
+#include "InputTrace.h"
+#include "InputScanner.h"
+#include "ButtonSequencer.h"
+#include "AnalogSampler.h"
+#include "GamepadProfile.h"
+#include "HubLink.h"
+#include "PendingReport.h"
+#include "HIDBatteryService.h"
 
 #define BLE_UUID_DESCRIPTOR_CLIENT_CHARACTERISTIC_CONFIGURATION 0x2902
 #define BLE_UUID_DESCRIPTOR_REPORT_REFERENCE 0x2908
@@ -14,6 +25,54 @@ enum ButtonState
     BUTTON_DOWN
 };
 
+enum GamepadReportMode
+{
+    GAMEPAD_REPORT_ON_CHANGE, // as soon as input changes, within the minimum report interval
+    GAMEPAD_REPORT_ON_RADIO,  // just before the next connection event
+};
+
+enum GamepadConnectionParameter
+{
+    GAMEPAD_CONNECTION_INTERVAL,            // microseconds
+    GAMEPAD_CONNECTION_SLAVE_LATENCY,       // connection events
+    GAMEPAD_CONNECTION_SUPERVISION_TIMEOUT, // milliseconds
+};
+
+enum GamepadPowerStat
+{
+    GAMEPAD_POWER_WAKEUPS,      // interrupts handled by the service per second
+    GAMEPAD_POWER_RADIO_EVENTS, // advertising or connection events per second
+    GAMEPAD_POWER_CURRENT,      // estimated average current of the radio and the wakeups(microamperes)
+};
+
+enum GamepadStartupStage
+{
+    GAMEPAD_STARTUP_BEGIN,        // the service was started
+    GAMEPAD_STARTUP_BLE_INIT,     // the BLE stack is initialized
+    GAMEPAD_STARTUP_SECURITY,     // the security manager is initialized
+    GAMEPAD_STARTUP_GATT,         // the services are registered
+    GAMEPAD_STARTUP_ADVERTISING,  // advertising started
+    GAMEPAD_STARTUP_CONNECTED,    // the first host connected
+    GAMEPAD_STARTUP_FIRST_REPORT, // the first gamepad report was sent
+    GAMEPAD_STARTUP_STAGES
+};
+
+enum GamepadHubStat
+{
+    GAMEPAD_HUB_FRAMES,         // valid frames received from the satellites
+    GAMEPAD_HUB_ERRORS,         // frames dropped for a bad player or checksum
+    GAMEPAD_HUB_LOST,           // frames missing from the sequence numbers
+    GAMEPAD_HUB_LATENCY_MAX_US, // from the first byte of a frame to its report queued in the SoftDevice
+    GAMEPAD_HUB_LATENCY_AVG_US,
+};
+
+enum GamepadOutput
+{
+    GAMEPAD_OUTPUT_RUMBLE,          // rumble intensity(%)
+    GAMEPAD_OUTPUT_RUMBLE_DURATION, // rumble duration(milliseconds), 0 until the next output report
+    GAMEPAD_OUTPUT_LEDS,            // LED matrix, 5 bits per row from the top, bit 0 for the left column
+};
+
 enum GamepadButton
 {
     GAMEPAD_BUTTON_UP = 0x1,
@@ -33,17 +92,466 @@ enum GamepadButton
 #define BOOT_PROTOCOL 0x0
 #define REPORT_PROTOCOL 0x1
 
+#define HID_CONTROL_POINT_SUSPEND 0x0
+#define HID_CONTROL_POINT_EXIT_SUSPEND 0x1
+
+/**
+ * Minimum spacing between two input reports(microseconds)
+ */
+#ifndef GAMEPAD_REPORT_MIN_INTERVAL_US
+#define GAMEPAD_REPORT_MIN_INTERVAL_US 7500
+#endif
+
+/**
+ * Interval of the periodic keep-alive report(microseconds), 0 to disable
+ */
+#ifndef GAMEPAD_REPORT_KEEP_ALIVE_US
+#define GAMEPAD_REPORT_KEEP_ALIVE_US 0
+#endif
+
+/**
+ * Number of button edges buffered between setButton() and the report path, a power of two
+ */
+#ifndef GAMEPAD_EDGE_QUEUE_SIZE
+#define GAMEPAD_EDGE_QUEUE_SIZE 16
+#endif
+
+/**
+ * Connection parameters requested while input is active(1.25 milliseconds units, 10 milliseconds units for the timeout)
+ */
+#ifndef GAMEPAD_ACTIVE_CONNECTION_MIN_INTERVAL
+#define GAMEPAD_ACTIVE_CONNECTION_MIN_INTERVAL 6 // 7.5 milliseconds, the shortest allowed
+#endif
+#ifndef GAMEPAD_ACTIVE_CONNECTION_MAX_INTERVAL
+#define GAMEPAD_ACTIVE_CONNECTION_MAX_INTERVAL 12 // 15 milliseconds
+#endif
+#ifndef GAMEPAD_ACTIVE_CONNECTION_SLAVE_LATENCY
+#define GAMEPAD_ACTIVE_CONNECTION_SLAVE_LATENCY 0
+#endif
+
+/**
+ * Connection parameters requested after no input for the idle timeout
+ */
+#ifndef GAMEPAD_IDLE_CONNECTION_MIN_INTERVAL
+#define GAMEPAD_IDLE_CONNECTION_MIN_INTERVAL 80 // 100 milliseconds
+#endif
+#ifndef GAMEPAD_IDLE_CONNECTION_MAX_INTERVAL
+#define GAMEPAD_IDLE_CONNECTION_MAX_INTERVAL 100 // 125 milliseconds
+#endif
+#ifndef GAMEPAD_IDLE_CONNECTION_SLAVE_LATENCY
+#define GAMEPAD_IDLE_CONNECTION_SLAVE_LATENCY 4
+#endif
+
+#ifndef GAMEPAD_SUPERVISION_TIMEOUT
+#define GAMEPAD_SUPERVISION_TIMEOUT 3200 // 32 seconds
+#endif
+
+/**
+ * Time without input before the idle connection parameters are requested(milliseconds), 0 to stay active
+ */
+#ifndef GAMEPAD_IDLE_TIMEOUT_MS
+#define GAMEPAD_IDLE_TIMEOUT_MS 5000
+#endif
+
+/**
+ * Advertising interval(milliseconds) and duration(seconds) of the fast phase, accepting bonded hosts only
+ */
+#ifndef GAMEPAD_FAST_ADVERTISING_INTERVAL
+#define GAMEPAD_FAST_ADVERTISING_INTERVAL 20
+#endif
+#ifndef GAMEPAD_WHITELIST_ADVERTISING_TIMEOUT
+#define GAMEPAD_WHITELIST_ADVERTISING_TIMEOUT 5
+#endif
+
+/**
+ * Advertising interval(milliseconds) and duration(seconds) of the burst open to any host,
+ * after which advertising slows down until a host connects or input is set, 0 to never slow down
+ */
+#ifndef GAMEPAD_GENERAL_ADVERTISING_INTERVAL
+#define GAMEPAD_GENERAL_ADVERTISING_INTERVAL 50
+#endif
+#ifndef GAMEPAD_GENERAL_ADVERTISING_TIMEOUT
+#define GAMEPAD_GENERAL_ADVERTISING_TIMEOUT 30
+#endif
+#ifndef GAMEPAD_SLOW_ADVERTISING_INTERVAL
+#define GAMEPAD_SLOW_ADVERTISING_INTERVAL 1000
+#endif
+
+/**
+ * Shortest time(seconds) between the start of a general burst and input starting another one while advertising slowly
+ */
+#ifndef GAMEPAD_ADVERTISING_RESTART_INTERVAL
+#define GAMEPAD_ADVERTISING_RESTART_INTERVAL 120
+#endif
+
+/**
+ * Charges used to estimate the current: one advertising event on three channels, one empty
+ * connection event and one interrupt(nanocoulombs), and the sleep current(microamperes).
+ * Rough nRF51 figures; the display, the accelerometer and the DAL system tick are not included.
+ */
+#ifndef GAMEPAD_ADVERTISING_EVENT_NC
+#define GAMEPAD_ADVERTISING_EVENT_NC 15000
+#endif
+#ifndef GAMEPAD_CONNECTION_EVENT_NC
+#define GAMEPAD_CONNECTION_EVENT_NC 8000
+#endif
+#ifndef GAMEPAD_WAKEUP_NC
+#define GAMEPAD_WAKEUP_NC 50
+#endif
+#ifndef GAMEPAD_SLEEP_UA
+#define GAMEPAD_SLEEP_UA 3
+#endif
+
+/**
+ * Message bus ID of the events raised by the service
+ */
+#ifndef GAMEPAD_EVT_ID
+#define GAMEPAD_EVT_ID 9600
+#endif
+#define GAMEPAD_EVT_PEER_CHANGED 1
+#define GAMEPAD_EVT_LAYOUT_CHANGED 2
+#define GAMEPAD_EVT_OUTPUT 3
+#define GAMEPAD_EVT_PROFILE_WRITTEN 4
+
+/**
+ * Number of SoftDevice TX buffers the reports may use, 0 to use all of them
+ */
+#ifndef GAMEPAD_TX_BUFFERS
+#define GAMEPAD_TX_BUFFERS 0
+#endif
+
+/**
+ * Adds the accelerometer tilt report(Report ID 2), 0 to remove it
+ */
+#ifndef GAMEPAD_TILT_REPORT
+#define GAMEPAD_TILT_REPORT 1
+#endif
+
+/**
+ * Bits per tilt axis, 8 or 16
+ */
+#ifndef GAMEPAD_TILT_AXIS_BITS
+#define GAMEPAD_TILT_AXIS_BITS 16
+#endif
+
+/**
+ * Adds a keyboard report(Report ID 3) and a consumer control report(Report ID 4), 1 to add them
+ */
+#ifndef GAMEPAD_KEYBOARD_REPORT
+#define GAMEPAD_KEYBOARD_REPORT 0
+#endif
+#ifndef GAMEPAD_CONSUMER_REPORT
+#define GAMEPAD_CONSUMER_REPORT 0
+#endif
+
+/**
+ * Adds an output report(Report ID 5) the host writes rumble and LED feedback to, 0 to remove it
+ */
+#ifndef GAMEPAD_OUTPUT_REPORT
+#define GAMEPAD_OUTPUT_REPORT 1
+#endif
+
+/**
+ * Adds the Battery Service, 0 to remove it
+ */
+#ifndef GAMEPAD_BATTERY_SERVICE
+#define GAMEPAD_BATTERY_SERVICE 1
+#endif
+
+/**
+ * Supply voltages(millivolts) read as a 100% and as a 0% battery level, e.g. 2 AAA cells
+ */
+#ifndef GAMEPAD_BATTERY_FULL_MV
+#define GAMEPAD_BATTERY_FULL_MV 3000
+#endif
+#ifndef GAMEPAD_BATTERY_EMPTY_MV
+#define GAMEPAD_BATTERY_EMPTY_MV 2000
+#endif
+
+/**
+ * Time between two battery measurements(milliseconds), and the change of level(%) worth a notification
+ */
+#ifndef GAMEPAD_BATTERY_PERIOD_MS
+#define GAMEPAD_BATTERY_PERIOD_MS 60000
+#endif
+#ifndef GAMEPAD_BATTERY_HYSTERESIS
+#define GAMEPAD_BATTERY_HYSTERESIS 5
+#endif
+
+/**
+ * TX buffers kept free for gamepad reports: keyboard, consumer and battery notifications only use the ones left over
+ */
+#ifndef GAMEPAD_TX_RESERVED
+#define GAMEPAD_TX_RESERVED 1
+#endif
+
+/**
+ * Adds the input scanner reading buttons from pins in a timer interrupt, 0 to remove it
+ */
+#ifndef GAMEPAD_INPUT_SCANNER
+#define GAMEPAD_INPUT_SCANNER 1
+#endif
+
+/**
+ * Default time between two scans of the input pins(microseconds), and number of consecutive scans a pin must agree on
+ */
+#ifndef GAMEPAD_SCAN_PERIOD_US
+#define GAMEPAD_SCAN_PERIOD_US 1000
+#endif
+#ifndef GAMEPAD_DEBOUNCE_SCANS
+#define GAMEPAD_DEBOUNCE_SCANS 5
+#endif
+
+/**
+ * Adds turbo buttons and macros, 0 to remove them
+ */
+#ifndef GAMEPAD_SEQUENCER
+#define GAMEPAD_SEQUENCER 1
+#endif
+
+/**
+ * Time between two steps of turbo buttons and macros(microseconds), by default one report interval,
+ * and number of steps a macro holds
+ */
+#ifndef GAMEPAD_SEQUENCER_TICK_US
+#define GAMEPAD_SEQUENCER_TICK_US GAMEPAD_REPORT_MIN_INTERVAL_US
+#endif
+#ifndef GAMEPAD_MACRO_STEPS
+#define GAMEPAD_MACRO_STEPS 32
+#endif
+
+/**
+ * Longest time between two scans while disconnected or idle(microseconds): a press only has to wake the gamepad up
+ */
+#ifndef GAMEPAD_IDLE_SCAN_PERIOD_US
+#define GAMEPAD_IDLE_SCAN_PERIOD_US 10000
+#endif
+
+/**
+ * Adds analog sticks and triggers, sampled from the ADC, to the input report(Report ID 1), 1 to add them
+ */
+#ifndef GAMEPAD_ANALOG_AXES
+#define GAMEPAD_ANALOG_AXES 0
+#endif
+
+/**
+ * Default time between two bursts of analog conversions(microseconds), conversions averaged per axis,
+ * and deadzone of the sticks and triggers(out of 127)
+ */
+#ifndef GAMEPAD_ANALOG_PERIOD_US
+#define GAMEPAD_ANALOG_PERIOD_US 10000
+#endif
+#ifndef GAMEPAD_ANALOG_OVERSAMPLING
+#define GAMEPAD_ANALOG_OVERSAMPLING 8
+#endif
+#ifndef GAMEPAD_ANALOG_DEADZONE
+#define GAMEPAD_ANALOG_DEADZONE 10
+#endif
+
+/**
+ * Movement of an analog axis(out of 127) and of the tilt(milli-g) since the last one counted that counts as input
+ * activity: smaller changes are still reported, but noise and drift do not keep the connection out of idle
+ */
+#ifndef GAMEPAD_ANALOG_ACTIVITY_THRESHOLD
+#define GAMEPAD_ANALOG_ACTIVITY_THRESHOLD 24
+#endif
+#ifndef GAMEPAD_TILT_ACTIVITY_THRESHOLD
+#define GAMEPAD_TILT_ACTIVITY_THRESHOLD 300
+#endif
+
+/**
+ * Number of input events the trace recorder holds, 0 to remove the recorder and player
+ */
+#ifndef GAMEPAD_TRACE_EVENTS
+#define GAMEPAD_TRACE_EVENTS 0
+#endif
+
+/**
+ * Adds the controller profile: read from flash at startup, written through a vendor characteristic, 1 to add it
+ */
+#ifndef GAMEPAD_PROFILE
+#define GAMEPAD_PROFILE 0
+#endif
+
+/**
+ * Flash page holding the profile, counted from the end of flash: below the pages of the DAL storage(17 and 19)
+ * and of the bonds(the last ones). The build checks it against them when the DAL's configuration sets them.
+ */
+#ifndef GAMEPAD_PROFILE_PAGE
+#define GAMEPAD_PROFILE_PAGE 21
+#endif
+
+/**
+ * Number of satellite boards the hub collects players from over the serial link(up to 4),
+ * each reported as a gamepad of its own(Report ID 6 and up), 0 to remove the hub
+ */
+#ifndef GAMEPAD_HUB_PLAYERS
+#define GAMEPAD_HUB_PLAYERS 0
+#endif
+#define GAMEPAD_HUB_REPORT_ID 6
+
+/**
+ * 1 to make the micro:bit a satellite player of a hub instead, 0 to remove the satellite
+ */
+#ifndef GAMEPAD_HUB_SATELLITE
+#define GAMEPAD_HUB_SATELLITE 0
+#endif
+
+/**
+ * Time each satellite has to answer its poll(microseconds): longer than the poll and a frame(6 bytes)
+ * at the baud rate of the link, with the satellite's interrupt latency. The hub polls them in turn.
+ */
+#ifndef GAMEPAD_HUB_POLL_US
+#define GAMEPAD_HUB_POLL_US 2000
+#endif
+
+/**
+ * Adds the Device Information Service when the DAL does not, 0 to remove it.
+ * HID over GATT hosts expect its PnP ID, so only remove it for hosts known to do without.
+ */
+#ifndef GAMEPAD_DEVICE_INFORMATION_SERVICE
+#define GAMEPAD_DEVICE_INFORMATION_SERVICE 1
+#endif
+
+/**
+ * Estimated bytes of one attribute in the SoftDevice attribute table, besides its value
+ */
+#ifndef GAMEPAD_GATT_ATTRIBUTE_BYTES
+#define GAMEPAD_GATT_ATTRIBUTE_BYTES 12
+#endif
+
+/**
+ * Bytes of static RAM the service and its GATT services may take: the build fails above it
+ */
+#ifndef GAMEPAD_RAM_BUDGET
+#define GAMEPAD_RAM_BUDGET 2560
+#endif
+
 typedef struct
 {
     uint8_t ID;
     uint8_t type;
 } report_reference_t;
 
+/**
+ * Input report(Report ID 1): D-pad as 2-bit X/Y axes(-1..1), then 4 buttons,
+ * then with GAMEPAD_ANALOG_AXES the left stick as Rx/Ry, the right stick as Z/Rz and the triggers
+ */
+typedef HIDInput<0x01,                        // Generic Desktop
+                 -1, 1, 2,                    // -1..1, 2 bits per axis
+                 0x30,                        // X
+                 0x31> GamepadAxes;           // Y
+typedef HIDInput<0x09,                        // Button
+                 0, 1, 1,                     // 0..1, 1 bit per button
+                 0x01,                        // Button A
+                 0x02,                        // Button B
+                 0x0b,                        // Select
+                 0x0c> GamepadButtons;        // Start
+#if GAMEPAD_ANALOG_AXES
+typedef HIDInput<0x01,                        // Generic Desktop
+                 -127, 127, 8,
+                 0x33,                        // Rx
+                 0x34,                        // Ry
+                 0x32,                        // Z
+                 0x35> GamepadSticks;         // Rz
+typedef HIDInput<0x02,                        // Simulation Controls
+                 0, 255, 8,
+                 0xc5,                        // Brake
+                 0xc4> GamepadTriggers;       // Accelerator
+typedef HIDReport<0x01, GamepadAxes, GamepadButtons, GamepadSticks, GamepadTriggers> GamepadInputReport;
+#else
+typedef HIDReport<0x01, GamepadAxes, GamepadButtons> GamepadInputReport;
+#endif
+
+/**
+ * Input report of a satellite player(Report ID 6 and up): the D-pad and buttons of the input report
+ */
+template <uint8_t Player>
+using GamepadPlayerReport = HIDReport<GAMEPAD_HUB_REPORT_ID + Player, GamepadAxes, GamepadButtons>;
+
+/**
+ * Put a button state into a report starting with GamepadAxes and GamepadButtons
+ */
+template <typename Report>
+inline void gamepadPutButtons(uint8_t *report, uint8_t state)
+{
+    // axes: opposite directions cancel out
+    Report::template putElement<0, 0>(report, ((state & GAMEPAD_BUTTON_RIGHT) != 0) - ((state & GAMEPAD_BUTTON_LEFT) != 0));
+    Report::template putElement<0, 1>(report, ((state & GAMEPAD_BUTTON_DOWN) != 0) - ((state & GAMEPAD_BUTTON_UP) != 0));
+
+    // buttons: A, B, Select, Start are the upper 4 bits of the state
+    Report::template put<1>(report, state >> 4);
+}
+
+/**
+ * Tilt report(Report ID 2): filtered accelerometer X/Y/Z
+ */
+#if GAMEPAD_TILT_AXIS_BITS == 8
+typedef HIDInput<0x01,                        // Generic Desktop
+                 -127, 127, 8,                // 16 milli-g per step
+                 0x30,                        // X
+                 0x31,                        // Y
+                 0x32> GamepadTiltAxes;       // Z
+#define GAMEPAD_TILT_AXIS_SHIFT 4
+#elif GAMEPAD_TILT_AXIS_BITS == 16
+typedef HIDInput<0x01,                        // Generic Desktop
+                 -2048, 2047, 16,             // 1 milli-g per step
+                 0x30,                        // X
+                 0x31,                        // Y
+                 0x32> GamepadTiltAxes;       // Z
+#define GAMEPAD_TILT_AXIS_SHIFT 0
+#else
+#error "GAMEPAD_TILT_AXIS_BITS must be 8 or 16"
+#endif
+typedef HIDReport<0x02, GamepadTiltAxes> GamepadTiltReport;
+
+/**
+ * Keyboard report(Report ID 3): modifier keys, a reserved byte, then up to 6 pressed keys
+ */
+typedef HIDInput<0x07,                        // Keyboard/Keypad
+                 0, 1, 1,
+                 0xe0, 0xe1, 0xe2, 0xe3,      // Left Control, Shift, Alt, GUI
+                 0xe4, 0xe5, 0xe6, 0xe7> GamepadKeyboardModifiers; // Right Control, Shift, Alt, GUI
+typedef HIDArray<0x07,                        // Keyboard/Keypad
+                 0, 0x65, 8, 6> GamepadKeyboardKeys;
+typedef HIDReport<0x03, GamepadKeyboardModifiers, HIDPadding<8>, GamepadKeyboardKeys> GamepadKeyboardReport;
+
+/**
+ * Consumer control report(Report ID 4): one consumer usage, e.g. Volume Increment(0xe9), 0 for none
+ */
+typedef HIDArray<0x0c,                        // Consumer
+                 0, 0x3ff, 16, 1> GamepadConsumerUsage;
+typedef HIDReport<0x04, GamepadConsumerUsage> GamepadConsumerReport;
+
+/**
+ * Output report(Report ID 5): rumble intensity and duration, then the rows of the LED matrix
+ */
+typedef HIDOutput<0x0e,                       // Haptics
+                  0, 100, 8,                  // percent
+                  0x23> GamepadRumbleIntensity; // Intensity
+typedef HIDOutput<0x0e,                       // Haptics
+                  0, 255, 8,                  // 10 milliseconds per step, 0 until the next report
+                  0x28> GamepadRumbleDuration; // Waveform Cutoff Time
+typedef HIDOutput<0x08,                       // LEDs
+                  0, 31, 5,                   // one bit per column
+                  0x4b, 0x4b, 0x4b, 0x4b, 0x4b> GamepadLeds; // Generic Indicator, one per row
+typedef HIDReport<0x05, GamepadRumbleIntensity, GamepadRumbleDuration, GamepadLeds, HIDPadding<7, OUTPUT(1)>> GamepadOutputReport;
+
+extern "C" void SWI3_IRQHandler(void);
+#if GAMEPAD_ANALOG_AXES
+extern "C" void ADC_IRQHandler(void);
+#endif
+
 /** 
  * A class to communicate a BLE Gamepad device
  */
 class BluetoothGamepadService
 {
+    friend void ::SWI3_IRQHandler(void);
+#if GAMEPAD_ANALOG_AXES
+    friend void ::ADC_IRQHandler(void);
+#endif
+
   public:
     /**
      * Constructor
@@ -56,21 +564,519 @@ class BluetoothGamepadService
      */
     void setButton(GamepadButton button, ButtonState state);
 
+    /**
+     * Set the state of all buttons at once
+     * @param buttons GamepadButton bits of the pressed buttons
+     */
+    void setButtons(uint8_t buttons);
+
+    /**
+     * Press buttons, leaving the others as they are
+     * @param buttons GamepadButton bits
+     */
+    void pressButtons(uint8_t buttons);
+
+    /**
+     * Release buttons, leaving the others as they are
+     * @param buttons GamepadButton bits
+     */
+    void releaseButtons(uint8_t buttons);
+
+    /**
+     * Start collecting button changes. Nothing is reported until commitUpdate().
+     */
+    void beginUpdate();
+
+    /**
+     * Apply the button changes collected since beginUpdate() at once, as one report
+     */
+    void commitUpdate();
+
+    /**
+     * Press or release a key of the keyboard report. Up to 6 keys, plus the modifier keys, can be pressed at once.
+     * Does nothing unless built with GAMEPAD_KEYBOARD_REPORT.
+     * @param key the HID usage of the key, e.g. 0x04 for A, 0xe1 for Left Shift
+     * @param state BUTTON_DOWN to press
+     */
+    void setKey(uint8_t key, ButtonState state);
+
+    /**
+     * Set the consumer control report. Does nothing unless built with GAMEPAD_CONSUMER_REPORT.
+     * @param usage the HID usage of the active control, e.g. 0xcd for Play/Pause, 0 for none
+     */
+    void setConsumerControl(uint16_t usage);
+
+    /**
+     * Get the battery level the Battery Service reports
+     * @return the level(%), 0 unless built with GAMEPAD_BATTERY_SERVICE
+     */
+    uint8_t getBatteryLevel();
+
+    /**
+     * Get a value of the last output report the host wrote
+     * @return the value, 0 unless built with GAMEPAD_OUTPUT_REPORT
+     */
+    uint32_t getOutput(GamepadOutput output);
+
+    /**
+     * Switch a pin, e.g. driving a vibration motor, on while the host asks for rumble.
+     * The pin is switched from the write callback, in the connection event the report arrives in.
+     * @param pin GPIO number(0..31), configured as a digital output by the caller, or a larger value for none
+     */
+    void setRumblePin(uint8_t pin);
+
+    /**
+     * Show the LEDs of output reports on the LED matrix
+     */
+    void setLedFeedback(bool enabled);
+
+    /**
+     * Read a button from a pin in the input scanner, a timer interrupt sampling all mapped pins at once.
+     * Buttons of the scanner and of setButton() are combined.
+     * @param button the button
+     * @param pin the pin, configured as a digital input by the caller
+     * @param activeLow true if the pin reads 0 while the button is pressed
+     */
+    void setInputPin(GamepadButton button, PinName pin, bool activeLow);
+
+    /**
+     * Set the input scanner timing
+     * @param period time between two scans(microseconds)
+     * @param samples number of consecutive scans a pin must agree on
+     */
+    void setInputScanning(uint32_t period, uint8_t samples);
+
+    /**
+     * Repeat a button while it is held, from a timer
+     * @param button the button
+     * @param rate presses per second, 0 to turn turbo off
+     */
+    void setTurbo(GamepadButton button, uint8_t rate);
+
+    /**
+     * Append a step to the macro, e.g. PRESS A, WAIT 2, RELEASE A, WAIT 2.
+     * Each WAIT tick is GAMEPAD_SEQUENCER_TICK_US long.
+     * @return false if the macro holds GAMEPAD_MACRO_STEPS steps already
+     */
+    bool addMacroStep(GamepadMacroOp op, uint8_t arg);
+
+    /**
+     * Stop and remove the macro
+     */
+    void clearMacro();
+
+    /**
+     * Play the macro from a timer. Its buttons are combined with the buttons held.
+     * @param loop true to repeat it until stopMacro()
+     */
+    void playMacro(bool loop);
+
+    void stopMacro();
+
+    bool isMacroPlaying();
+
+    /**
+     * Read an analog axis from a pin, converted by the ADC in bursts between reports.
+     * Does nothing unless built with GAMEPAD_ANALOG_AXES.
+     * @param axis the axis
+     * @param pin GPIO number of an analog pin, switched to analog mode, or NC to unmap the axis
+     * @param inverted true if the pin reads higher to the left, to the top, or at the rest position of a trigger
+     * @return false if the pin has no ADC input
+     */
+    bool setAnalogPin(GamepadAnalogAxis axis, PinName pin, bool inverted);
+
+    /**
+     * Set the analog sampling
+     * @param period time between two bursts of conversions(microseconds)
+     * @param oversampling conversions averaged per axis(1..64)
+     * @param deadzone deadzone of the sticks and triggers(out of 127)
+     */
+    void setAnalogSampling(uint32_t period, uint8_t oversampling, uint8_t deadzone);
+
+    /**
+     * Use the current position of the sticks as their centers, and of the triggers as their rest positions
+     */
+    void calibrateAnalog();
+
+    /**
+     * Get the value of an analog axis, as reported
+     * @return -127..127 for the sticks, 0..255 for the triggers, 0 unless built with GAMEPAD_ANALOG_AXES
+     */
+    int32_t getAnalogAxis(GamepadAnalogAxis axis);
+
+    /**
+     * Set the timing of input reports
+     * @param minInterval minimum spacing between two reports(microseconds)
+     * @param keepAlive interval of the periodic keep-alive report(microseconds), 0 to disable
+     */
+    void setReportInterval(uint32_t minInterval, uint32_t keepAlive);
+
+    /**
+     * Set when input reports are sent
+     */
+    void setReportMode(GamepadReportMode mode);
+
+    /**
+     * Start or stop sampling the accelerometer for the tilt report
+     * @param period sampling period(milliseconds), 0 to stop
+     */
+    void setTiltSampling(uint16_t period);
+
+    /**
+     * Set the tilt filter
+     * @param smoothing 0 for no filtering, n for y += (x - y) / 2^n
+     * @param deadzone values within +/- deadzone(milli-g) read as 0
+     */
+    void setTiltFilter(uint8_t smoothing, int16_t deadzone);
+
+    /**
+     * Use the current tilt as the center
+     */
+    void calibrateTilt();
+
+    /**
+     * Set the time without input before the idle connection parameters are requested
+     * @param timeout time(milliseconds), 0 to always use the active connection parameters
+     */
+    void setIdleTimeout(uint32_t timeout);
+
+    /**
+     * Get a parameter of the current connection, as granted by the host
+     * @return the parameter, 0 when not connected
+     */
+    uint32_t getConnectionParameter(GamepadConnectionParameter parameter);
+
+    /**
+     * Get a report path counter or timing, 0 unless built with GAMEPAD_DIAGNOSTICS
+     */
+    uint32_t getDiagnostic(GamepadDiagnostic diagnostic);
+
+    /**
+     * Get a bucket of the press-to-queue latency histogram: < 1 ms, < 2 ms, < 4 ms, ... and the rest
+     */
+    uint32_t getLatencyHistogram(uint8_t bucket);
+
+    void resetDiagnostics();
+
+    /**
+     * Get the time from the last disconnection to the following connection
+     * @return the time(milliseconds), 0 before the first reconnection
+     */
+    uint32_t getReconnectTime();
+
+    /**
+     * Start or stop recording input events, from setButton() and the tilt filter.
+     * Starting clears the previous trace. Does nothing unless built with GAMEPAD_TRACE_EVENTS.
+     */
+    void recordTrace(bool record);
+
+    /**
+     * Replay the trace into the report path at its original timing, in a fiber.
+     * Live input is ignored until the replay ends.
+     */
+    void playTrace();
+
+    /**
+     * Send the trace to the serial port: an InputTraceHeader, then the events
+     */
+    void sendTrace();
+
+    /**
+     * Replace the trace by one received from the serial port, in the format of sendTrace()
+     * @return the number of events received, 0 if the header is invalid
+     */
+    uint16_t receiveTrace();
+
+    /**
+     * Get the number of events in the trace
+     */
+    uint16_t getTraceLength();
+
+    /**
+     * Get the time a startup stage completed at
+     * @return the time since boot(microseconds), 0 if the stage has not completed yet
+     */
+    uint32_t getStartupTime(GamepadStartupStage stage);
+
+    /**
+     * Get a wakeup rate or the estimated current.
+     * Rates are averaged over at least one second since the previous update.
+     */
+    uint32_t getPowerStat(GamepadPowerStat stat);
+
+    /**
+     * @return true if the service started with the profile in flash, false unless built with GAMEPAD_PROFILE
+     */
+    bool isProfileLoaded();
+
+    /**
+     * Erase the profile in flash: the next boot starts with the defaults
+     */
+    void clearProfile();
+
+    /**
+     * Poll the satellite players in turn over the serial link, and collect their frames in the UART interrupt.
+     * Does nothing unless built with GAMEPAD_HUB_PLAYERS.
+     * @param tx the transmit pin, wired to the receive pins of the satellites
+     * @param rx the receive pin, pulled up, wired to the open-drain transmit pins of the satellites
+     * @param baud the baud rate of the satellites
+     */
+    void startHub(PinName tx, PinName rx, uint32_t baud);
+
+    /**
+     * Get a counter or the forwarding latency of the hub, 0 unless built with GAMEPAD_HUB_PLAYERS
+     */
+    uint32_t getHubStat(GamepadHubStat stat);
+
   private:
+    enum AdvertisingPhase
+    {
+        ADVERTISING_DIRECTED,
+        ADVERTISING_WHITELIST,
+        ADVERTISING_GENERAL,
+        ADVERTISING_SLOW,
+    };
+
     BLEDevice &ble;
     bool connected;
 
-    Ticker reportTicker;
+    uint32_t startupTimes[GAMEPAD_STARTUP_STAGES];
+
+    void markStartup(GamepadStartupStage stage);
+    Gap::Handle_t connectionHandle;
+    Gap::ConnectionParams_t connectionParams;
+
+    GamepadPeerAddress connectionPeer;
+    GamepadPeerAddress bondedPeer;
+    bool peerIsStored;
+    volatile AdvertisingPhase advertisingPhase;
+    uint32_t generalAdvertisingTime;
+    uint32_t disconnectionTime;
+    uint32_t reconnectTime;
+
+    uint32_t gattLayout;
+    volatile bool layoutIsChanged;
+
+    // the build defaults, or the profile in flash
+    const Gap::ConnectionParams_t *activeConnectionParams;
+    const Gap::ConnectionParams_t *idleConnectionParams;
+
+    GamepadTimeout idleTimeout;
+    uint32_t idleTimeoutPeriod;
+    volatile uint32_t lastInputTime;
+    volatile bool connectionIsIdle;
+
+    volatile uint32_t wakeups;
+    uint32_t wakeupsCounted;
+    uint32_t wakeupsCountTime;
+    uint32_t wakeupRate;
+
+    GamepadTicker reportTicker;
     bool reportTickerIsActive;
 
+    GamepadTimeout reportTimeout;
+    volatile bool reportIsScheduled;
+    uint32_t lastReportTime;
+    uint32_t reportMinInterval;
+    uint32_t reportKeepAlive;
+    volatile bool reportIsBlocked;
+    volatile bool reportIsPending;
+    volatile bool keepAliveIsDue;
+    GamepadReportMode reportMode;
+    bool radioNotificationIsActive;
+
+    uint8_t txCapacity;
+    volatile uint32_t txQueued;
+    volatile uint32_t txCompleted;
+
     uint8_t protocolMode;
     uint8_t controlPointCommand;
-    uint8_t inputReportData[1];
+    uint8_t inputReportData[GamepadInputReport::size];
+    GattAttribute::Handle_t protocolModeValueHandle;
+    GattAttribute::Handle_t controlPointValueHandle;
+
+    void onDataWritten(const GattWriteCallbackParams *params);
+
+#if GAMEPAD_OUTPUT_REPORT
+    GattAttribute::Handle_t outputReportValueHandle;
+    volatile uint8_t rumblePin;
+    bool ledFeedbackIsEnabled;
+    uint8_t outputRumble;
+    uint8_t outputRumbleDuration;
+    uint32_t outputLeds;
+    GamepadTimeout rumbleTimeout;
+
+    void applyOutputReport(const uint8_t *report);
+
+    void stopRumble();
+#endif
+
+    volatile uint8_t buttonsState;
+    bool updateIsOpen;
+    uint8_t updatedButtonsState;
+    ButtonEdgeQueue<GAMEPAD_EDGE_QUEUE_SIZE> buttonEdges;
+
+#if GAMEPAD_INPUT_SCANNER
+    // the input scanner produces its own edges from its timer interrupt
+    InputScanner inputScanner;
+    GamepadTicker scanTicker;
+    uint32_t scanPeriod;
+    volatile uint8_t scannedButtonsState;
+    uint8_t sentScannedButtons;
+    ButtonEdgeQueue<GAMEPAD_EDGE_QUEUE_SIZE> scannedButtonEdges;
+
+    void scanInputs();
+#endif
+
+#if GAMEPAD_SEQUENCER
+    // turbo and macros produce their own edges from the sequencer timer
+    ButtonSequencer<GAMEPAD_MACRO_STEPS> sequencer;
+    GamepadTicker sequencerTicker;
+    volatile bool sequencerIsRunning;
+    volatile uint8_t sequencedButtons;
+    volatile uint8_t sequencedSuppressed;
+    uint8_t sentSequencedButtons;
+    uint8_t sentSequencedSuppressed;
+    ButtonEdgeQueue<GAMEPAD_EDGE_QUEUE_SIZE> sequencedButtonEdges;
+
+    void startSequencer();
+
+    void sequencerTick();
+#endif
+
+#if GAMEPAD_ANALOG_AXES
+    // the ADC interrupt publishes the axes, at the priority of the report interrupt reading them
+    AnalogSampler analogSampler;
+    GamepadTicker analogTicker;
+    uint32_t analogPeriod;
+    volatile bool analogBurstIsRunning;
+    volatile bool adcIsReserved;
+    GamepadAdcConfig adcSaved;
+    volatile int16_t analogAxes[AnalogSampler::AXES];
+    int16_t analogActivityAxes[AnalogSampler::AXES];
+
+    void startAnalogBurst();
+
+    void onAnalogSample();
+
+    void reserveAdc();
+#endif
+
+    // the buttons as of the last edge sent, with the scanner's and the sequencer's above
+    uint8_t sentButtons;
+
+#if GAMEPAD_TILT_REPORT
+    TiltFilter tiltFilter;
+    volatile uint16_t tiltSamplingPeriod;
+    bool tiltSamplerIsRunning;
+    PendingReport<GamepadTiltReport> tiltReport;
+    int16_t tiltActivity[TiltFilter::AXES];
+
+    static void tiltSamplerEntry(void *param);
+
+    void sampleTilt();
+
+    void putTilt(const int16_t *tilt);
+#endif
+
+#if GAMEPAD_KEYBOARD_REPORT
+    PendingReport<GamepadKeyboardReport> keyboardReport;
+    uint8_t keyboardModifiers;
+    uint8_t keyboardKeys[GamepadKeyboardKeys::count];
+#endif
+
+#if GAMEPAD_CONSUMER_REPORT
+    PendingReport<GamepadConsumerReport> consumerReport;
+#endif
+
+    template <typename Report>
+    bool sendPendingReport(PendingReport<Report> &report, uint8_t reservedCredits);
+
+#if GAMEPAD_BATTERY_SERVICE
+    HIDBatteryService *batteryService;
+    volatile bool batteryLevelIsDirty;
+
+    static void batteryMonitorEntry(void *param);
+
+    void monitorBattery();
+
+    bool sendBatteryLevel();
+#endif
 
-    uint8_t buttonsState;
+#if GAMEPAD_DIAGNOSTICS
+    GamepadDiagnostics diagnostics;
+    GattAttribute::Handle_t diagnosticsValueHandle;
+#endif
 
-    int8_t axisX;
-    int8_t axisY;
+#if GAMEPAD_PROFILE
+    GattAttribute::Handle_t profileValueHandle;
+    GamepadProfile stagedProfile;
+    volatile bool profileCommitIsPending;
+    bool profileIsLoaded;
+
+    void applyProfile(const GamepadProfile *profile);
+
+    void onProfileWritten(GamepadEvent);
+#endif
+
+#if GAMEPAD_HUB_PLAYERS
+    // the UART interrupt writes the reports in place, the report interrupt sends them from there
+    HubLink<GAMEPAD_HUB_PLAYERS, GamepadPlayerReport<0>::size> hubLink;
+    // the poll timer only queues its poll: the UART interrupt sends it
+    HubLinkTx<2> hubLinkTx;
+    GamepadTicker hubPollTicker;
+    GattAttribute::Handle_t hubValueHandles[GAMEPAD_HUB_PLAYERS];
+    uint8_t hubSentReports[GAMEPAD_HUB_PLAYERS][GamepadPlayerReport<0>::size];
+    volatile uint8_t hubDirtyPlayers;
+    uint32_t hubLatencyMax;
+    uint32_t hubLatencyTotal;
+    uint32_t hubLatencyCount;
+
+    void pollHub();
+
+    void onHubReceived();
+
+    bool sendHubReports();
+#endif
+
+#if GAMEPAD_TRACE_EVENTS
+    InputTrace<GAMEPAD_TRACE_EVENTS> inputTrace;
+    bool traceIsRecording;
+    volatile bool traceIsPlaying;
+
+    static void tracePlayerEntry(void *param);
+
+    void replayTrace();
+#endif
+
+    void changeButtons(uint8_t released, uint8_t pressed);
+
+    uint8_t heldButtons();
+
+    void updateButtons(uint8_t newButtonsState);
+
+    void updateDiagnostics();
+
+    void startInputScanner();
+
+    void startAnalogSampler();
+
+    void countWakeup();
+
+    /**
+     * @return advertising or connection events per 1000 seconds
+     */
+    uint32_t getRadioEventRate();
+
+    void onInputActivity();
+
+    void startIdleTimeout();
+
+    void onIdleTimeout();
+
+    void enterIdle();
+
+    void requestConnectionParams(bool idle);
 
     void onConnection(const Gap::ConnectionCallbackParams_t *params);
     void onDisconnection(const Gap::DisconnectionCallbackParams_t *params);
@@ -81,10 +1087,40 @@ class BluetoothGamepadService
 
     void stopReportTicker();
 
+    void scheduleReport();
+
     void sendCallback();
 
+    void reportTimeoutCallback();
+
+    void keepAliveCallback();
+
+    void onRadioNotification(bool radioActive);
+
+    void onDataSent(unsigned count);
+
+    uint8_t txCredits() const;
+
+    bool notify(GattAttribute::Handle_t handle, const uint8_t *data, uint16_t length);
+
+    bool sendReport(uint8_t state, bool force);
+
+    void setupAdvertising();
+
     void startAdvertise();
 
+    void startAdvertisingPhase(AdvertisingPhase phase);
+
+    static void onGapTimeout(Gap::TimeoutSource_t source);
+
+    static void onLinkSecured(Gap::Handle_t handle, SecurityManager::SecurityMode_t securityMode);
+
+    bool isPeerBonded();
+
+    void onPeerChanged(GamepadEvent);
+
+    void onLayoutChanged(GamepadEvent);
+
     void startService();
 };
 
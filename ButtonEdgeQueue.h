@@ -0,0 +1,102 @@
+#ifndef __BUTTON_EDGE_QUEUE_H__
+#define __BUTTON_EDGE_QUEUE_H__
+
+#include "GamepadHal.h"
+
+/**
+ * A button edge: the state of all buttons just after one of them changed
+ */
+typedef struct
+{
+    uint32_t time;
+    uint8_t buttons;
+    uint8_t suppressed; // buttons to report released although held, e.g. by turbo
+} ButtonEdge;
+
+/**
+ * A lock-free single producer / single consumer ring of button edges.
+ *
+ * The producer only writes `head`, the consumer only writes `tail`, so
+ * neither side needs to disable interrupts.
+ * @tparam SIZE number of edges, must be a power of two
+ */
+template <uint8_t SIZE>
+class ButtonEdgeQueue
+{
+    static_assert(SIZE > 0 && (SIZE & (SIZE - 1)) == 0, "ButtonEdgeQueue size must be a power of two");
+
+  public:
+    ButtonEdgeQueue() : head(0), tail(0)
+    {
+    }
+
+    /**
+     * Append an edge (producer side)
+     * @param buttons the state of all buttons
+     * @param time the time of the edge(microseconds)
+     * @param suppressed buttons to report released although held
+     * @return false if the queue is full
+     */
+    bool push(uint8_t buttons, uint32_t time, uint8_t suppressed = 0)
+    {
+        uint8_t h = head;
+        if ((uint8_t)(h - tail) == SIZE)
+        {
+            return false;
+        }
+
+        ButtonEdge &edge = edges[h & (SIZE - 1)];
+        edge.time = time;
+        edge.buttons = buttons;
+        edge.suppressed = suppressed;
+
+        // the edge must be complete before the consumer can see it
+        __DMB();
+        head = h + 1;
+        return true;
+    }
+
+    /**
+     * Read the oldest edge without removing it (consumer side)
+     * @param edge the edge read
+     * @return false if the queue is empty
+     */
+    bool peek(ButtonEdge &edge) const
+    {
+        uint8_t t = tail;
+        if (head == t)
+        {
+            return false;
+        }
+        __DMB();
+        edge = edges[t & (SIZE - 1)];
+        return true;
+    }
+
+    /**
+     * Remove the oldest edge (consumer side)
+     */
+    void pop()
+    {
+        uint8_t t = tail;
+        if (head == t)
+        {
+            return;
+        }
+        // the edge must be read before the producer can overwrite it
+        __DMB();
+        tail = t + 1;
+    }
+
+    bool isEmpty() const
+    {
+        return head == tail;
+    }
+
+  private:
+    ButtonEdge edges[SIZE];
+    volatile uint8_t head;
+    volatile uint8_t tail;
+};
+
+#endif /* __BUTTON_EDGE_QUEUE_H__ */
@@ -0,0 +1,221 @@
+#ifndef __BUTTON_SEQUENCER_H__
+#define __BUTTON_SEQUENCER_H__
+
+#include <stdint.h>
+
+enum GamepadMacroOp
+{
+    GAMEPAD_MACRO_PRESS,   // arg: buttons to press
+    GAMEPAD_MACRO_RELEASE, // arg: buttons to release
+    GAMEPAD_MACRO_WAIT,    // arg: ticks to keep the buttons as they are(1..255)
+};
+
+/**
+ * One step of a macro program
+ */
+typedef struct
+{
+    uint8_t op; // GamepadMacroOp
+    uint8_t arg;
+} GamepadMacroStep;
+
+/**
+ * Turbo buttons and a macro player, advanced one tick at a time from a timer.
+ *
+ * Turbo: while a turbo button is held, it is reported pressed for `ticks` ticks, then released
+ * for `ticks` ticks, and so on, starting pressed.
+ * Macro: the program runs PRESS and RELEASE steps until a WAIT step, which ends the tick.
+ *
+ * The program and the turbo settings are changed from fibers, and only while stopped
+ * (programs may grow while playing); tick() runs in the timer interrupt.
+ * @tparam STEPS number of macro steps
+ */
+template <uint8_t STEPS>
+class ButtonSequencer
+{
+    static_assert(STEPS > 0, "ButtonSequencer must hold at least one step");
+
+  public:
+    ButtonSequencer() : turboButtons(0), length(0), playing(false), repeat(false), pc(0), wait(0), macroButtons(0)
+    {
+        for (uint8_t i = 0; i < 8; i++)
+        {
+            turboTicks[i] = 0;
+            turboCount[i] = 0;
+        }
+    }
+
+    /**
+     * Set the turbo of a button
+     * @param button the GamepadButton bit
+     * @param ticks ticks pressed and ticks released, 0 to turn turbo off
+     */
+    void setTurbo(uint8_t button, uint8_t ticks)
+    {
+        for (uint8_t i = 0; i < 8; i++)
+        {
+            if (button & (1 << i))
+            {
+                turboTicks[i] = ticks;
+                turboCount[i] = 0;
+            }
+        }
+        if (ticks == 0)
+        {
+            turboButtons &= ~button;
+        }
+        else
+        {
+            turboButtons |= button;
+        }
+    }
+
+    uint8_t getTurboButtons() const
+    {
+        return turboButtons;
+    }
+
+    /**
+     * Append a step to the program
+     * @return false if the program is full
+     */
+    bool addStep(uint8_t op, uint8_t arg)
+    {
+        if (length == STEPS || op > GAMEPAD_MACRO_WAIT || (op == GAMEPAD_MACRO_WAIT && arg == 0))
+        {
+            return false;
+        }
+        steps[length].op = op;
+        steps[length].arg = arg;
+        length++;
+        return true;
+    }
+
+    void clear()
+    {
+        length = 0;
+    }
+
+    uint8_t size() const
+    {
+        return length;
+    }
+
+    /**
+     * Run the program from its first step on the next tick
+     * @param loop true to start over at the end of the program
+     */
+    void play(bool loop)
+    {
+        pc = 0;
+        wait = 0;
+        macroButtons = 0;
+        repeat = loop;
+        playing = length > 0;
+    }
+
+    /**
+     * Stop the program, releasing its buttons on the next tick
+     */
+    void stop()
+    {
+        playing = false;
+    }
+
+    bool isPlaying() const
+    {
+        return playing;
+    }
+
+    /**
+     * @return true if tick() has anything to do for the held buttons
+     */
+    bool isActive(uint8_t held) const
+    {
+        return playing || macroButtons != 0 || (held & turboButtons) != 0;
+    }
+
+    /**
+     * Advance one tick
+     * @param held the buttons held by the player
+     * @param suppressed set to the held turbo buttons in their released phase
+     * @return the buttons pressed by the program
+     */
+    uint8_t tick(uint8_t held, uint8_t &suppressed)
+    {
+        suppressed = 0;
+        for (uint8_t i = 0; i < 8; i++)
+        {
+            uint8_t bit = 1 << i;
+            if (!(turboButtons & held & bit))
+            {
+                turboCount[i] = 0;
+                continue;
+            }
+            if (turboCount[i] >= turboTicks[i])
+            {
+                suppressed |= bit;
+            }
+            if (++turboCount[i] >= 2 * turboTicks[i])
+            {
+                turboCount[i] = 0;
+            }
+        }
+
+        if (!playing)
+        {
+            macroButtons = 0;
+            return 0;
+        }
+        if (wait > 0 && --wait > 0)
+        {
+            return macroButtons;
+        }
+
+        // a program without WAIT steps runs at most once per tick
+        for (uint8_t executed = 0; executed < length; executed++)
+        {
+            if (pc == length)
+            {
+                if (!repeat)
+                {
+                    playing = false;
+                    macroButtons = 0;
+                    return 0;
+                }
+                pc = 0;
+            }
+
+            const GamepadMacroStep &step = steps[pc++];
+            if (step.op == GAMEPAD_MACRO_PRESS)
+            {
+                macroButtons |= step.arg;
+            }
+            else if (step.op == GAMEPAD_MACRO_RELEASE)
+            {
+                macroButtons &= ~step.arg;
+            }
+            else
+            {
+                wait = step.arg;
+                break;
+            }
+        }
+        return macroButtons;
+    }
+
+  private:
+    uint8_t turboTicks[8];
+    uint8_t turboCount[8];
+    volatile uint8_t turboButtons;
+
+    GamepadMacroStep steps[STEPS];
+    volatile uint8_t length;
+    volatile bool playing;
+    bool repeat;
+    uint8_t pc;
+    uint8_t wait;
+    uint8_t macroButtons;
+};
+
+#endif /* __BUTTON_SEQUENCER_H__ */
@@ -0,0 +1,153 @@
+#ifndef __GAMEPAD_DIAGNOSTICS_H__
+#define __GAMEPAD_DIAGNOSTICS_H__
+
+#include "GamepadHal.h"
+
+/**
+ * Set to 1 to count and time the report path, and to add the diagnostics characteristic.
+ * When 0, the GAMEPAD_DIAG_* macros compile to nothing.
+ */
+#ifndef GAMEPAD_DIAGNOSTICS
+#define GAMEPAD_DIAGNOSTICS 0
+#endif
+
+/**
+ * Number of press-to-queue latency histogram buckets: < 1 ms, < 2 ms, < 4 ms, ... and the rest
+ */
+#define GAMEPAD_LATENCY_BUCKETS 8
+
+enum GamepadDiagnostic
+{
+    GAMEPAD_DIAG_REPORTS_SENT,           // reports queued in the SoftDevice
+    GAMEPAD_DIAG_REPORTS_REJECTED,       // reports retried because no TX buffer was free
+    GAMEPAD_DIAG_REPORTS_DROPPED,        // reports the SoftDevice refused, e.g. notifications disabled
+    GAMEPAD_DIAG_DUPLICATES_SUPPRESSED,  // reports not sent because nothing changed
+    GAMEPAD_DIAG_EDGES_OVERFLOWED,       // button edges lost because the edge queue was full
+    GAMEPAD_DIAG_SET_BUTTON_MAX_US,      // setButton()
+    GAMEPAD_DIAG_SET_BUTTON_AVG_US,
+    GAMEPAD_DIAG_ENCODE_MAX_US,          // building one report
+    GAMEPAD_DIAG_ENCODE_AVG_US,
+    GAMEPAD_DIAG_WRITE_MAX_US,           // gattServer().write()
+    GAMEPAD_DIAG_WRITE_AVG_US,
+};
+
+#pragma pack(push, 1)
+/**
+ * Duration statistics(microseconds)
+ */
+typedef struct
+{
+    uint16_t max;
+    uint16_t count;
+    uint32_t total;
+} GamepadTiming;
+
+/**
+ * Report path counters, as read from the diagnostics characteristic(little endian)
+ */
+typedef struct
+{
+    uint32_t reportsSent;
+    uint32_t reportsRejected;
+    uint32_t reportsDropped;
+    uint32_t duplicatesSuppressed;
+    uint32_t edgesOverflowed;
+    GamepadTiming setButtonTime;
+    GamepadTiming encodeTime;
+    GamepadTiming writeTime;
+    uint16_t latencyHistogram[GAMEPAD_LATENCY_BUCKETS]; // press-to-queue latency
+} GamepadDiagnostics;
+#pragma pack(pop)
+
+/**
+ * Add one duration
+ * @param timing statistics to update
+ * @param duration duration(microseconds)
+ */
+inline void gamepadTimingAdd(GamepadTiming &timing, uint32_t duration)
+{
+    if (duration > 0xffff)
+    {
+        duration = 0xffff;
+    }
+    if (timing.count == 0xffff)
+    {
+        // keep the average meaningful instead of overflowing
+        timing.count /= 2;
+        timing.total /= 2;
+    }
+    if (duration > timing.max)
+    {
+        timing.max = duration;
+    }
+    timing.count++;
+    timing.total += duration;
+}
+
+/**
+ * Add one press-to-queue latency to the histogram
+ * @param latency latency(microseconds)
+ */
+inline void gamepadLatencyAdd(GamepadDiagnostics &diagnostics, uint32_t latency)
+{
+    uint8_t bucket = 0;
+    for (uint32_t limit = 1000; latency >= limit && bucket < GAMEPAD_LATENCY_BUCKETS - 1; limit <<= 1)
+    {
+        bucket++;
+    }
+    if (diagnostics.latencyHistogram[bucket] != 0xffff)
+    {
+        diagnostics.latencyHistogram[bucket]++;
+    }
+}
+
+/**
+ * Get one diagnostic value
+ */
+inline uint32_t gamepadDiagnostic(const GamepadDiagnostics &diagnostics, GamepadDiagnostic diagnostic)
+{
+    switch (diagnostic)
+    {
+        case GAMEPAD_DIAG_REPORTS_SENT:
+            return diagnostics.reportsSent;
+        case GAMEPAD_DIAG_REPORTS_REJECTED:
+            return diagnostics.reportsRejected;
+        case GAMEPAD_DIAG_REPORTS_DROPPED:
+            return diagnostics.reportsDropped;
+        case GAMEPAD_DIAG_DUPLICATES_SUPPRESSED:
+            return diagnostics.duplicatesSuppressed;
+        case GAMEPAD_DIAG_EDGES_OVERFLOWED:
+            return diagnostics.edgesOverflowed;
+        case GAMEPAD_DIAG_SET_BUTTON_MAX_US:
+            return diagnostics.setButtonTime.max;
+        case GAMEPAD_DIAG_SET_BUTTON_AVG_US:
+            return diagnostics.setButtonTime.count ? diagnostics.setButtonTime.total / diagnostics.setButtonTime.count : 0;
+        case GAMEPAD_DIAG_ENCODE_MAX_US:
+            return diagnostics.encodeTime.max;
+        case GAMEPAD_DIAG_ENCODE_AVG_US:
+            return diagnostics.encodeTime.count ? diagnostics.encodeTime.total / diagnostics.encodeTime.count : 0;
+        case GAMEPAD_DIAG_WRITE_MAX_US:
+            return diagnostics.writeTime.max;
+        case GAMEPAD_DIAG_WRITE_AVG_US:
+            return diagnostics.writeTime.count ? diagnostics.writeTime.total / diagnostics.writeTime.count : 0;
+    }
+    return 0;
+}
+
+/*
+ * Instrumentation of BluetoothGamepadService, which holds a `diagnostics` member when enabled.
+ * The Cortex-M0 has no cycle counter, so durations are measured with the 1 MHz us_ticker clock.
+ */
+#if GAMEPAD_DIAGNOSTICS
+#define GAMEPAD_DIAG_COUNT(counter) (diagnostics.counter++)
+#define GAMEPAD_DIAG_TIME_BEGIN(start) uint32_t start = gamepadClockUs()
+#define GAMEPAD_DIAG_TIME_END(timing, start) gamepadTimingAdd(diagnostics.timing, gamepadClockUs() - (start))
+#define GAMEPAD_DIAG_LATENCY(time) gamepadLatencyAdd(diagnostics, gamepadClockUs() - (time))
+#else
+#define GAMEPAD_DIAG_COUNT(counter) ((void)0)
+#define GAMEPAD_DIAG_TIME_BEGIN(start) ((void)0)
+#define GAMEPAD_DIAG_TIME_END(timing, start) ((void)0)
+#define GAMEPAD_DIAG_LATENCY(time) ((void)0)
+#endif
+
+#endif /* __GAMEPAD_DIAGNOSTICS_H__ */
@@ -0,0 +1,544 @@
+#ifndef __GAMEPAD_HAL_H__
+#define __GAMEPAD_HAL_H__
+
+/**
+ * Platform seam of the service: the clocks, the timers, the report interrupt, the fibers, the message bus,
+ * the storage, the GPIO pins, the supply voltage, the analog inputs, the accelerometer, the display,
+ * the flash, the serial ports, the SoftDevice calls and BLE_API.
+ *
+ * The service and its helpers include this header only. On the micro:bit these are typedefs and
+ * inline functions over the DAL, mbed, the SoftDevice and BLE_API, so they compile to the same calls
+ * as before. The host build in host/ defines GAMEPAD_HAL_HEADER to a header providing the same names
+ * over a simulated clock and a mock BLE stack.
+ */
+#ifdef GAMEPAD_HAL_HEADER
+#include GAMEPAD_HAL_HEADER
+#else
+#include "MicroBit.h"
+#include "ble/BLE.h"
+#include "ble/GapAdvertisingData.h"
+#include "ble/GattService.h"
+#include "ble/GattCharacteristic.h"
+#include "ble.h"
+
+/**
+ * Address of a host, as the SoftDevice stores it: `addr_type`, `addr`
+ */
+typedef ble_gap_addr_t GamepadPeerAddress;
+
+/**
+ * Event of the message bus, delivered to listeners in a fiber
+ */
+typedef MicroBitEvent GamepadEvent;
+
+/**
+ * Hosts the bond table keeps
+ */
+#define GAMEPAD_MAXIMUM_BONDS MICROBIT_BLE_MAXIMUM_BONDS
+
+/**
+ * Bytes of the attribute table the SoftDevice is given, when the build sets it
+ */
+#ifdef MICROBIT_SD_GATT_TABLE_SIZE
+#define GAMEPAD_GATT_TABLE_SIZE MICROBIT_SD_GATT_TABLE_SIZE
+#endif
+
+/**
+ * Flash pages of the DAL's MicroBitStorage and its scratch page, and pages of the SoftDevice's bond storage
+ * with its swap page, counted from the end of flash as gamepadFlashPage() does, when the build sets them
+ */
+#ifdef MICROBIT_STORAGE_STORE_PAGE_OFFSET
+#define GAMEPAD_DAL_STORAGE_PAGE MICROBIT_STORAGE_STORE_PAGE_OFFSET
+#endif
+#ifdef MICROBIT_STORAGE_SCRATCH_PAGE_OFFSET
+#define GAMEPAD_DAL_SCRATCH_PAGE MICROBIT_STORAGE_SCRATCH_PAGE_OFFSET
+#endif
+#ifdef PSTORAGE_NUM_OF_PAGES
+#define GAMEPAD_BOND_PAGES (PSTORAGE_NUM_OF_PAGES + 1)
+#endif
+
+/**
+ * 1 if the DAL adds its own Device Information service
+ */
+#define GAMEPAD_DAL_DEVICE_INFORMATION CONFIG_ENABLED(MICROBIT_BLE_DEVICE_INFORMATION_SERVICE)
+
+/**
+ * Period of the scheduler tick(milliseconds): fibers sleep in whole ticks
+ */
+#define GAMEPAD_SLEEP_TICK_MS SYSTEM_TICK_PERIOD_MS
+
+/**
+ * Software interrupt the reports are sent from. SWI3_IRQHandler is defined by BluetoothGamepadService.cpp.
+ * It defers the writes out of the handler that requested them, but it is still an interrupt:
+ * see gamepadReportIrqEnable() for what it runs behind.
+ */
+#define GAMEPAD_REPORT_IRQn SWI3_IRQn
+
+/**
+ * ADC interrupt the analog axes are sampled from. ADC_IRQHandler is defined by BluetoothGamepadService.cpp.
+ */
+#define GAMEPAD_ADC_IRQn ADC_IRQn
+
+/**
+ * One-shot timer, calling back in interrupt context: `attach_us(object, method, delay)`, `detach()`
+ */
+typedef Timeout GamepadTimeout;
+
+/**
+ * Periodic timer, calling back in interrupt context: `attach_us(object, method, period)`, `detach()`
+ */
+typedef Ticker GamepadTicker;
+
+/**
+ * Free running clock(microseconds), wrapping around
+ */
+inline uint32_t gamepadClockUs()
+{
+    return us_ticker_read();
+}
+
+/**
+ * System clock(milliseconds)
+ */
+inline uint32_t gamepadClockMs()
+{
+    return system_timer_current_time();
+}
+
+/**
+ * Enable the interrupt sending reports, at a priority the SoftDevice allows to call it from.
+ *
+ * APP_IRQ_PRIORITY_LOW is shared with the BLE event dispatch(SWI2) and the RTC of the timers(RTC1),
+ * so the writes never preempt them and wait for a running one to return; pending interrupts of the
+ * same priority run in IRQ number order, so pending BLE events and timers go first.
+ * The radio notification(SWI1) only pends this interrupt. Whether nRF5xGap gives it a higher priority
+ * or the same one, it returns before the writes start, as SWI1 comes before SWI3.
+ */
+inline void gamepadReportIrqEnable()
+{
+    sd_nvic_SetPriority(GAMEPAD_REPORT_IRQn, APP_IRQ_PRIORITY_LOW);
+    sd_nvic_EnableIRQ(GAMEPAD_REPORT_IRQn);
+}
+
+/**
+ * Request the interrupt sending reports. A simulated stack runs it when it chooses,
+ * e.g. right away, or at the next simulated connection event.
+ */
+inline void gamepadReportIrqPend()
+{
+    NVIC_SetPendingIRQ(GAMEPAD_REPORT_IRQn);
+}
+
+/**
+ * Get the number of notifications the SoftDevice can queue per connection
+ * @return false if unknown
+ */
+inline bool gamepadTxBufferCount(uint8_t &count)
+{
+    return sd_ble_tx_buffer_count_get(&count) == NRF_SUCCESS;
+}
+
+/**
+ * Read all GPIO pins at once
+ */
+inline uint32_t gamepadReadPins()
+{
+    return NRF_GPIO->IN;
+}
+
+/**
+ * Configure a GPIO pin as a digital input, without the DAL
+ * @param pullUp true to pull it up, false to pull it down
+ */
+inline void gamepadPinInput(uint8_t pin, bool pullUp)
+{
+    NRF_GPIO->PIN_CNF[pin] = (GPIO_PIN_CNF_DIR_Input << GPIO_PIN_CNF_DIR_Pos) |
+                             (GPIO_PIN_CNF_INPUT_Connect << GPIO_PIN_CNF_INPUT_Pos) |
+                             ((pullUp ? GPIO_PIN_CNF_PULL_Pullup : GPIO_PIN_CNF_PULL_Pulldown) << GPIO_PIN_CNF_PULL_Pos);
+}
+
+/**
+ * Configure a GPIO pin for the ADC: its digital input is disconnected
+ */
+inline void gamepadPinAnalog(uint8_t pin)
+{
+    NRF_GPIO->PIN_CNF[pin] = (GPIO_PIN_CNF_DIR_Input << GPIO_PIN_CNF_DIR_Pos) |
+                             (GPIO_PIN_CNF_INPUT_Disconnect << GPIO_PIN_CNF_INPUT_Pos) |
+                             (GPIO_PIN_CNF_PULL_Disabled << GPIO_PIN_CNF_PULL_Pos);
+}
+
+/**
+ * Set a GPIO output pin, safe from interrupts
+ */
+inline void gamepadWritePin(uint8_t pin, bool high)
+{
+    if (high)
+    {
+        NRF_GPIO->OUTSET = 1UL << pin;
+    }
+    else
+    {
+        NRF_GPIO->OUTCLR = 1UL << pin;
+    }
+}
+
+/**
+ * Measure the supply voltage with the ADC, restoring its configuration for the analog pins
+ * @return the voltage(millivolts)
+ */
+inline uint32_t gamepadSupplyVoltage()
+{
+    uint32_t config = NRF_ADC->CONFIG;
+    uint32_t enable = NRF_ADC->ENABLE;
+
+    // VDD / 3 against the 1.2 V band gap, 10 bits
+    NRF_ADC->CONFIG = (ADC_CONFIG_RES_10bit << ADC_CONFIG_RES_Pos) |
+                      (ADC_CONFIG_INPSEL_SupplyOneThirdPrescaling << ADC_CONFIG_INPSEL_Pos) |
+                      (ADC_CONFIG_REFSEL_VBG << ADC_CONFIG_REFSEL_Pos) |
+                      (ADC_CONFIG_PSEL_Disabled << ADC_CONFIG_PSEL_Pos) |
+                      (ADC_CONFIG_EXTREFSEL_None << ADC_CONFIG_EXTREFSEL_Pos);
+    NRF_ADC->ENABLE = ADC_ENABLE_ENABLE_Enabled;
+    NRF_ADC->EVENTS_END = 0;
+    NRF_ADC->TASKS_START = 1;
+    while (!NRF_ADC->EVENTS_END)
+    {
+    }
+    NRF_ADC->EVENTS_END = 0;
+    uint32_t result = NRF_ADC->RESULT;
+
+    NRF_ADC->ENABLE = enable;
+    NRF_ADC->CONFIG = config;
+    return result * 3600 / 1023;
+}
+
+/**
+ * Get a flash page, mapped in memory
+ * @param fromEnd pages from the end of flash
+ */
+inline uint32_t *gamepadFlashPage(uint16_t fromEnd)
+{
+    return reinterpret_cast<uint32_t *>(NRF_FICR->CODEPAGESIZE * (NRF_FICR->CODESIZE - fromEnd));
+}
+
+/**
+ * Get the ADC input of a GPIO pin
+ * @return the input(0..7), or 0xff if the pin is not analog
+ */
+inline uint8_t gamepadAnalogInput(uint8_t pin)
+{
+    // AIN0..1 are P0.26..27, AIN2..7 are P0.01..06
+    if (pin >= 1 && pin <= 6)
+    {
+        return pin + 1;
+    }
+    if (pin == 26 || pin == 27)
+    {
+        return pin - 26;
+    }
+    return 0xff;
+}
+
+/**
+ * Enable the interrupt of the analog conversions, at the priority of the report interrupt
+ */
+inline void gamepadAdcIrqEnable()
+{
+    sd_nvic_SetPriority(GAMEPAD_ADC_IRQn, APP_IRQ_PRIORITY_LOW);
+    sd_nvic_EnableIRQ(GAMEPAD_ADC_IRQn);
+}
+
+/**
+ * ADC configuration of its other users, saved over a burst of conversions
+ */
+struct GamepadAdcConfig
+{
+    uint32_t config;
+    uint32_t enable;
+};
+
+/**
+ * Save the ADC configuration before a burst of conversions.
+ * From there until gamepadAdcStop() the burst owns the ADC and its END interrupt: an analog read of the DAL
+ * in between would take a conversion of the burst, or have its own taken by the ADC interrupt.
+ */
+inline void gamepadAdcSave(GamepadAdcConfig &saved)
+{
+    saved.config = NRF_ADC->CONFIG;
+    saved.enable = NRF_ADC->ENABLE;
+}
+
+/**
+ * Start converting an analog input against the supply, 10 bits, interrupting when done
+ * @param input ADC input(0..7)
+ */
+inline void gamepadAdcStart(uint8_t input)
+{
+    // input / 3 against VDD / 3: a potentiometer across the supply reads the same at any battery level
+    NRF_ADC->CONFIG = (ADC_CONFIG_RES_10bit << ADC_CONFIG_RES_Pos) |
+                      (ADC_CONFIG_INPSEL_AnalogInputOneThirdPrescaling << ADC_CONFIG_INPSEL_Pos) |
+                      (ADC_CONFIG_REFSEL_SupplyOneThirdPrescaling << ADC_CONFIG_REFSEL_Pos) |
+                      ((1UL << input) << ADC_CONFIG_PSEL_Pos) |
+                      (ADC_CONFIG_EXTREFSEL_None << ADC_CONFIG_EXTREFSEL_Pos);
+    NRF_ADC->ENABLE = ADC_ENABLE_ENABLE_Enabled;
+    NRF_ADC->EVENTS_END = 0;
+    NRF_ADC->INTENSET = ADC_INTENSET_END_Msk;
+    NRF_ADC->TASKS_START = 1;
+}
+
+/**
+ * Read the conversion that just ended, from the ADC interrupt
+ * @return the value(0..1023)
+ */
+inline uint16_t gamepadAdcResult()
+{
+    NRF_ADC->EVENTS_END = 0;
+    return NRF_ADC->RESULT;
+}
+
+/**
+ * Stop interrupting and release the ADC, restoring its configuration for the battery measurement
+ * and the analog pins of the DAL
+ */
+inline void gamepadAdcStop(const GamepadAdcConfig &saved)
+{
+    NRF_ADC->INTENCLR = ADC_INTENCLR_END_Msk;
+    NRF_ADC->EVENTS_END = 0;
+    NRF_ADC->ENABLE = saved.enable;
+    NRF_ADC->CONFIG = saved.config;
+}
+
+/**
+ * Take over the serial port as the link from the satellite boards: `method` is called
+ * from the UART interrupt when bytes arrive. The DAL's own receive buffer is bypassed.
+ * RX is pulled up, for the open-drain TX of the satellites sharing it.
+ * A host build can back the link with a pseudo-terminal instead.
+ */
+template <typename T>
+inline void gamepadLinkStart(T *object, void (T::*method)(), PinName tx, PinName rx, uint32_t baud)
+{
+    uBit.serial.redirect(tx, rx);
+    uBit.serial.baud(baud);
+    NRF_GPIO->PIN_CNF[rx] = (NRF_GPIO->PIN_CNF[rx] & ~GPIO_PIN_CNF_PULL_Msk) | (GPIO_PIN_CNF_PULL_Pullup << GPIO_PIN_CNF_PULL_Pos);
+    uBit.serial.attach(object, method, SerialBase::RxIrq);
+}
+
+/**
+ * Take over the serial port as the link of a satellite board to the hub, as gamepadLinkStart() does.
+ * TX only pulls the line low(standard 0, disconnected 1), so that the satellites can share the hub's RX.
+ */
+template <typename T>
+inline void gamepadSatelliteLinkStart(T *object, void (T::*method)(), PinName tx, PinName rx, uint32_t baud)
+{
+    uBit.serial.redirect(tx, rx);
+    uBit.serial.baud(baud);
+    NRF_GPIO->PIN_CNF[tx] = (NRF_GPIO->PIN_CNF[tx] & ~GPIO_PIN_CNF_DRIVE_Msk) | (GPIO_PIN_CNF_DRIVE_S0D1 << GPIO_PIN_CNF_DRIVE_Pos);
+    uBit.serial.attach(object, method, SerialBase::RxIrq);
+}
+
+/**
+ * Read a received byte of the link, from its interrupt
+ * @return false if none is left
+ */
+inline bool gamepadLinkRead(uint8_t &byte)
+{
+    if (!uBit.serial.readable())
+    {
+        return false;
+    }
+    byte = uBit.serial.getc();
+    return true;
+}
+
+/**
+ * Enable or disable the TX interrupt of the link
+ */
+inline void gamepadLinkTxEnable(bool enable)
+{
+    if (enable)
+    {
+        NRF_UART0->INTENSET = UART_INTENSET_TXDRDY_Msk;
+    }
+    else
+    {
+        NRF_UART0->INTENCLR = UART_INTENCLR_TXDRDY_Msk;
+    }
+}
+
+/**
+ * Call `method` from the UART interrupt each time a byte went out on the link, while the TX interrupt is enabled.
+ * The DAL's TX buffer is bypassed, as its receive buffer is.
+ */
+template <typename T>
+inline void gamepadLinkTxAttach(T *object, void (T::*method)())
+{
+    uBit.serial.attach(object, method, SerialBase::TxIrq);
+    gamepadLinkTxEnable(false);
+}
+
+/**
+ * Write a byte on the link, once the last one went out: it does not wait then
+ */
+inline void gamepadLinkPut(uint8_t byte)
+{
+    uBit.serial.putc(byte);
+}
+
+/**
+ * Update an attribute value, and notify it unless `localOnly`
+ */
+inline ble_error_t gamepadGattWrite(BLEDevice &ble, GattAttribute::Handle_t handle, const uint8_t *data, uint16_t length, bool localOnly = false)
+{
+    return ble.gattServer().write(handle, data, length, localOnly);
+}
+
+/**
+ * Start high duty directed advertising to a host, which the BLE API can not address
+ * @return false if the SoftDevice refused it
+ */
+inline bool gamepadAdvertiseDirected(GamepadPeerAddress &peer)
+{
+    ble_gap_adv_params_t params;
+    memset(&params, 0, sizeof(params));
+    params.type = BLE_GAP_ADV_TYPE_ADV_DIRECT_IND;
+    params.p_peer_addr = &peer;
+    params.fp = BLE_GAP_ADV_FP_ANY;
+    return sd_ble_gap_adv_start(&params) == NRF_SUCCESS;
+}
+
+/**
+ * Indicate Service Changed for the whole attribute table
+ * @return false unless the host subscribed to it, i.e. caches the attribute table
+ */
+inline bool gamepadServiceChanged(Gap::Handle_t connection)
+{
+    return sd_ble_gatts_service_changed(connection, 0x0001, 0xFFFF) == NRF_SUCCESS;
+}
+
+/**
+ * Raise an event on the message bus. Its listeners run later, in a fiber.
+ */
+inline void gamepadRaiseEvent(uint16_t id, uint16_t value)
+{
+    MicroBitEvent(id, value);
+}
+
+/**
+ * Call `method` in a fiber for every event `id` with `value`
+ */
+template <typename T>
+inline void gamepadListen(uint16_t id, uint16_t value, T *object, void (T::*method)(GamepadEvent))
+{
+    uBit.messageBus.listen(id, value, object, method);
+}
+
+/**
+ * Run `entry(param)` in a new fiber
+ */
+inline void gamepadStartFiber(void (*entry)(void *), void *param)
+{
+    create_fiber(entry, param);
+}
+
+/**
+ * Sleep the calling fiber, for whole scheduler ticks
+ */
+inline void gamepadSleep(uint32_t ms)
+{
+    fiber_sleep(ms);
+}
+
+/**
+ * Let the other fibers run, from a fiber waiting for less than a tick
+ */
+inline void gamepadYield()
+{
+    schedule();
+}
+
+/**
+ * Read a value from the key value storage
+ * @return false if the key is not stored
+ */
+inline bool gamepadStorageGet(const char *key, void *value, uint8_t size)
+{
+    MicroBitStorage::KeyValuePair *stored = uBit.storage.get(key);
+    if (stored == NULL)
+    {
+        return false;
+    }
+    memcpy(value, stored->value, size);
+    delete stored;
+    return true;
+}
+
+/**
+ * Write a value to the key value storage, from a fiber
+ */
+inline void gamepadStoragePut(const char *key, const void *value, uint8_t size)
+{
+    uBit.storage.put(key, reinterpret_cast<uint8_t *>(const_cast<void *>(value)), size);
+}
+
+/**
+ * Erase a flash page, from a fiber
+ */
+inline void gamepadFlashErase(uint32_t *page)
+{
+    MicroBitFlash flash;
+    flash.erase_page(page);
+}
+
+/**
+ * Write erased flash, from a fiber
+ * @return false if it failed
+ */
+inline bool gamepadFlashWrite(uint32_t *address, const void *data, uint32_t length)
+{
+    MicroBitFlash flash;
+    return flash.flash_write(address, const_cast<void *>(data), length) == MICROBIT_OK;
+}
+
+/**
+ * Light or clear a LED of the display
+ */
+inline void gamepadDisplayPixel(int16_t x, int16_t y, bool on)
+{
+    uBit.display.image.setPixelValue(x, y, on ? 255 : 0);
+}
+
+/**
+ * Set the sampling period of the accelerometer(milliseconds)
+ */
+inline void gamepadAccelerometerPeriod(uint16_t period)
+{
+    uBit.accelerometer.setPeriod(period);
+}
+
+/**
+ * Read the accelerometer(milli-g), from a fiber
+ */
+inline void gamepadAccelerometerRead(int16_t *sample)
+{
+    sample[0] = (int16_t)uBit.accelerometer.getX();
+    sample[1] = (int16_t)uBit.accelerometer.getY();
+    sample[2] = (int16_t)uBit.accelerometer.getZ();
+}
+
+/**
+ * Send bytes on the serial port of the DAL, sleeping the fiber until they are sent
+ */
+inline void gamepadSerialSend(const uint8_t *data, uint16_t length)
+{
+    uBit.serial.send(const_cast<uint8_t *>(data), length, SYNC_SLEEP);
+}
+
+/**
+ * Read a byte from the serial port of the DAL, sleeping the fiber until one arrives
+ */
+inline uint8_t gamepadSerialRead()
+{
+    return (uint8_t)uBit.serial.read(SYNC_SLEEP);
+}
+#endif
+
+#endif /* __GAMEPAD_HAL_H__ */
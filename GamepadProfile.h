@@ -0,0 +1,92 @@
+#ifndef __GAMEPAD_PROFILE_H__
+#define __GAMEPAD_PROFILE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "GamepadHal.h"
+
+#define GAMEPAD_PROFILE_MAGIC 0x46525047UL // "GPRF" in flash
+#define GAMEPAD_PROFILE_VERSION 1
+
+/**
+ * Bytes of one write to the profile characteristic: the offset in the profile, then up to 19 bytes
+ */
+#define GAMEPAD_PROFILE_CHUNK_BYTES 20
+#define GAMEPAD_PROFILE_COMMIT 0xff
+
+#define GAMEPAD_PROFILE_NO_PIN 0xff
+
+/**
+ * Ranges of the profile fields: a profile with a field out of range is neither used nor stored
+ */
+#define GAMEPAD_PROFILE_PINS 32                                   // GPIO of the nRF51
+#define GAMEPAD_PROFILE_MIN_SCAN_PERIOD_US 250
+#define GAMEPAD_PROFILE_MAX_SCAN_PERIOD_US 100000
+#define GAMEPAD_PROFILE_MAX_IDLE_TIMEOUT_MS (0xffffffffUL / 1000) // the idle timer counts microseconds
+
+/**
+ * A controller profile, as stored in flash and read there in place(little endian).
+ * Every field is naturally aligned, so the service uses it without copying or parsing.
+ * Pins are GPIO numbers, e.g. 3 for P0, 2 for P1, 1 for P2.
+ */
+typedef struct
+{
+    uint32_t magic;                          // GAMEPAD_PROFILE_MAGIC
+    uint8_t version;                         // GAMEPAD_PROFILE_VERSION
+    uint8_t length;                          // sizeof(GamepadProfile)
+    uint16_t checksum;                       // CRC-16/CCITT-FALSE of the bytes after this field
+
+    uint8_t buttonPins[8];                   // pin of each GamepadButton bit, from UP, GAMEPAD_PROFILE_NO_PIN for none
+    uint8_t activeLowButtons;                // GamepadButton bits whose pin reads 0 while pressed
+    uint8_t debounceScans;
+    uint8_t reportMode;                      // GamepadReportMode
+    uint8_t analogOversampling;
+    uint32_t scanPeriod;                     // microseconds
+    uint32_t reportMinInterval;              // microseconds
+    uint32_t reportKeepAlive;                // microseconds, 0 to disable
+    uint32_t idleTimeout;                    // milliseconds, 0 to stay active
+    uint32_t analogPeriod;                   // microseconds
+
+    Gap::ConnectionParams_t activeConnection; // 1.25 milliseconds units, 10 milliseconds units for the timeout
+    Gap::ConnectionParams_t idleConnection;
+
+    uint8_t analogPins[6];                   // pin of each GamepadAnalogAxis, GAMEPAD_PROFILE_NO_PIN for none
+    uint8_t invertedAxes;                    // bit per GamepadAnalogAxis
+    uint8_t analogDeadzone;                  // out of 127
+    int16_t tiltDeadzone;                    // milli-g
+    uint8_t tiltSmoothing;
+    uint8_t reserved;
+} GamepadProfile;
+
+static_assert(sizeof(GamepadProfile) == 68, "GamepadProfile must keep its flash layout");
+static_assert(sizeof(GamepadProfile) < GAMEPAD_PROFILE_COMMIT, "GAMEPAD_PROFILE_COMMIT must not be an offset in the profile");
+
+/**
+ * CRC-16/CCITT-FALSE
+ */
+inline uint16_t gamepadProfileChecksum(const uint8_t *data, uint16_t length)
+{
+    uint16_t crc = 0xffff;
+    for (uint16_t i = 0; i < length; i++)
+    {
+        crc ^= (uint16_t)data[i] << 8;
+        for (uint8_t bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+/**
+ * @return true if the profile was written whole, for this layout
+ */
+inline bool gamepadProfileIsValid(const GamepadProfile *profile)
+{
+    const uint8_t *body = reinterpret_cast<const uint8_t *>(profile) + offsetof(GamepadProfile, buttonPins);
+    return profile->magic == GAMEPAD_PROFILE_MAGIC && profile->version == GAMEPAD_PROFILE_VERSION &&
+           profile->length == sizeof(GamepadProfile) &&
+           profile->checksum == gamepadProfileChecksum(body, sizeof(GamepadProfile) - offsetof(GamepadProfile, buttonPins));
+}
+
+#endif /* __GAMEPAD_PROFILE_H__ */
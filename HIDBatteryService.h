@@ -17,7 +17,7 @@
 #ifndef __BLE_BATTERY_SERVICE_H__
 #define __BLE_BATTERY_SERVICE_H__
 
-#include "ble/BLE.h"
+#include "GamepadHal.h"
 
 /**
 * @class BatteryService
@@ -49,12 +49,26 @@ public:
      * @brief Update the battery level with a new value. [Valid values lie between 0 and 100];
      * anything outside this range will be ignored.
      *
+     * The value is only updated locally: hosts read it, and the owner of the
+     * connection decides when to notify it, with getValueHandle().
+     *
      * @param newLevel
      *              Update to battery level.
      */
     void updateBatteryLevel(uint8_t newLevel) {
+        if (newLevel > 100) {
+            return;
+        }
         batteryLevel = newLevel;
-        ble.gattServer().write(batteryLevelCharacteristic.getValueHandle(), &batteryLevel, 1);
+        ble.gattServer().write(batteryLevelCharacteristic.getValueHandle(), &batteryLevel, 1, true);
+    }
+
+    uint8_t getBatteryLevel() const {
+        return batteryLevel;
+    }
+
+    GattAttribute::Handle_t getValueHandle() const {
+        return batteryLevelCharacteristic.getValueHandle();
     }
 
 protected:
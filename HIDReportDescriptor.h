@@ -0,0 +1,341 @@
+#ifndef __HID_REPORT_DESCRIPTOR_H__
+#define __HID_REPORT_DESCRIPTOR_H__
+
+#include <stdint.h>
+#include "USBHID_Types.h"
+
+/**
+ * Compile-time HID report descriptions.
+ *
+ * A report is described once as a list of fields. The report descriptor bytes,
+ * the encoder that packs values into the report and the decoder that reads them
+ * back are all generated from that description, so they can not drift apart.
+ *
+ * Example:
+ *   typedef HIDInput<0x01, -1, 1, 2, 0x30, 0x31> Axes;  // X, Y: 2 bits each, -1..1
+ *   typedef HIDReport<1, Axes> Report;                  // Report ID 1
+ *   Report::putElement<0, 1>(data, -1);                 // Y = -1
+ *   Report::getElement<0, 1>(data);                     // -1
+ */
+
+/**
+ * A list of descriptor bytes
+ */
+template <uint8_t... Bytes>
+struct HIDBytes
+{
+    static const uint16_t size = sizeof...(Bytes);
+    static const uint8_t data[sizeof...(Bytes)];
+};
+
+template <uint8_t... Bytes>
+const uint8_t HIDBytes<Bytes...>::data[sizeof...(Bytes)] = {Bytes...};
+
+/**
+ * Concatenation of HIDBytes lists
+ */
+template <typename... Lists>
+struct HIDConcat;
+
+template <uint8_t... A>
+struct HIDConcat<HIDBytes<A...>>
+{
+    typedef HIDBytes<A...> type;
+};
+
+template <uint8_t... A, uint8_t... B, typename... Rest>
+struct HIDConcat<HIDBytes<A...>, HIDBytes<B...>, Rest...>
+{
+    typedef typename HIDConcat<HIDBytes<A..., B...>, Rest...>::type type;
+};
+
+/**
+ * A short item with a signed value, using the smallest item size the value fits in
+ * @tparam Tag item tag, with size 0 (e.g. LOGICAL_MINIMUM(0))
+ */
+template <uint8_t Tag, int32_t Value,
+          uint8_t Size = (Value >= -128 && Value <= 127) ? 1 : (Value >= -32768 && Value <= 32767) ? 2 : 4>
+struct HIDSignedItem
+{
+    typedef HIDBytes<Tag | 1, (uint8_t)Value> type;
+};
+
+template <uint8_t Tag, int32_t Value>
+struct HIDSignedItem<Tag, Value, 2>
+{
+    typedef HIDBytes<Tag | 2, (uint8_t)Value, (uint8_t)(Value >> 8)> type;
+};
+
+template <uint8_t Tag, int32_t Value>
+struct HIDSignedItem<Tag, Value, 4>
+{
+    typedef HIDBytes<Tag | 3, (uint8_t)Value, (uint8_t)(Value >> 8), (uint8_t)(Value >> 16), (uint8_t)(Value >> 24)> type;
+};
+
+/**
+ * A variable field: `sizeof...(Usages)` values of `Size` bits each, ranging LogicalMin..LogicalMax
+ * @tparam Main main item, with its size(e.g. INPUT(1))
+ * @tparam UsagePage usage page of the usages
+ * @tparam LogicalMin minimum value, negative values are sent in two's complement
+ * @tparam LogicalMax maximum value
+ * @tparam Size bits per value
+ * @tparam Usages one usage per value
+ */
+template <uint8_t Main, uint8_t UsagePage, int32_t LogicalMin, int32_t LogicalMax, uint8_t Size, uint8_t... Usages>
+struct HIDVariable
+{
+    static_assert(Size >= 1 && Size <= 16, "HID field values must be 1 to 16 bits");
+    static_assert(sizeof...(Usages) >= 1, "HID field must have at least one usage");
+    static_assert(LogicalMin < LogicalMax, "HID field logical minimum must be less than its maximum");
+    static_assert(LogicalMin < 0 ? (LogicalMin >= -(1L << (Size - 1)) && LogicalMax < (1L << (Size - 1)))
+                                 : (LogicalMax < (1L << Size)),
+                  "HID field logical range does not fit its bit width");
+
+    static const int32_t minimum = LogicalMin;
+    static const int32_t maximum = LogicalMax;
+    static const uint8_t size = Size;
+    static const uint8_t count = sizeof...(Usages);
+    static const uint16_t bits = Size * sizeof...(Usages);
+
+    typedef typename HIDConcat<
+        HIDBytes<USAGE_PAGE(1), UsagePage>,
+        HIDBytes<USAGE(1), Usages>...,
+        typename HIDSignedItem<LOGICAL_MINIMUM(0), LogicalMin>::type,
+        typename HIDSignedItem<LOGICAL_MAXIMUM(0), LogicalMax>::type,
+        HIDBytes<REPORT_SIZE(1), Size,
+                 REPORT_COUNT(1), sizeof...(Usages),
+                 Main, 0x02>>::type descriptor; // Data, Variable, Absolute
+};
+
+/**
+ * An input field, sent by the device
+ */
+template <uint8_t UsagePage, int32_t LogicalMin, int32_t LogicalMax, uint8_t Size, uint8_t... Usages>
+using HIDInput = HIDVariable<INPUT(1), UsagePage, LogicalMin, LogicalMax, Size, Usages...>;
+
+/**
+ * An output field, written by the host
+ */
+template <uint8_t UsagePage, int32_t LogicalMin, int32_t LogicalMax, uint8_t Size, uint8_t... Usages>
+using HIDOutput = HIDVariable<OUTPUT(1), UsagePage, LogicalMin, LogicalMax, Size, Usages...>;
+
+/**
+ * An array input field: `Count` slots of `Size` bits each, holding the usages in UsageMin..UsageMax
+ * that are currently active, 0 in unused slots (e.g. keyboard keys)
+ * @tparam UsagePage usage page of the usages
+ * @tparam UsageMin first usage, also the logical minimum
+ * @tparam UsageMax last usage, also the logical maximum
+ * @tparam Size bits per slot
+ * @tparam Count number of slots
+ */
+template <uint8_t UsagePage, int32_t UsageMin, int32_t UsageMax, uint8_t Size, uint8_t Count>
+struct HIDArray
+{
+    static_assert(Size >= 1 && Size <= 16, "HID array slots must be 1 to 16 bits");
+    static_assert(Count >= 1, "HID array must have at least one slot");
+    static_assert(UsageMin >= 0 && UsageMin < UsageMax, "HID array usage range is invalid");
+    static_assert(UsageMax < (1L << Size), "HID array usage range does not fit its bit width");
+
+    static const int32_t minimum = UsageMin;
+    static const int32_t maximum = UsageMax;
+    static const uint8_t size = Size;
+    static const uint8_t count = Count;
+    static const uint16_t bits = Size * Count;
+
+    typedef typename HIDConcat<
+        HIDBytes<USAGE_PAGE(1), UsagePage>,
+        typename HIDSignedItem<USAGE_MINIMUM(0), UsageMin>::type,
+        typename HIDSignedItem<USAGE_MAXIMUM(0), UsageMax>::type,
+        typename HIDSignedItem<LOGICAL_MINIMUM(0), UsageMin>::type,
+        typename HIDSignedItem<LOGICAL_MAXIMUM(0), UsageMax>::type,
+        HIDBytes<REPORT_SIZE(1), Size,
+                 REPORT_COUNT(1), Count,
+                 INPUT(1), 0x00>>::type descriptor; // Data, Array, Absolute
+};
+
+/**
+ * Constant padding bits
+ * @tparam Main main item of the report it pads(e.g. OUTPUT(1))
+ */
+template <uint8_t Bits, uint8_t Main = INPUT(1)>
+struct HIDPadding
+{
+    static const uint8_t size = Bits;
+    static const uint8_t count = 1;
+    static const uint16_t bits = Bits;
+
+    typedef HIDBytes<REPORT_SIZE(1), Bits,
+                     REPORT_COUNT(1), 1,
+                     Main, 0x01> descriptor; // Constant
+};
+
+/**
+ * Total bits of fields
+ */
+template <typename... Fields>
+struct HIDBitCount;
+
+template <>
+struct HIDBitCount<>
+{
+    static const uint16_t value = 0;
+};
+
+template <typename First, typename... Rest>
+struct HIDBitCount<First, Rest...>
+{
+    static const uint16_t value = First::bits + HIDBitCount<Rest...>::value;
+};
+
+/**
+ * Field at `Index`, and its bit offset from the start of the report
+ */
+template <uint8_t Index, typename... Fields>
+struct HIDFieldAt;
+
+template <typename First, typename... Rest>
+struct HIDFieldAt<0, First, Rest...>
+{
+    typedef First type;
+    static const uint16_t offset = 0;
+};
+
+template <uint8_t Index, typename First, typename... Rest>
+struct HIDFieldAt<Index, First, Rest...>
+{
+    typedef typename HIDFieldAt<Index - 1, Rest...>::type type;
+    static const uint16_t offset = First::bits + HIDFieldAt<Index - 1, Rest...>::offset;
+};
+
+/**
+ * Writes `Width` bits of a value at bit `Offset` of a report, least significant bit first.
+ * Offsets and masks are constants, so this compiles to a few loads, masks and stores.
+ */
+template <uint16_t Offset, uint8_t Width, bool LastByte = ((Offset % 8) + Width <= 8)>
+struct HIDBitWriter
+{
+    static void write(uint8_t *report, uint32_t value)
+    {
+        const uint8_t shift = Offset % 8;
+        report[Offset / 8] = (uint8_t)((report[Offset / 8] & ~(0xff << shift)) | (value << shift));
+        HIDBitWriter<Offset + 8 - shift, Width - (8 - shift)>::write(report, value >> (8 - shift));
+    }
+};
+
+template <uint16_t Offset, uint8_t Width>
+struct HIDBitWriter<Offset, Width, true>
+{
+    static void write(uint8_t *report, uint32_t value)
+    {
+        const uint8_t mask = (uint8_t)(((1u << Width) - 1) << (Offset % 8));
+        report[Offset / 8] = (uint8_t)((report[Offset / 8] & ~mask) | ((value << (Offset % 8)) & mask));
+    }
+};
+
+/**
+ * Reads `Width` bits at bit `Offset` of a report, least significant bit first
+ */
+template <uint16_t Offset, uint8_t Width, bool LastByte = ((Offset % 8) + Width <= 8)>
+struct HIDBitReader
+{
+    static uint32_t read(const uint8_t *report)
+    {
+        const uint8_t shift = Offset % 8;
+        return (uint32_t)(report[Offset / 8] >> shift) |
+               (HIDBitReader<Offset + 8 - shift, Width - (8 - shift)>::read(report) << (8 - shift));
+    }
+};
+
+template <uint16_t Offset, uint8_t Width>
+struct HIDBitReader<Offset, Width, true>
+{
+    static uint32_t read(const uint8_t *report)
+    {
+        return (uint32_t)(report[Offset / 8] >> (Offset % 8)) & ((1u << Width) - 1);
+    }
+};
+
+/**
+ * A report: a Report ID followed by fields
+ * @tparam ID Report ID
+ * @tparam Fields HIDInput, HIDOutput, HIDArray or HIDPadding fields, in report order
+ */
+template <uint8_t ID, typename... Fields>
+struct HIDReport
+{
+    static const uint8_t id = ID;
+    static const uint16_t bits = HIDBitCount<Fields...>::value;
+    static const uint8_t size = bits / 8;
+
+    static_assert(ID != 0, "HID Report ID 0 is reserved");
+    static_assert(bits % 8 == 0, "HID report must be a whole number of bytes");
+    static_assert(bits / 8 <= 20, "HID report must fit one notification (ATT MTU 23)");
+
+    typedef typename HIDConcat<HIDBytes<REPORT_ID(1), ID>, typename Fields::descriptor...>::type descriptor;
+
+    /**
+     * Write all values of a field at once, the first value in the least significant bits
+     */
+    template <uint8_t Index>
+    static void put(uint8_t *report, int32_t value)
+    {
+        HIDBitWriter<HIDFieldAt<Index, Fields...>::offset,
+                     HIDFieldAt<Index, Fields...>::type::bits>::write(report, (uint32_t)value);
+    }
+
+    /**
+     * Write one value of a field
+     */
+    template <uint8_t Index, uint8_t Element>
+    static void putElement(uint8_t *report, int32_t value)
+    {
+        static_assert(Element < HIDFieldAt<Index, Fields...>::type::count, "HID field has no such element");
+        HIDBitWriter<HIDFieldAt<Index, Fields...>::offset + Element * HIDFieldAt<Index, Fields...>::type::size,
+                     HIDFieldAt<Index, Fields...>::type::size>::write(report, (uint32_t)value);
+    }
+
+    /**
+     * Read all values of a field at once, the first value in the least significant bits
+     */
+    template <uint8_t Index>
+    static uint32_t get(const uint8_t *report)
+    {
+        static_assert(HIDFieldAt<Index, Fields...>::type::bits <= 32, "HID field does not fit 32 bits");
+        return HIDBitReader<HIDFieldAt<Index, Fields...>::offset,
+                            HIDFieldAt<Index, Fields...>::type::bits>::read(report);
+    }
+
+    /**
+     * Read one value of a field, sign extended if the field has negative values
+     */
+    template <uint8_t Index, uint8_t Element>
+    static int32_t getElement(const uint8_t *report)
+    {
+        typedef typename HIDFieldAt<Index, Fields...>::type Field;
+        static_assert(Element < Field::count, "HID field has no such element");
+        uint32_t value = HIDBitReader<HIDFieldAt<Index, Fields...>::offset + Element * Field::size, Field::size>::read(report);
+        if (Field::minimum < 0 && (value & (1UL << (Field::size - 1))))
+        {
+            return (int32_t)value - (int32_t)(1L << Field::size);
+        }
+        return (int32_t)value;
+    }
+};
+
+/**
+ * An application collection holding reports in a physical collection
+ */
+template <uint8_t UsagePage, uint8_t Usage, typename... Reports>
+struct HIDApplication
+{
+    typedef typename HIDConcat<
+        HIDBytes<USAGE_PAGE(1), UsagePage,
+                 USAGE(1), Usage,
+                 COLLECTION(1), 0x01,  // Collection: Application
+                 COLLECTION(1), 0x00>, // Collection: Physical
+        typename Reports::descriptor...,
+        HIDBytes<END_COLLECTION(0),
+                 END_COLLECTION(0)>>::type descriptor;
+};
+
+#endif /* __HID_REPORT_DESCRIPTOR_H__ */
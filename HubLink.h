@@ -0,0 +1,414 @@
+#ifndef __HUB_LINK_H__
+#define __HUB_LINK_H__
+
+#include <stdint.h>
+#include "GamepadHal.h"
+
+/**
+ * First byte of a hub frame
+ */
+#define HUB_LINK_SYNC 0xa5
+
+/**
+ * Byte the hub polls a player with: HUB_LINK_POLL | player, for players 0..HUB_LINK_MAX_PLAYERS - 1
+ */
+#define HUB_LINK_POLL 0xc0
+#define HUB_LINK_MAX_PLAYERS 4
+
+/**
+ * CRC-8(polynomial 0x07) of one more byte
+ */
+inline uint8_t hubLinkCrc(uint8_t crc, uint8_t byte)
+{
+    crc ^= byte;
+    for (uint8_t bit = 0; bit < 8; bit++)
+    {
+        crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+    return crc;
+}
+
+inline uint8_t hubLinkPoll(uint8_t player)
+{
+    return HUB_LINK_POLL | player;
+}
+
+/**
+ * Encode a frame of the serial link, on a satellite board
+ * @tparam PAYLOAD bytes of a player report
+ * @param frame PAYLOAD + 4 bytes
+ */
+template <uint8_t PAYLOAD>
+inline void hubLinkEncode(uint8_t player, uint8_t sequence, const uint8_t *report, uint8_t *frame)
+{
+    frame[0] = HUB_LINK_SYNC;
+    frame[1] = player;
+    frame[2] = sequence;
+    uint8_t crc = hubLinkCrc(hubLinkCrc(0, player), sequence);
+    for (uint8_t i = 0; i < PAYLOAD; i++)
+    {
+        frame[3 + i] = report[i];
+        crc = hubLinkCrc(crc, report[i]);
+    }
+    frame[3 + PAYLOAD] = crc;
+}
+
+/**
+ * Frames of the serial link from satellite boards to the hub.
+ *
+ * The satellites share the hub's RX line, so the hub polls them in turn and only the polled one answers:
+ * the hub sends hubLinkPoll(player) to all of them, and that player answers with one frame.
+ * A frame is SYNC, the player(0..PLAYERS - 1), a sequence number incremented by the
+ * satellite for every frame, the player's report(PAYLOAD bytes), then the CRC-8 of
+ * the player, the sequence and the report. A frame of another player than the one polled is an error.
+ *
+ * The receiver writes the report bytes straight into the back buffer of the player
+ * as they arrive, and swaps buffers once the CRC matches: the report interrupt sends
+ * the front buffer as it is, and a corrupted frame never reaches it.
+ * receive() runs in the UART interrupt; report() is read from the report interrupt.
+ * @tparam PLAYERS number of satellite players
+ * @tparam PAYLOAD bytes of a player report
+ */
+template <uint8_t PLAYERS, uint8_t PAYLOAD>
+class HubLink
+{
+    static_assert(PLAYERS > 0 && PLAYERS <= HUB_LINK_MAX_PLAYERS, "HubLink carries 1 to HUB_LINK_MAX_PLAYERS players");
+
+  public:
+    static const uint8_t NONE = 0xff;
+
+    HubLink() : polled(PLAYERS - 1), state(STATE_SYNC), player(0), sequence(0), index(0), crc(0), startTime(0),
+                frames(0), errors(0), lost(0)
+    {
+        for (uint8_t i = 0; i < PLAYERS; i++)
+        {
+            front[i] = 0;
+            lastSequence[i] = 0;
+            isSynchronized[i] = false;
+            frameTimes[i] = 0;
+            for (uint8_t j = 0; j < PAYLOAD; j++)
+            {
+                buffers[i][0][j] = 0;
+                buffers[i][1][j] = 0;
+            }
+        }
+    }
+
+    /**
+     * Move on to the next player, from the poll timer
+     * @return the byte to poll it with
+     */
+    uint8_t poll()
+    {
+        polled = polled + 1 < PLAYERS ? polled + 1 : 0;
+        return hubLinkPoll(polled);
+    }
+
+    /**
+     * Take one received byte
+     * @param time when it was received(microseconds)
+     * @return the player whose frame this byte completed with a new report, NONE otherwise
+     */
+    uint8_t receive(uint8_t byte, uint32_t time)
+    {
+        switch (state)
+        {
+        case STATE_SYNC:
+            if (byte == HUB_LINK_SYNC)
+            {
+                startTime = time;
+                state = STATE_PLAYER;
+            }
+            return NONE;
+
+        case STATE_PLAYER:
+            if (byte != polled)
+            {
+                errors++;
+                state = STATE_SYNC;
+                return NONE;
+            }
+            player = byte;
+            crc = hubLinkCrc(0, byte);
+            state = STATE_SEQUENCE;
+            return NONE;
+
+        case STATE_SEQUENCE:
+            sequence = byte;
+            crc = hubLinkCrc(crc, byte);
+            index = 0;
+            state = PAYLOAD > 0 ? STATE_PAYLOAD : STATE_CRC;
+            return NONE;
+
+        case STATE_PAYLOAD:
+            buffers[player][front[player] ^ 1][index++] = byte;
+            crc = hubLinkCrc(crc, byte);
+            if (index == PAYLOAD)
+            {
+                state = STATE_CRC;
+            }
+            return NONE;
+
+        default:
+            state = STATE_SYNC;
+            if (byte != crc)
+            {
+                errors++;
+                return NONE;
+            }
+            // frames lost on the way show up as a jump of the sequence
+            if (isSynchronized[player])
+            {
+                lost += (uint8_t)(sequence - lastSequence[player] - 1);
+            }
+            isSynchronized[player] = true;
+            lastSequence[player] = sequence;
+            frames++;
+            // every poll is answered: only a change is news
+            if (isSameReport(buffers[player][0], buffers[player][1]))
+            {
+                return NONE;
+            }
+            frameTimes[player] = startTime;
+            front[player] ^= 1;
+            return player;
+        }
+    }
+
+    /**
+     * The last valid report of a player
+     */
+    const uint8_t *report(uint8_t player) const
+    {
+        return buffers[player][front[player]];
+    }
+
+    /**
+     * When the first byte of the last valid frame of a player was received(microseconds)
+     */
+    uint32_t frameTime(uint8_t player) const
+    {
+        return frameTimes[player];
+    }
+
+    uint32_t getFrames() const
+    {
+        return frames;
+    }
+
+    /**
+     * Frames dropped for a bad player or CRC
+     */
+    uint32_t getErrors() const
+    {
+        return errors;
+    }
+
+    /**
+     * Frames missing from the sequence numbers
+     */
+    uint32_t getLost() const
+    {
+        return lost;
+    }
+
+  private:
+    static bool isSameReport(const uint8_t *a, const uint8_t *b)
+    {
+        for (uint8_t i = 0; i < PAYLOAD; i++)
+        {
+            if (a[i] != b[i])
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    enum State
+    {
+        STATE_SYNC,
+        STATE_PLAYER,
+        STATE_SEQUENCE,
+        STATE_PAYLOAD,
+        STATE_CRC,
+    };
+
+    uint8_t buffers[PLAYERS][2][PAYLOAD];
+    volatile uint8_t front[PLAYERS];
+    volatile uint8_t polled;
+    uint8_t lastSequence[PLAYERS];
+    bool isSynchronized[PLAYERS];
+    volatile uint32_t frameTimes[PLAYERS];
+
+    State state;
+    uint8_t player;
+    uint8_t sequence;
+    uint8_t index;
+    uint8_t crc;
+    uint32_t startTime;
+
+    volatile uint32_t frames;
+    volatile uint32_t errors;
+    volatile uint32_t lost;
+};
+
+/**
+ * Bytes queued for the serial link, sent from the UART interrupt one at a time as the previous one goes out,
+ * so that the interrupt queuing them never waits for the line(87 microseconds a byte at 115200 baud).
+ * @tparam CAPACITY bytes
+ */
+template <uint8_t CAPACITY>
+class HubLinkTx
+{
+  public:
+    HubLinkTx() : first(0), count(0), isSending(false)
+    {
+    }
+
+    /**
+     * Take the TX interrupt of the link, once it is started
+     */
+    void start()
+    {
+        gamepadLinkTxAttach(this, &HubLinkTx::onSent);
+    }
+
+    /**
+     * Queue bytes and start sending them if the line is free, from an interrupt or a fiber
+     * @return false if they do not fit: none of them is queued
+     */
+    bool write(const uint8_t *data, uint8_t length)
+    {
+        __disable_irq();
+        bool fits = count + length <= CAPACITY;
+        if (fits)
+        {
+            for (uint8_t i = 0; i < length; i++)
+            {
+                bytes[(first + count + i) % CAPACITY] = data[i];
+            }
+            count += length;
+            if (!isSending)
+            {
+                // nothing is going out: the first byte goes right away, and its interrupt sends the next
+                isSending = true;
+                putNext();
+                gamepadLinkTxEnable(true);
+            }
+        }
+        __enable_irq();
+        return fits;
+    }
+
+  private:
+    void putNext()
+    {
+        uint8_t byte = bytes[first];
+        first = (first + 1) % CAPACITY;
+        count--;
+        gamepadLinkPut(byte);
+    }
+
+    /**
+     * Send the next byte, in the UART interrupt once the last one went out
+     */
+    void onSent()
+    {
+        __disable_irq();
+        if (count == 0)
+        {
+            isSending = false;
+            gamepadLinkTxEnable(false);
+        }
+        else
+        {
+            putNext();
+        }
+        __enable_irq();
+    }
+
+    uint8_t bytes[CAPACITY];
+    uint8_t first;
+    uint8_t count;
+    bool isSending;
+};
+
+/**
+ * A satellite board of the hub: it answers the polls of its player with a frame of its report,
+ * from the UART interrupt, and doesn't start the gamepad service.
+ * Its TX is open-drain, so that the satellites can share the hub's RX.
+ * @tparam PAYLOAD bytes of a player report
+ */
+template <uint8_t PAYLOAD>
+class HubSatellite
+{
+  public:
+    HubSatellite() : player(HUB_LINK_MAX_PLAYERS), sequence(0), polls(0)
+    {
+        for (uint8_t i = 0; i < PAYLOAD; i++)
+        {
+            report[i] = 0;
+        }
+    }
+
+    /**
+     * Take over the serial port and answer the polls of a player
+     * @param player 0..HUB_LINK_MAX_PLAYERS - 1
+     */
+    void start(uint8_t player, PinName tx, PinName rx, uint32_t baud)
+    {
+        this->player = player;
+        gamepadSatelliteLinkStart(this, &HubSatellite::onPolled, tx, rx, baud);
+        linkTx.start();
+    }
+
+    /**
+     * Set the report sent at the next poll, from a fiber
+     */
+    void setReport(const uint8_t *newReport)
+    {
+        // the UART interrupt encodes it
+        __disable_irq();
+        for (uint8_t i = 0; i < PAYLOAD; i++)
+        {
+            report[i] = newReport[i];
+        }
+        __enable_irq();
+    }
+
+    /**
+     * Polls answered since the start
+     */
+    uint32_t getPolls() const
+    {
+        return polls;
+    }
+
+  private:
+    void onPolled()
+    {
+        uint8_t byte;
+        while (gamepadLinkRead(byte))
+        {
+            if (byte == hubLinkPoll(player))
+            {
+                // a frame still going out leaves the poll unanswered: the gap in the sequence counts it lost
+                uint8_t frame[PAYLOAD + 4];
+                hubLinkEncode<PAYLOAD>(player, sequence++, report, frame);
+                if (linkTx.write(frame, sizeof(frame)))
+                {
+                    polls++;
+                }
+            }
+        }
+    }
+
+    uint8_t report[PAYLOAD];
+    HubLinkTx<PAYLOAD + 4> linkTx;
+    uint8_t player;
+    uint8_t sequence;
+    volatile uint32_t polls;
+};
+
+#endif /* __HUB_LINK_H__ */
@@ -0,0 +1,125 @@
+#ifndef __INPUT_SCANNER_H__
+#define __INPUT_SCANNER_H__
+
+#include <stdint.h>
+
+/**
+ * Maps GPIO pins to gamepad buttons and debounces them.
+ *
+ * All pins are sampled at once from the GPIO input register, and each one has an
+ * integrating debounce counter: it counts up while the pin reads pressed and down
+ * while it reads released, and the button only changes when the counter reaches
+ * either end. A bounce shorter than `samples` scans is never reported.
+ * Each button is expected to have one pin.
+ */
+class InputScanner
+{
+  public:
+    static const uint8_t PINS = 8;
+
+    InputScanner() : pinCount(0), activeLowPins(0), threshold(1), buttons(0)
+    {
+    }
+
+    /**
+     * Map a pin to a button, replacing the pin's previous button
+     * @param pin GPIO number(0..31)
+     * @param button the GamepadButton bit
+     * @param activeLow true if the pin reads 0 when pressed
+     * @return false if all PINS pins are already mapped
+     */
+    bool setPin(uint8_t pin, uint8_t button, bool activeLow)
+    {
+        uint8_t i = 0;
+        while (i < pinCount && pins[i].mask != (1UL << pin))
+        {
+            i++;
+        }
+        if (i == PINS)
+        {
+            return false;
+        }
+        if (i == pinCount)
+        {
+            pinCount++;
+        }
+        else
+        {
+            buttons &= ~pins[i].button;
+        }
+
+        pins[i].mask = 1UL << pin;
+        pins[i].button = button;
+        pins[i].integrator = 0;
+        if (activeLow)
+        {
+            activeLowPins |= pins[i].mask;
+        }
+        else
+        {
+            activeLowPins &= ~pins[i].mask;
+        }
+        buttons &= ~button;
+        return true;
+    }
+
+    /**
+     * Set the number of consecutive scans a pin must agree on
+     * @param samples 1 for no debouncing
+     */
+    void setDebounce(uint8_t samples)
+    {
+        threshold = samples == 0 ? 1 : samples;
+        for (uint8_t i = 0; i < pinCount; i++)
+        {
+            pins[i].integrator = (buttons & pins[i].button) ? threshold : 0;
+        }
+    }
+
+    bool isEmpty() const
+    {
+        return pinCount == 0;
+    }
+
+    /**
+     * Debounce one sample of all pins
+     * @param gpio the GPIO input register
+     * @return the debounced state of the mapped buttons
+     */
+    uint8_t scan(uint32_t gpio)
+    {
+        uint32_t pressed = gpio ^ activeLowPins;
+        for (uint8_t i = 0; i < pinCount; i++)
+        {
+            Pin &p = pins[i];
+            if (pressed & p.mask)
+            {
+                if (p.integrator < threshold && ++p.integrator == threshold)
+                {
+                    buttons |= p.button;
+                }
+            }
+            else if (p.integrator > 0 && --p.integrator == 0)
+            {
+                buttons &= ~p.button;
+            }
+        }
+        return buttons;
+    }
+
+  private:
+    typedef struct
+    {
+        uint32_t mask;
+        uint8_t button;
+        uint8_t integrator;
+    } Pin;
+
+    Pin pins[PINS];
+    uint8_t pinCount;
+    uint32_t activeLowPins;
+    uint8_t threshold;
+    uint8_t buttons;
+};
+
+#endif /* __INPUT_SCANNER_H__ */
@@ -0,0 +1,156 @@
+#ifndef __INPUT_TRACE_H__
+#define __INPUT_TRACE_H__
+
+#include <stdint.h>
+
+/**
+ * Units of InputTraceEvent::delta(microseconds)
+ */
+#define INPUT_TRACE_TICK_US 100
+
+enum InputTraceKind
+{
+    INPUT_TRACE_BUTTONS, // value: the state of all buttons
+    INPUT_TRACE_TILT_X,  // value: filtered tilt(milli-g), followed by Y and Z at delta 0
+    INPUT_TRACE_TILT_Y,
+    INPUT_TRACE_TILT_Z,
+    INPUT_TRACE_WAIT,    // value: additional periods of 65536 ticks before the next event
+};
+
+#pragma pack(push, 1)
+/**
+ * One input event of a trace(little endian)
+ */
+typedef struct
+{
+    uint16_t delta; // time since the previous event(INPUT_TRACE_TICK_US)
+    uint8_t kind;   // InputTraceKind
+    int16_t value;
+} InputTraceEvent;
+
+/**
+ * Header of an exported trace, followed by `count` events, oldest first
+ */
+typedef struct
+{
+    uint8_t magic[4]; // "GTRC"
+    uint8_t version;  // 1
+    uint8_t eventSize;
+    uint16_t count;
+} InputTraceHeader;
+#pragma pack(pop)
+
+/**
+ * A fixed size recorder of input events. When full, the oldest events are overwritten,
+ * so the trace always holds the input just before a problem was noticed.
+ *
+ * Not interrupt safe: recording and reading must happen from fibers.
+ * @tparam SIZE number of events
+ */
+template <uint16_t SIZE>
+class InputTrace
+{
+    static_assert(SIZE > 0, "InputTrace must hold at least one event");
+
+  public:
+    InputTrace() : first(0), count(0), lastTime(0)
+    {
+    }
+
+    /**
+     * Append an event
+     * @param time the time of the event(microseconds)
+     * @param kind the InputTraceKind of the event
+     * @param value the value of the event
+     */
+    void record(uint32_t time, uint8_t kind, int16_t value)
+    {
+        uint32_t ticks = 0;
+        if (count == 0)
+        {
+            lastTime = time;
+        }
+        else
+        {
+            ticks = (time - lastTime) / INPUT_TRACE_TICK_US;
+            // advance by whole ticks only, so that rounding does not accumulate
+            lastTime += ticks * INPUT_TRACE_TICK_US;
+        }
+
+        if (ticks > 0xffff)
+        {
+            // idle times over half an hour are shortened, so that delay() fits a signed 32 bit clock difference
+            uint32_t periods = ticks >> 16;
+            append((uint16_t)ticks, INPUT_TRACE_WAIT, (int16_t)(periods > 320 ? 320 : periods));
+            ticks = 0;
+        }
+        append((uint16_t)ticks, kind, value);
+    }
+
+    /**
+     * Append an event as it is, e.g. one of a received trace
+     */
+    void add(const InputTraceEvent &event)
+    {
+        append(event.delta, event.kind, event.value);
+    }
+
+    /**
+     * Get an event
+     * @param index 0 for the oldest event
+     */
+    const InputTraceEvent &at(uint16_t index) const
+    {
+        return events[(first + index) % SIZE];
+    }
+
+    uint16_t size() const
+    {
+        return count;
+    }
+
+    void clear()
+    {
+        first = 0;
+        count = 0;
+    }
+
+    /**
+     * Get the time between an event and the one before it
+     * @param event an event
+     * @return the time(microseconds), including the periods of an INPUT_TRACE_WAIT event
+     */
+    static uint32_t delay(const InputTraceEvent &event)
+    {
+        uint32_t ticks = event.delta;
+        if (event.kind == INPUT_TRACE_WAIT)
+        {
+            ticks += (uint32_t)(uint16_t)event.value << 16;
+        }
+        return ticks * INPUT_TRACE_TICK_US;
+    }
+
+  private:
+    void append(uint16_t delta, uint8_t kind, int16_t value)
+    {
+        InputTraceEvent &event = events[(first + count) % SIZE];
+        event.delta = delta;
+        event.kind = kind;
+        event.value = value;
+        if (count < SIZE)
+        {
+            count++;
+        }
+        else
+        {
+            first = (first + 1) % SIZE;
+        }
+    }
+
+    InputTraceEvent events[SIZE];
+    uint16_t first;
+    uint16_t count;
+    uint32_t lastTime;
+};
+
+#endif /* __INPUT_TRACE_H__ */
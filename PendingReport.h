@@ -0,0 +1,80 @@
+#ifndef __PENDING_REPORT_H__
+#define __PENDING_REPORT_H__
+
+#include "GamepadHal.h"
+
+/**
+ * An input report that is produced in fibers and sent from the report interrupt.
+ *
+ * The producer puts whole reports; the latest one is sent, so a report waiting for
+ * a TX buffer is never sent stale. `value` is the characteristic value, updated when
+ * a report is sent.
+ * @tparam Report the HIDReport
+ */
+template <typename Report>
+class PendingReport
+{
+  public:
+    PendingReport() : valueHandle(0), dirty(false)
+    {
+        memset(value, 0, sizeof(value));
+        memset(pending, 0, sizeof(pending));
+    }
+
+    /**
+     * Queue a report (producer side)
+     * @return false if it is the same as the report already queued
+     */
+    bool put(const uint8_t *report)
+    {
+        // the report interrupt reads `pending`
+        __disable_irq();
+        bool changed = memcmp(report, pending, sizeof(pending)) != 0;
+        if (changed)
+        {
+            memcpy(pending, report, sizeof(pending));
+            dirty = true;
+        }
+        __enable_irq();
+        return changed;
+    }
+
+    /**
+     * Send the queued report again, e.g. to a new host
+     */
+    void invalidate()
+    {
+        dirty = true;
+    }
+
+    bool isDirty() const
+    {
+        return dirty;
+    }
+
+    /**
+     * The report to send (report interrupt side)
+     */
+    const uint8_t *data() const
+    {
+        return pending;
+    }
+
+    /**
+     * Mark the queued report as sent (report interrupt side)
+     */
+    void sent()
+    {
+        dirty = false;
+        memcpy(value, pending, sizeof(value));
+    }
+
+    uint8_t value[Report::size];
+    GattAttribute::Handle_t valueHandle;
+
+  private:
+    uint8_t pending[Report::size];
+    volatile bool dirty;
+};
+
+#endif /* __PENDING_REPORT_H__ */
@@ -0,0 +1,101 @@
+#ifndef __TILT_FILTER_H__
+#define __TILT_FILTER_H__
+
+#include <stdint.h>
+
+/**
+ * Fixed-point filter pipeline for the 3 accelerometer axes:
+ * low-pass(IIR) filter, calibration offset, then deadzone.
+ *
+ * Integer only and allocation free. The filter state is kept in Q8 fixed point
+ * so that strong smoothing does not lose the sensor's resolution.
+ */
+class TiltFilter
+{
+  public:
+    static const uint8_t AXES = 3;
+
+    TiltFilter() : smoothing(2), deadzone(0), primed(false)
+    {
+        for (uint8_t i = 0; i < AXES; i++)
+        {
+            state[i] = 0;
+            offset[i] = 0;
+        }
+    }
+
+    /**
+     * Set the strength of the low-pass filter
+     * @param shift 0 for no filtering, n for y += (x - y) / 2^n
+     */
+    void setSmoothing(uint8_t shift)
+    {
+        smoothing = shift > 7 ? 7 : shift;
+    }
+
+    /**
+     * Set the deadzone around the calibrated center
+     * @param milliG values within +/- milliG read as 0
+     */
+    void setDeadzone(int16_t milliG)
+    {
+        deadzone = milliG < 0 ? 0 : milliG;
+    }
+
+    /**
+     * Use the current filtered values as the center
+     */
+    void calibrate()
+    {
+        for (uint8_t i = 0; i < AXES; i++)
+        {
+            offset[i] = (int16_t)(state[i] >> 8);
+        }
+    }
+
+    /**
+     * Filter one sample
+     * @param sample raw values(milli-g) of X, Y, Z
+     * @param output filtered values(milli-g) of X, Y, Z
+     */
+    void update(const int16_t *sample, int16_t *output)
+    {
+        for (uint8_t i = 0; i < AXES; i++)
+        {
+            int32_t x = (int32_t)sample[i] << 8;
+            if (primed)
+            {
+                state[i] += (x - state[i]) >> smoothing;
+            }
+            else
+            {
+                state[i] = x;
+            }
+
+            int32_t value = (state[i] >> 8) - offset[i];
+            if (value > deadzone)
+            {
+                value -= deadzone;
+            }
+            else if (value < -deadzone)
+            {
+                value += deadzone;
+            }
+            else
+            {
+                value = 0;
+            }
+            output[i] = (int16_t)value;
+        }
+        primed = true;
+    }
+
+  private:
+    int32_t state[AXES];
+    int16_t offset[AXES];
+    uint8_t smoothing;
+    int16_t deadzone;
+    bool primed;
+};
+
+#endif /* __TILT_FILTER_H__ */
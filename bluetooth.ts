@@ -1,12 +1,13 @@
 namespace bluetooth {
     /**
      * Starts the Gamepad service over Bluetooth and registers it as the Gamepad transport.
+     * Call it in "on start", so that the stack is set up and advertising before the first button press.
      */
     //% blockId="bluetooth_start_gamepad"
     //% block="bluetooth start gamepad service"
     //% parts="bluetooth"
+    //% shim=bluetooth::startGamepadService
     export function startGamepadService() {
-        bluetooth.setGamepadButton(GamepadButton.GAMEPAD_BUTTON_LEFT, ButtonState.BUTTON_UP)
     }
 
     /**
@@ -20,6 +21,615 @@ namespace bluetooth {
     export function setGamepadButton(button: GamepadButton, state: ButtonState) {
     }
 
+    /**
+     * Sets all Gamepad buttons at once, e.g. GamepadButton.GAMEPAD_BUTTON_A | GamepadButton.GAMEPAD_BUTTON_UP
+     * @param buttons the pressed buttons, the others are released
+     */
+    //% blockId="bluetooth_gamepad_set_buttons"
+    //% block="gamepad|set buttons %buttons"
+    //% parts="bluetooth"
+    //% shim=bluetooth::setGamepadButtons
+    //% advanced=true
+    export function setGamepadButtons(buttons: number) {
+    }
+
+    /**
+     * Presses Gamepad buttons, leaving the others as they are
+     * @param buttons the buttons, e.g. GamepadButton.GAMEPAD_BUTTON_A | GamepadButton.GAMEPAD_BUTTON_B
+     */
+    //% blockId="bluetooth_gamepad_press_buttons"
+    //% block="gamepad|press buttons %buttons"
+    //% parts="bluetooth"
+    //% shim=bluetooth::pressGamepadButtons
+    //% advanced=true
+    export function pressGamepadButtons(buttons: number) {
+    }
+
+    /**
+     * Releases Gamepad buttons, leaving the others as they are
+     * @param buttons the buttons, e.g. GamepadButton.GAMEPAD_BUTTON_A | GamepadButton.GAMEPAD_BUTTON_B
+     */
+    //% blockId="bluetooth_gamepad_release_buttons"
+    //% block="gamepad|release buttons %buttons"
+    //% parts="bluetooth"
+    //% shim=bluetooth::releaseGamepadButtons
+    //% advanced=true
+    export function releaseGamepadButtons(buttons: number) {
+    }
+
+    /**
+     * Starts collecting Gamepad button changes. Nothing is sent until the update is committed.
+     */
+    //% blockId="bluetooth_gamepad_begin_update"
+    //% block="gamepad|begin update"
+    //% parts="bluetooth"
+    //% shim=bluetooth::beginGamepadUpdate
+    //% advanced=true
+    export function beginGamepadUpdate() {
+    }
+
+    /**
+     * Sends the Gamepad button changes collected since the update began, at once in one report
+     */
+    //% blockId="bluetooth_gamepad_commit_update"
+    //% block="gamepad|commit update"
+    //% parts="bluetooth"
+    //% shim=bluetooth::commitGamepadUpdate
+    //% advanced=true
+    export function commitGamepadUpdate() {
+    }
+
+    /**
+     * Presses or releases a key of the keyboard report. Needs GAMEPAD_KEYBOARD_REPORT in the yotta config.
+     * @param key the HID usage of the key, eg: 4
+     * @param state BUTTON_DOWN to press
+     */
+    //% blockId="bluetooth_gamepad_set_key"
+    //% block="gamepad|set key %key|to %state"
+    //% parts="bluetooth"
+    //% shim=bluetooth::setGamepadKey
+    //% advanced=true
+    export function setGamepadKey(key: number, state: ButtonState) {
+    }
+
+    /**
+     * Sets the active consumer control, e.g. 0xcd for Play/Pause, 0 for none. Needs GAMEPAD_CONSUMER_REPORT in the yotta config.
+     * @param usage the HID usage of the control, eg: 205
+     */
+    //% blockId="bluetooth_gamepad_set_consumer_control"
+    //% block="gamepad|set consumer control %usage"
+    //% parts="bluetooth"
+    //% shim=bluetooth::setGamepadConsumerControl
+    //% advanced=true
+    export function setGamepadConsumerControl(usage: number) {
+    }
+
+    /**
+     * Reads a Gamepad button from a pin, sampled and debounced natively instead of through pin events
+     * @param button the button
+     * @param pin the pin the button is wired to
+     * @param activeLow true if the pin reads 0 while pressed: the pin is pulled up, and the button connects it to GND
+     */
+    //% blockId="bluetooth_gamepad_input_pin"
+    //% block="gamepad|button %button|on pin %pin|active low %activeLow"
+    //% parts="bluetooth"
+    //% shim=bluetooth::setGamepadInputPin
+    //% advanced=true
+    export function setGamepadInputPin(button: GamepadButton, pin: DigitalPin, activeLow: boolean) {
+    }
+
+    /**
+     * Sets how often the pins of the Gamepad buttons are sampled, and how many consecutive samples must agree
+     * @param period time between two samples(ms), eg: 1
+     * @param samples number of samples, eg: 5
+     */
+    //% blockId="bluetooth_gamepad_input_scanning"
+    //% block="gamepad|sample pins every %period|ms, debounce %samples|samples"
+    //% parts="bluetooth"
+    //% shim=bluetooth::setGamepadInputScanning
+    //% advanced=true
+    export function setGamepadInputScanning(period: number, samples: number) {
+    }
+
+    /**
+     * Repeats a Gamepad button natively while it is held, at a steady rate
+     * @param button the button
+     * @param rate presses per second, 0 to turn turbo off, eg: 10
+     */
+    //% blockId="bluetooth_gamepad_turbo"
+    //% block="gamepad|turbo %button|at %rate|presses per second"
+    //% parts="bluetooth"
+    //% shim=bluetooth::setGamepadTurbo
+    //% advanced=true
+    export function setGamepadTurbo(button: GamepadButton, rate: number) {
+    }
+
+    /**
+     * Appends a step to the Gamepad macro: press or release buttons, or wait a number of report intervals
+     * @param op the step
+     * @param arg the buttons to press or release, or the intervals to wait(1..255)
+     */
+    //% blockId="bluetooth_gamepad_macro_step"
+    //% block="gamepad|macro %op|%arg"
+    //% parts="bluetooth"
+    //% shim=bluetooth::addGamepadMacroStep
+    //% advanced=true
+    export function addGamepadMacroStep(op: GamepadMacroOp, arg: number): boolean {
+        return false
+    }
+
+    /**
+     * Stops and removes the Gamepad macro
+     */
+    //% blockId="bluetooth_gamepad_clear_macro"
+    //% block="gamepad|clear macro"
+    //% parts="bluetooth"
+    //% shim=bluetooth::clearGamepadMacro
+    //% advanced=true
+    export function clearGamepadMacro() {
+    }
+
+    /**
+     * Plays the Gamepad macro natively, at the timing of the report path
+     * @param loop true to repeat it until it is stopped
+     */
+    //% blockId="bluetooth_gamepad_play_macro"
+    //% block="gamepad|play macro|loop %loop"
+    //% parts="bluetooth"
+    //% shim=bluetooth::playGamepadMacro
+    //% advanced=true
+    export function playGamepadMacro(loop: boolean) {
+    }
+
+    /**
+     * Stops the Gamepad macro, releasing its buttons
+     */
+    //% blockId="bluetooth_gamepad_stop_macro"
+    //% block="gamepad|stop macro"
+    //% parts="bluetooth"
+    //% shim=bluetooth::stopGamepadMacro
+    //% advanced=true
+    export function stopGamepadMacro() {
+    }
+
+    /**
+     * Whether the Gamepad macro is playing
+     */
+    //% blockId="bluetooth_gamepad_macro_playing"
+    //% block="gamepad|macro playing"
+    //% parts="bluetooth"
+    //% shim=bluetooth::gamepadMacroPlaying
+    //% advanced=true
+    export function gamepadMacroPlaying(): boolean {
+        return false
+    }
+
+    /**
+     * Reads a Gamepad stick or trigger axis from an analog pin, oversampled natively between reports.
+     * Needs the extension built with GAMEPAD_ANALOG_AXES.
+     * @param axis the axis
+     * @param pin the analog pin the potentiometer wiper is wired to, its ends to 3V and GND
+     * @param inverted true if the pin reads higher to the left, to the top, or at the rest position of a trigger
+     */
+    //% blockId="bluetooth_gamepad_analog_pin"
+    //% block="gamepad|axis %axis|on pin %pin|inverted %inverted"
+    //% parts="bluetooth"
+    //% shim=bluetooth::setGamepadAnalogPin
+    //% advanced=true
+    export function setGamepadAnalogPin(axis: GamepadAnalogAxis, pin: AnalogPin, inverted: boolean) {
+    }
+
+    /**
+     * Sets how often the Gamepad analog axes are sampled, how many conversions are averaged, and their deadzone
+     * @param period time between two samples(ms), eg: 10
+     * @param oversampling conversions averaged per axis(1..64), eg: 8
+     * @param deadzone deadzone of the sticks and triggers(out of 127), eg: 10
+     */
+    //% blockId="bluetooth_gamepad_analog_sampling"
+    //% block="gamepad|sample axes every %period|ms averaging %oversampling|deadzone %deadzone"
+    //% parts="bluetooth"
+    //% shim=bluetooth::setGamepadAnalogSampling
+    //% advanced=true
+    export function setGamepadAnalogSampling(period: number, oversampling: number, deadzone: number) {
+    }
+
+    /**
+     * Uses the current position of the Gamepad sticks as their centers, and of the triggers as their rest positions
+     */
+    //% blockId="bluetooth_gamepad_calibrate_analog"
+    //% block="gamepad|calibrate axes"
+    //% parts="bluetooth"
+    //% shim=bluetooth::calibrateGamepadAnalog
+    //% advanced=true
+    export function calibrateGamepadAnalog() {
+    }
+
+    /**
+     * Gets a Gamepad analog axis as reported: -127..127 for the sticks, 0..255 for the triggers
+     * @param axis the axis
+     */
+    //% blockId="bluetooth_gamepad_analog_axis"
+    //% block="gamepad|axis %axis"
+    //% parts="bluetooth"
+    //% shim=bluetooth::gamepadAnalogAxis
+    //% advanced=true
+    export function gamepadAnalogAxis(axis: GamepadAnalogAxis): number {
+        return 0
+    }
+
+    /**
+     * Whether the Gamepad started with the controller profile stored in flash.
+     * Needs the extension built with GAMEPAD_PROFILE.
+     */
+    //% blockId="bluetooth_gamepad_profile_loaded"
+    //% block="gamepad|profile loaded"
+    //% parts="bluetooth"
+    //% shim=bluetooth::gamepadProfileLoaded
+    //% advanced=true
+    export function gamepadProfileLoaded(): boolean {
+        return false
+    }
+
+    /**
+     * Erases the Gamepad controller profile: the next boot starts with the defaults and the script's setup
+     */
+    //% blockId="bluetooth_gamepad_clear_profile"
+    //% block="gamepad|clear profile"
+    //% parts="bluetooth"
+    //% shim=bluetooth::clearGamepadProfile
+    //% advanced=true
+    export function clearGamepadProfile() {
+    }
+
+    /**
+     * Aggregates satellite micro:bits wired to a serial link into extra Gamepad players.
+     * Needs the extension built with GAMEPAD_HUB_PLAYERS.
+     * Polls up to 4 satellites in turn; only the polled one answers.
+     * @param tx the pin wired to the satellites' RX
+     * @param rx the pin wired to the satellites' TX, pulled up by the hub
+     * @param rate the baud rate of the link, eg: BaudRate.BaudRate115200
+     */
+    //% blockId="bluetooth_gamepad_start_hub"
+    //% block="gamepad|start hub|TX %tx|RX %rx|at baud rate %rate"
+    //% parts="bluetooth"
+    //% shim=bluetooth::startGamepadHub
+    //% advanced=true
+    export function startGamepadHub(tx: SerialPin, rx: SerialPin, rate: BaudRate) {
+    }
+
+    /**
+     * Gets a statistic of the hub's serial link
+     * @param stat the statistic
+     */
+    //% blockId="bluetooth_gamepad_hub_stat"
+    //% block="gamepad|hub %stat"
+    //% parts="bluetooth"
+    //% shim=bluetooth::gamepadHubStat
+    //% advanced=true
+    export function gamepadHubStat(stat: GamepadHubStat): number {
+        return 0
+    }
+
+    /**
+     * Makes this micro:bit a satellite player of a hub: it answers the hub's polls with its buttons, through the serial port.
+     * The satellite doesn't start the Gamepad service. Its TX only pulls the line low, so that satellites can share the hub's RX.
+     * Needs GAMEPAD_HUB_SATELLITE set to 1 in the yotta config.
+     * @param player the satellite's player on the hub, 0 to 3, below the hub's GAMEPAD_HUB_PLAYERS, eg: 0
+     * @param tx the pin wired to the hub's RX
+     * @param rx the pin wired to the hub's TX
+     * @param rate the baud rate of the link, eg: BaudRate.BaudRate115200
+     */
+    //% blockId="bluetooth_gamepad_start_satellite"
+    //% block="gamepad|start satellite player %player|TX %tx|RX %rx|at baud rate %rate"
+    //% player.min=0 player.max=3
+    //% parts="bluetooth"
+    //% shim=bluetooth::startGamepadSatellite
+    //% advanced=true
+    export function startGamepadSatellite(player: number, tx: SerialPin, rx: SerialPin, rate: BaudRate) {
+    }
+
+    /**
+     * Sets the buttons the satellite sends at the hub's next poll
+     * @param buttons the state of the buttons
+     */
+    //% blockId="bluetooth_gamepad_satellite_buttons"
+    //% block="gamepad|satellite buttons %buttons"
+    //% parts="bluetooth"
+    //% shim=bluetooth::setGamepadSatelliteButtons
+    //% advanced=true
+    export function setGamepadSatelliteButtons(buttons: number) {
+    }
+
+    /**
+     * Sets the timing of the Gamepad reports. Reports are sent when a button changes.
+     * @param minInterval minimum spacing between two reports in milliseconds, eg: 8
+     * @param keepAlive interval to resend the current state in milliseconds, 0 to disable, eg: 0
+     */
+    //% blockId="bluetooth_gamepad_set_report_interval"
+    //% block="gamepad|set report interval %minInterval|ms keep alive %keepAlive|ms"
+    //% parts="bluetooth"
+    //% shim=bluetooth::setGamepadReportInterval
+    //% advanced=true
+    export function setGamepadReportInterval(minInterval: number, keepAlive: number) {
+    }
+
+    /**
+     * Sets when the Gamepad reports are sent: as soon as input changes, or just before each radio connection event
+     * for the lowest and steadiest latency.
+     */
+    //% blockId="bluetooth_gamepad_set_report_mode"
+    //% block="gamepad|send reports %mode"
+    //% parts="bluetooth"
+    //% shim=bluetooth::setGamepadReportMode
+    //% advanced=true
+    export function setGamepadReportMode(mode: GamepadReportMode) {
+    }
+
+    /**
+     * Sends the micro:bit tilt as analog X/Y/Z axes. The accelerometer is sampled natively.
+     * @param period sampling period in milliseconds, 0 to stop, eg: 10
+     */
+    //% blockId="bluetooth_gamepad_set_tilt_sampling"
+    //% block="gamepad|sample tilt every %period|ms"
+    //% parts="bluetooth"
+    //% shim=bluetooth::setGamepadTiltSampling
+    //% advanced=true
+    export function setGamepadTiltSampling(period: number) {
+    }
+
+    /**
+     * Sets the filter applied to the tilt axes
+     * @param smoothing 0 for no smoothing, up to 7 for the strongest, eg: 2
+     * @param deadzone tilt in milli-g around the center that reads as 0, eg: 50
+     */
+    //% blockId="bluetooth_gamepad_set_tilt_filter"
+    //% block="gamepad|set tilt smoothing %smoothing|deadzone %deadzone"
+    //% parts="bluetooth"
+    //% shim=bluetooth::setGamepadTiltFilter
+    //% advanced=true
+    export function setGamepadTiltFilter(smoothing: number, deadzone: number) {
+    }
+
+    /**
+     * Uses the current tilt as the center of the tilt axes
+     */
+    //% blockId="bluetooth_gamepad_calibrate_tilt"
+    //% block="gamepad|calibrate tilt"
+    //% parts="bluetooth"
+    //% shim=bluetooth::calibrateGamepadTilt
+    //% advanced=true
+    export function calibrateGamepadTilt() {
+    }
+
+    /**
+     * Sets how long the Gamepad waits without input before asking the host for a slower, power saving connection.
+     * The fast connection is requested again on the next input.
+     * @param timeout time without input in milliseconds, 0 to always stay fast, eg: 5000
+     */
+    //% blockId="bluetooth_gamepad_set_idle_timeout"
+    //% block="gamepad|set idle timeout %timeout|ms"
+    //% parts="bluetooth"
+    //% shim=bluetooth::setGamepadIdleTimeout
+    //% advanced=true
+    export function setGamepadIdleTimeout(timeout: number) {
+    }
+
+    /**
+     * Gets a parameter of the current connection, as granted by the host. 0 when not connected.
+     */
+    //% blockId="bluetooth_gamepad_connection_parameter"
+    //% block="gamepad|connection %parameter"
+    //% parts="bluetooth"
+    //% shim=bluetooth::gamepadConnectionParameter
+    //% advanced=true
+    export function gamepadConnectionParameter(parameter: GamepadConnectionParameter): number {
+        return 0
+    }
+
+    /**
+     * Gets the battery level in percent the Gamepad reports to the host, measured from the supply voltage
+     */
+    //% blockId="bluetooth_gamepad_battery_level"
+    //% block="gamepad|battery level"
+    //% parts="bluetooth"
+    //% shim=bluetooth::gamepadBatteryLevel
+    //% advanced=true
+    export function gamepadBatteryLevel(): number {
+        return 0
+    }
+
+    /**
+     * Gets the time since boot, in microseconds, at which a startup stage of the Gamepad completed, 0 if it has not yet
+     */
+    //% blockId="bluetooth_gamepad_startup_time"
+    //% block="gamepad|startup time %stage"
+    //% parts="bluetooth"
+    //% shim=bluetooth::gamepadStartupTime
+    //% advanced=true
+    export function gamepadStartupTime(stage: GamepadStartupStage): number {
+        return 0
+    }
+
+    /**
+     * Switches a pin on while the host asks the Gamepad to rumble, e.g. to drive a vibration motor
+     * @param pin the pin the motor driver is wired to
+     */
+    //% blockId="bluetooth_gamepad_rumble_pin"
+    //% block="gamepad|rumble on pin %pin"
+    //% parts="bluetooth"
+    //% shim=bluetooth::setGamepadRumblePin
+    //% advanced=true
+    export function setGamepadRumblePin(pin: DigitalPin) {
+    }
+
+    /**
+     * Shows the LEDs the host writes to the Gamepad on the LED screen
+     * @param enabled true to show them
+     */
+    //% blockId="bluetooth_gamepad_led_feedback"
+    //% block="gamepad|show host LEDs %enabled"
+    //% parts="bluetooth"
+    //% shim=bluetooth::setGamepadLedFeedback
+    //% advanced=true
+    export function setGamepadLedFeedback(enabled: boolean) {
+    }
+
+    /**
+     * Gets a value of the last output report the host wrote: rumble intensity(%), rumble duration(ms) or LEDs
+     */
+    //% blockId="bluetooth_gamepad_output"
+    //% block="gamepad|host output %output"
+    //% parts="bluetooth"
+    //% shim=bluetooth::gamepadOutput
+    //% advanced=true
+    export function gamepadOutput(output: GamepadOutput): number {
+        return 0
+    }
+
+    /**
+     * Runs code when the host writes rumble or LED feedback to the Gamepad
+     */
+    //% blockId="bluetooth_gamepad_on_output"
+    //% block="on gamepad host output"
+    //% parts="bluetooth"
+    //% advanced=true
+    export function onGamepadOutput(handler: () => void) {
+        control.onEvent(gamepadEventId(), 3, handler) // GAMEPAD_EVT_OUTPUT
+    }
+
+    /**
+     * Gets the message bus ID of the Gamepad's events, GAMEPAD_EVT_ID of the build
+     */
+    //% shim=bluetooth::gamepadEventId
+    //% advanced=true
+    export function gamepadEventId(): number {
+        return 9600
+    }
+
+    /**
+     * Gets the wakeups per second of the Gamepad, or its estimated current draw in microamperes.
+     * The radio and the Gamepad's interrupts are counted; the display and the sensors are not.
+     */
+    //% blockId="bluetooth_gamepad_power_stat"
+    //% block="gamepad|power %stat"
+    //% parts="bluetooth"
+    //% shim=bluetooth::gamepadPowerStat
+    //% advanced=true
+    export function gamepadPowerStat(stat: GamepadPowerStat): number {
+        return 0
+    }
+
+    /**
+     * Gets the time in milliseconds the host took to reconnect after the last disconnection, 0 before the first reconnection
+     */
+    //% blockId="bluetooth_gamepad_reconnect_time"
+    //% block="gamepad|reconnect time"
+    //% parts="bluetooth"
+    //% shim=bluetooth::gamepadReconnectTime
+    //% advanced=true
+    export function gamepadReconnectTime(): number {
+        return 0
+    }
+
+    /**
+     * Gets a counter or timing of the Gamepad report path.
+     * Always 0 unless the package is built with GAMEPAD_DIAGNOSTICS set to 1.
+     */
+    //% blockId="bluetooth_gamepad_diagnostic"
+    //% block="gamepad|diagnostic %diagnostic"
+    //% parts="bluetooth"
+    //% shim=bluetooth::gamepadDiagnostic
+    //% advanced=true
+    export function gamepadDiagnostic(diagnostic: GamepadDiagnostic): number {
+        return 0
+    }
+
+    /**
+     * Gets the number of button edges whose press-to-queue latency fell in a bucket:
+     * 0 for less than 1 ms, 1 for less than 2 ms, 2 for less than 4 ms, ... up to 7 for the rest.
+     * @param bucket histogram bucket, eg: 0
+     */
+    //% blockId="bluetooth_gamepad_latency_histogram"
+    //% block="gamepad|latency histogram bucket %bucket"
+    //% parts="bluetooth"
+    //% shim=bluetooth::gamepadLatencyHistogram
+    //% advanced=true
+    export function gamepadLatencyHistogram(bucket: number): number {
+        return 0
+    }
+
+    /**
+     * Resets the Gamepad diagnostics
+     */
+    //% blockId="bluetooth_gamepad_reset_diagnostics"
+    //% block="gamepad|reset diagnostics"
+    //% parts="bluetooth"
+    //% shim=bluetooth::resetGamepadDiagnostics
+    //% advanced=true
+    export function resetGamepadDiagnostics() {
+    }
+
+    /**
+     * Starts or stops recording the Gamepad input. Starting clears the previous recording.
+     * Needs GAMEPAD_TRACE_EVENTS in the yotta config.
+     * @param record true to start recording, false to stop
+     */
+    //% blockId="bluetooth_gamepad_record_trace"
+    //% block="gamepad|record input %record"
+    //% record.shadow="toggleOnOff"
+    //% parts="bluetooth"
+    //% shim=bluetooth::recordGamepadTrace
+    //% advanced=true
+    export function recordGamepadTrace(record: boolean) {
+    }
+
+    /**
+     * Replays the recorded Gamepad input at its original timing. Buttons set meanwhile are ignored.
+     */
+    //% blockId="bluetooth_gamepad_play_trace"
+    //% block="gamepad|replay input"
+    //% parts="bluetooth"
+    //% shim=bluetooth::playGamepadTrace
+    //% advanced=true
+    export function playGamepadTrace() {
+    }
+
+    /**
+     * Sends the recorded Gamepad input to the serial port
+     */
+    //% blockId="bluetooth_gamepad_send_trace"
+    //% block="gamepad|send input to serial"
+    //% parts="bluetooth"
+    //% shim=bluetooth::sendGamepadTrace
+    //% advanced=true
+    export function sendGamepadTrace() {
+    }
+
+    /**
+     * Receives a Gamepad input recording from the serial port, replacing the current one.
+     * Returns the number of events received.
+     */
+    //% blockId="bluetooth_gamepad_receive_trace"
+    //% block="gamepad|receive input from serial"
+    //% parts="bluetooth"
+    //% shim=bluetooth::receiveGamepadTrace
+    //% advanced=true
+    export function receiveGamepadTrace(): number {
+        return 0
+    }
+
+    /**
+     * Gets the number of recorded Gamepad input events
+     */
+    //% blockId="bluetooth_gamepad_trace_length"
+    //% block="gamepad|recorded input length"
+    //% parts="bluetooth"
+    //% shim=bluetooth::gamepadTraceLength
+    //% advanced=true
+    export function gamepadTraceLength(): number {
+        return 0
+    }
+
     /**
      * Gets the button
      */
@@ -8,6 +8,95 @@
     }
 
 
+    declare const enum GamepadDiagnostic
+    {
+    GAMEPAD_DIAG_REPORTS_SENT = 0,
+    GAMEPAD_DIAG_REPORTS_REJECTED = 1,
+    GAMEPAD_DIAG_REPORTS_DROPPED = 2,
+    GAMEPAD_DIAG_DUPLICATES_SUPPRESSED = 3,
+    GAMEPAD_DIAG_EDGES_OVERFLOWED = 4,
+    GAMEPAD_DIAG_SET_BUTTON_MAX_US = 5,
+    GAMEPAD_DIAG_SET_BUTTON_AVG_US = 6,
+    GAMEPAD_DIAG_ENCODE_MAX_US = 7,
+    GAMEPAD_DIAG_ENCODE_AVG_US = 8,
+    GAMEPAD_DIAG_WRITE_MAX_US = 9,
+    GAMEPAD_DIAG_WRITE_AVG_US = 10,
+    }
+
+
+    declare const enum GamepadReportMode
+    {
+    GAMEPAD_REPORT_ON_CHANGE = 0,
+    GAMEPAD_REPORT_ON_RADIO = 1,
+    }
+
+
+    declare const enum GamepadConnectionParameter
+    {
+    GAMEPAD_CONNECTION_INTERVAL = 0,
+    GAMEPAD_CONNECTION_SLAVE_LATENCY = 1,
+    GAMEPAD_CONNECTION_SUPERVISION_TIMEOUT = 2,
+    }
+
+
+    declare const enum GamepadPowerStat
+    {
+    GAMEPAD_POWER_WAKEUPS = 0,
+    GAMEPAD_POWER_RADIO_EVENTS = 1,
+    GAMEPAD_POWER_CURRENT = 2,
+    }
+
+
+    declare const enum GamepadMacroOp
+    {
+    GAMEPAD_MACRO_PRESS = 0,
+    GAMEPAD_MACRO_RELEASE = 1,
+    GAMEPAD_MACRO_WAIT = 2,
+    }
+
+
+    declare const enum GamepadAnalogAxis
+    {
+    GAMEPAD_ANALOG_LEFT_X = 0,
+    GAMEPAD_ANALOG_LEFT_Y = 1,
+    GAMEPAD_ANALOG_RIGHT_X = 2,
+    GAMEPAD_ANALOG_RIGHT_Y = 3,
+    GAMEPAD_ANALOG_LEFT_TRIGGER = 4,
+    GAMEPAD_ANALOG_RIGHT_TRIGGER = 5,
+    }
+
+
+    declare const enum GamepadHubStat
+    {
+    GAMEPAD_HUB_FRAMES = 0,
+    GAMEPAD_HUB_ERRORS = 1,
+    GAMEPAD_HUB_LOST = 2,
+    GAMEPAD_HUB_LATENCY_MAX_US = 3,
+    GAMEPAD_HUB_LATENCY_AVG_US = 4,
+    }
+
+
+    declare const enum GamepadStartupStage
+    {
+    GAMEPAD_STARTUP_BEGIN = 0,
+    GAMEPAD_STARTUP_BLE_INIT = 1,
+    GAMEPAD_STARTUP_SECURITY = 2,
+    GAMEPAD_STARTUP_GATT = 3,
+    GAMEPAD_STARTUP_ADVERTISING = 4,
+    GAMEPAD_STARTUP_CONNECTED = 5,
+    GAMEPAD_STARTUP_FIRST_REPORT = 6,
+    GAMEPAD_STARTUP_STAGES = 7,
+    }
+
+
+    declare const enum GamepadOutput
+    {
+    GAMEPAD_OUTPUT_RUMBLE = 0,
+    GAMEPAD_OUTPUT_RUMBLE_DURATION = 1,
+    GAMEPAD_OUTPUT_LEDS = 2,
+    }
+
+
     declare const enum GamepadButton
     {
     GAMEPAD_BUTTON_UP = 0x1,
@@ -1,3 +1,4 @@
+#include <new>
 #include "pxt.h"
 #include "BluetoothGamepadService.h"
 using namespace pxt;
@@ -6,20 +7,463 @@ using namespace pxt;
  */
 namespace bluetooth
 {
+/**
+ * Storage of the service, so that it takes no heap and its RAM shows up at link time
+ */
+alignas(BluetoothGamepadService) static uint8_t gamepadStorage[sizeof(BluetoothGamepadService)];
 static BluetoothGamepadService *pGamepadInstance = nullptr;
 static BluetoothGamepadService *getGamepad()
 {
     if (pGamepadInstance == nullptr)
     {
-        pGamepadInstance = new BluetoothGamepadService(uBit.ble);
+        // constructed on first use, once uBit.ble exists
+        pGamepadInstance = new (gamepadStorage) BluetoothGamepadService(uBit.ble);
     }
     return pGamepadInstance;
 }
 
+//%
+void startGamepadService()
+{
+    getGamepad();
+}
+
 //%
 void gamepadButton(GamepadButton button, ButtonState state)
 {
     BluetoothGamepadService *pGamepad = getGamepad();
     pGamepad->setButton(button, state);
 }
+
+//%
+void setGamepadButtons(int buttons)
+{
+    BluetoothGamepadService *pGamepad = getGamepad();
+    pGamepad->setButtons(buttons);
+}
+
+//%
+void pressGamepadButtons(int buttons)
+{
+    BluetoothGamepadService *pGamepad = getGamepad();
+    pGamepad->pressButtons(buttons);
+}
+
+//%
+void releaseGamepadButtons(int buttons)
+{
+    BluetoothGamepadService *pGamepad = getGamepad();
+    pGamepad->releaseButtons(buttons);
+}
+
+//%
+void beginGamepadUpdate()
+{
+    BluetoothGamepadService *pGamepad = getGamepad();
+    pGamepad->beginUpdate();
+}
+
+//%
+void commitGamepadUpdate()
+{
+    BluetoothGamepadService *pGamepad = getGamepad();
+    pGamepad->commitUpdate();
+}
+
+//%
+void setGamepadKey(int key, ButtonState state)
+{
+    if (key < 0 || key > 0xff)
+    {
+        return;
+    }
+    BluetoothGamepadService *pGamepad = getGamepad();
+    pGamepad->setKey(key, state);
+}
+
+//%
+void setGamepadConsumerControl(int usage)
+{
+    if (usage < 0 || usage > 0xffff)
+    {
+        return;
+    }
+    BluetoothGamepadService *pGamepad = getGamepad();
+    pGamepad->setConsumerControl(usage);
+}
+
+//%
+void setGamepadInputPin(GamepadButton button, int pin, bool activeLow)
+{
+    MicroBitPin *inputPin = getPin(pin);
+    if (inputPin == NULL)
+    {
+        return;
+    }
+    // the scanner reads the pin directly, it only has to be a digital input
+    inputPin->getDigitalValue();
+    inputPin->setPull(activeLow ? PullUp : PullDown);
+
+    BluetoothGamepadService *pGamepad = getGamepad();
+    pGamepad->setInputPin(button, inputPin->name, activeLow);
+}
+
+//%
+void setGamepadInputScanning(int period, int samples)
+{
+    if (period < 0 || samples < 0 || samples > 255)
+    {
+        return;
+    }
+    BluetoothGamepadService *pGamepad = getGamepad();
+    pGamepad->setInputScanning(period * 1000, samples);
+}
+
+//%
+void setGamepadReportInterval(int minInterval, int keepAlive)
+{
+    if (minInterval < 0 || keepAlive < 0)
+    {
+        return;
+    }
+    BluetoothGamepadService *pGamepad = getGamepad();
+    pGamepad->setReportInterval(minInterval * 1000, keepAlive * 1000);
+}
+
+//%
+void setGamepadReportMode(GamepadReportMode mode)
+{
+    BluetoothGamepadService *pGamepad = getGamepad();
+    pGamepad->setReportMode(mode);
+}
+
+//%
+void setGamepadTiltSampling(int period)
+{
+    if (period < 0)
+    {
+        return;
+    }
+    BluetoothGamepadService *pGamepad = getGamepad();
+    pGamepad->setTiltSampling(period);
+}
+
+//%
+void setGamepadTiltFilter(int smoothing, int deadzone)
+{
+    if (smoothing < 0 || deadzone < 0)
+    {
+        return;
+    }
+    BluetoothGamepadService *pGamepad = getGamepad();
+    pGamepad->setTiltFilter(smoothing, deadzone);
+}
+
+//%
+void calibrateGamepadTilt()
+{
+    BluetoothGamepadService *pGamepad = getGamepad();
+    pGamepad->calibrateTilt();
+}
+
+//%
+void setGamepadIdleTimeout(int timeout)
+{
+    if (timeout < 0)
+    {
+        return;
+    }
+    BluetoothGamepadService *pGamepad = getGamepad();
+    pGamepad->setIdleTimeout(timeout);
+}
+
+//%
+int gamepadConnectionParameter(GamepadConnectionParameter parameter)
+{
+    BluetoothGamepadService *pGamepad = getGamepad();
+    return pGamepad->getConnectionParameter(parameter);
+}
+
+//%
+int gamepadReconnectTime()
+{
+    BluetoothGamepadService *pGamepad = getGamepad();
+    return pGamepad->getReconnectTime();
+}
+
+//%
+int gamepadDiagnostic(GamepadDiagnostic diagnostic)
+{
+    BluetoothGamepadService *pGamepad = getGamepad();
+    return pGamepad->getDiagnostic(diagnostic);
+}
+
+//%
+int gamepadLatencyHistogram(int bucket)
+{
+    if (bucket < 0)
+    {
+        return 0;
+    }
+    BluetoothGamepadService *pGamepad = getGamepad();
+    return pGamepad->getLatencyHistogram(bucket);
+}
+
+//%
+void resetGamepadDiagnostics()
+{
+    BluetoothGamepadService *pGamepad = getGamepad();
+    pGamepad->resetDiagnostics();
+}
+
+//%
+void recordGamepadTrace(bool record)
+{
+    BluetoothGamepadService *pGamepad = getGamepad();
+    pGamepad->recordTrace(record);
+}
+
+//%
+void playGamepadTrace()
+{
+    BluetoothGamepadService *pGamepad = getGamepad();
+    pGamepad->playTrace();
+}
+
+//%
+void sendGamepadTrace()
+{
+    BluetoothGamepadService *pGamepad = getGamepad();
+    pGamepad->sendTrace();
+}
+
+//%
+int receiveGamepadTrace()
+{
+    BluetoothGamepadService *pGamepad = getGamepad();
+    return pGamepad->receiveTrace();
+}
+
+//%
+int gamepadTraceLength()
+{
+    BluetoothGamepadService *pGamepad = getGamepad();
+    return pGamepad->getTraceLength();
+}
+
+//%
+int gamepadBatteryLevel()
+{
+    BluetoothGamepadService *pGamepad = getGamepad();
+    return pGamepad->getBatteryLevel();
+}
+
+//%
+int gamepadPowerStat(GamepadPowerStat stat)
+{
+    BluetoothGamepadService *pGamepad = getGamepad();
+    return pGamepad->getPowerStat(stat);
+}
+
+//%
+void setGamepadRumblePin(int pin)
+{
+    MicroBitPin *outputPin = getPin(pin);
+    if (outputPin == NULL)
+    {
+        return;
+    }
+    // the service switches the pin directly, it only has to be a digital output
+    outputPin->setDigitalValue(0);
+
+    BluetoothGamepadService *pGamepad = getGamepad();
+    pGamepad->setRumblePin((uint8_t)outputPin->name);
+}
+
+//%
+void setGamepadLedFeedback(bool enabled)
+{
+    BluetoothGamepadService *pGamepad = getGamepad();
+    pGamepad->setLedFeedback(enabled);
+}
+
+//%
+int gamepadOutput(GamepadOutput output)
+{
+    BluetoothGamepadService *pGamepad = getGamepad();
+    return pGamepad->getOutput(output);
+}
+
+//%
+int gamepadEventId()
+{
+    return GAMEPAD_EVT_ID;
+}
+
+//%
+int gamepadStartupTime(GamepadStartupStage stage)
+{
+    if (stage < 0 || stage >= GAMEPAD_STARTUP_STAGES)
+    {
+        return 0;
+    }
+    BluetoothGamepadService *pGamepad = getGamepad();
+    return pGamepad->getStartupTime(stage);
+}
+
+//%
+void setGamepadTurbo(GamepadButton button, int rate)
+{
+    if (rate < 0 || rate > 255)
+    {
+        return;
+    }
+    BluetoothGamepadService *pGamepad = getGamepad();
+    pGamepad->setTurbo(button, rate);
+}
+
+//%
+bool addGamepadMacroStep(GamepadMacroOp op, int arg)
+{
+    if (arg < 0 || arg > 255)
+    {
+        return false;
+    }
+    BluetoothGamepadService *pGamepad = getGamepad();
+    return pGamepad->addMacroStep(op, arg);
+}
+
+//%
+void clearGamepadMacro()
+{
+    BluetoothGamepadService *pGamepad = getGamepad();
+    pGamepad->clearMacro();
+}
+
+//%
+void playGamepadMacro(bool loop)
+{
+    BluetoothGamepadService *pGamepad = getGamepad();
+    pGamepad->playMacro(loop);
+}
+
+//%
+void stopGamepadMacro()
+{
+    BluetoothGamepadService *pGamepad = getGamepad();
+    pGamepad->stopMacro();
+}
+
+//%
+bool gamepadMacroPlaying()
+{
+    BluetoothGamepadService *pGamepad = getGamepad();
+    return pGamepad->isMacroPlaying();
+}
+
+//%
+bool setGamepadAnalogPin(GamepadAnalogAxis axis, int pin, bool inverted)
+{
+    MicroBitPin *inputPin = getPin(pin);
+    if (inputPin == NULL)
+    {
+        return false;
+    }
+    BluetoothGamepadService *pGamepad = getGamepad();
+    return pGamepad->setAnalogPin(axis, inputPin->name, inverted);
+}
+
+//%
+void setGamepadAnalogSampling(int period, int oversampling, int deadzone)
+{
+    if (period < 0 || oversampling < 0 || oversampling > 255 || deadzone < 0 || deadzone > 255)
+    {
+        return;
+    }
+    BluetoothGamepadService *pGamepad = getGamepad();
+    pGamepad->setAnalogSampling(period * 1000, oversampling, deadzone);
+}
+
+//%
+void calibrateGamepadAnalog()
+{
+    BluetoothGamepadService *pGamepad = getGamepad();
+    pGamepad->calibrateAnalog();
+}
+
+//%
+int gamepadAnalogAxis(GamepadAnalogAxis axis)
+{
+    BluetoothGamepadService *pGamepad = getGamepad();
+    return pGamepad->getAnalogAxis(axis);
+}
+
+//%
+bool gamepadProfileLoaded()
+{
+    BluetoothGamepadService *pGamepad = getGamepad();
+    return pGamepad->isProfileLoaded();
+}
+
+//%
+void clearGamepadProfile()
+{
+    BluetoothGamepadService *pGamepad = getGamepad();
+    pGamepad->clearProfile();
+}
+
+//%
+void startGamepadHub(int tx, int rx, int baud)
+{
+    MicroBitPin *txPin = getPin(tx);
+    MicroBitPin *rxPin = getPin(rx);
+    if (txPin == NULL || rxPin == NULL || baud <= 0)
+    {
+        return;
+    }
+    BluetoothGamepadService *pGamepad = getGamepad();
+    pGamepad->startHub(txPin->name, rxPin->name, baud);
+}
+
+//%
+int gamepadHubStat(GamepadHubStat stat)
+{
+    BluetoothGamepadService *pGamepad = getGamepad();
+    return pGamepad->getHubStat(stat);
+}
+
+#if GAMEPAD_HUB_SATELLITE
+/**
+ * The satellite board, when this micro:bit is one: it only talks to the hub, and doesn't start the gamepad service
+ */
+static HubSatellite<GamepadPlayerReport<0>::size> gamepadSatellite;
+#endif
+
+//%
+void startGamepadSatellite(int player, int tx, int rx, int baud)
+{
+#if GAMEPAD_HUB_SATELLITE
+    MicroBitPin *txPin = getPin(tx);
+    MicroBitPin *rxPin = getPin(rx);
+    if (player < 0 || player >= HUB_LINK_MAX_PLAYERS || txPin == NULL || rxPin == NULL || baud <= 0)
+    {
+        return;
+    }
+    gamepadSatellite.start(player, txPin->name, rxPin->name, baud);
+#endif
+}
+
+//%
+void setGamepadSatelliteButtons(int buttons)
+{
+#if GAMEPAD_HUB_SATELLITE
+    if (buttons < 0 || buttons > 255)
+    {
+        return;
+    }
+    uint8_t report[GamepadPlayerReport<0>::size] = {0};
+    gamepadPutButtons<GamepadPlayerReport<0>>(report, buttons);
+    gamepadSatellite.setReport(report);
+#endif
+}
 }
@@ -0,0 +1,403 @@
+#ifndef __GAMEPAD_HOST_HAL_H__
+#define __GAMEPAD_HOST_HAL_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+#include "HostScheduler.h"
+#include "MockBle.h"
+
+/**
+ * GamepadHal.h for the host build: the same names over the simulated clock of HostScheduler,
+ * the mock BLE stack and the simulated board of HostBoard.
+ * Selected with -DGAMEPAD_HAL_HEADER='"GamepadHostHal.h"'.
+ */
+
+// interrupts only run between the steps of the scheduler, never inside the service
+inline void __disable_irq()
+{
+}
+
+inline void __enable_irq()
+{
+}
+
+inline void __DMB()
+{
+    __sync_synchronize();
+}
+
+typedef int PinName;
+static const PinName NC = -1;
+
+#define GAMEPAD_MAXIMUM_BONDS SecurityManager::MAX_BONDS
+#define GAMEPAD_DAL_DEVICE_INFORMATION 0
+#define GAMEPAD_SLEEP_TICK_MS 6
+#ifndef GAMEPAD_GATT_TABLE_SIZE
+#define GAMEPAD_GATT_TABLE_SIZE 0x300
+#endif
+
+typedef HostTimeout GamepadTimeout;
+typedef HostTicker GamepadTicker;
+
+typedef struct
+{
+    uint8_t addr_type;
+    uint8_t addr[6];
+} GamepadPeerAddress;
+
+typedef struct
+{
+    uint16_t source;
+    uint16_t value;
+} GamepadEvent;
+
+extern "C" void SWI3_IRQHandler(void);
+extern "C" void ADC_IRQHandler(void);
+
+/**
+ * The simulated board: what the tests drive and observe besides the BLE link
+ */
+class HostBoard
+{
+  public:
+    static const uint16_t FLASH_PAGES = 256;
+    static const uint16_t FLASH_PAGE_WORDS = 256;
+    static const uint32_t ADC_CONVERSION_US = 68;
+
+    static uint32_t pinLevels;         // levels driven on the pins, where driven
+    static uint32_t drivenPins;
+    static uint32_t pullUps;           // configured pulls of the pins not driven
+    static uint32_t outputs;
+    static uint32_t supplyMillivolts;
+    static uint16_t analogInputs[8];   // 0..1023 per ADC input
+    static int16_t accelerometer[3];   // milli-g
+    static uint16_t accelerometerPeriod;
+    static uint32_t display;           // bit y * 5 + x
+    static uint32_t flash[FLASH_PAGES][FLASH_PAGE_WORDS];
+
+    /**
+     * Queue bytes for gamepadSerialRead()
+     */
+    static void serialInput(const uint8_t *data, uint32_t length);
+
+    /**
+     * Take the bytes sent with gamepadSerialSend()
+     * @return the number of bytes copied
+     */
+    static uint32_t serialOutput(uint8_t *data, uint32_t capacity);
+
+    /**
+     * Receive bytes on the link, from its interrupt
+     */
+    static void linkInput(const uint8_t *data, uint32_t length);
+
+    /**
+     * Take the bytes sent with gamepadLinkPut()
+     * @return the number of bytes copied
+     */
+    static uint32_t linkOutput(uint8_t *data, uint32_t capacity);
+
+    /**
+     * Back the link with a new pseudo-terminal instead of linkInput() and linkOutput(), as one more wire to a peer
+     * process: bytes written go to every terminal of the link, bytes read come from any of them.
+     * From then on the simulated clock is paced to the wall clock, so that the peers keep up with it.
+     * @return the path of the terminal for the peer to open with linkOpenTty(), valid until the next call; NULL if it failed
+     */
+    static const char *linkOpenPty();
+
+    /**
+     * Back the link with a terminal, e.g. the one a hub process opened with linkOpenPty()
+     * @return false if it failed
+     */
+    static bool linkOpenTty(const char *path);
+
+    /**
+     * Forget the storage, the flash, the inputs and the outputs
+     */
+    static void reset();
+
+    static uint8_t adcInput;
+    static HostTimeout adcTimer;
+    static HostCallback<> linkCallback;
+    static HostCallback<> linkTxCallback;
+
+    static bool storageGet(const char *key, void *value, uint8_t size);
+    static void storagePut(const char *key, const void *value, uint8_t size);
+    static bool serialRead(uint8_t &byte);
+    static void serialWrite(const uint8_t *data, uint16_t length);
+    static bool linkRead(uint8_t &byte);
+    static void linkWrite(const uint8_t *data, uint8_t length);
+    static void linkTxEnable(bool enable);
+    static void raiseEvent(uint16_t id, uint16_t value);
+    static void listen(uint16_t id, uint16_t value, const HostCallback<GamepadEvent> &callback);
+    static void onAdcEnd();
+};
+
+inline uint32_t gamepadClockUs()
+{
+    return (uint32_t)HostScheduler::now();
+}
+
+inline uint32_t gamepadClockMs()
+{
+    return (uint32_t)(HostScheduler::now() / 1000);
+}
+
+inline void gamepadReportIrqEnable()
+{
+}
+
+inline void gamepadReportIrqPend()
+{
+    HostScheduler::pend(&SWI3_IRQHandler);
+}
+
+inline bool gamepadTxBufferCount(uint8_t &count)
+{
+    count = BLE::Instance().gattServer().txBuffers;
+    return true;
+}
+
+inline uint32_t gamepadReadPins()
+{
+    return (HostBoard::pinLevels & HostBoard::drivenPins) | (HostBoard::pullUps & ~HostBoard::drivenPins);
+}
+
+inline void gamepadPinInput(uint8_t pin, bool pullUp)
+{
+    if (pullUp)
+    {
+        HostBoard::pullUps |= 1UL << pin;
+    }
+    else
+    {
+        HostBoard::pullUps &= ~(1UL << pin);
+    }
+}
+
+inline void gamepadPinAnalog(uint8_t pin)
+{
+    HostBoard::pullUps &= ~(1UL << pin);
+}
+
+inline void gamepadWritePin(uint8_t pin, bool high)
+{
+    if (high)
+    {
+        HostBoard::outputs |= 1UL << pin;
+    }
+    else
+    {
+        HostBoard::outputs &= ~(1UL << pin);
+    }
+}
+
+inline uint32_t gamepadSupplyVoltage()
+{
+    return HostBoard::supplyMillivolts;
+}
+
+inline uint32_t *gamepadFlashPage(uint16_t fromEnd)
+{
+    return HostBoard::flash[HostBoard::FLASH_PAGES - fromEnd];
+}
+
+inline uint8_t gamepadAnalogInput(uint8_t pin)
+{
+    // the pins of the nRF51: AIN0..1 are P0.26..27, AIN2..7 are P0.01..06
+    if (pin >= 1 && pin <= 6)
+    {
+        return pin + 1;
+    }
+    if (pin == 26 || pin == 27)
+    {
+        return pin - 26;
+    }
+    return 0xff;
+}
+
+inline void gamepadAdcIrqEnable()
+{
+}
+
+struct GamepadAdcConfig
+{
+};
+
+inline void gamepadAdcSave(GamepadAdcConfig &saved)
+{
+}
+
+inline void gamepadAdcStart(uint8_t input)
+{
+    HostBoard::adcInput = input;
+    HostBoard::adcTimer.attach_us(&HostBoard::onAdcEnd, HostBoard::ADC_CONVERSION_US);
+}
+
+inline uint16_t gamepadAdcResult()
+{
+    return HostBoard::analogInputs[HostBoard::adcInput & 7];
+}
+
+inline void gamepadAdcStop(const GamepadAdcConfig &saved)
+{
+    HostBoard::adcTimer.detach();
+}
+
+template <typename T>
+inline void gamepadLinkStart(T *object, void (T::*method)(), PinName tx, PinName rx, uint32_t baud)
+{
+    HostBoard::linkCallback.attach(object, method);
+}
+
+template <typename T>
+inline void gamepadSatelliteLinkStart(T *object, void (T::*method)(), PinName tx, PinName rx, uint32_t baud)
+{
+    HostBoard::linkCallback.attach(object, method);
+}
+
+inline bool gamepadLinkRead(uint8_t &byte)
+{
+    return HostBoard::linkRead(byte);
+}
+
+inline void gamepadLinkTxEnable(bool enable)
+{
+    HostBoard::linkTxEnable(enable);
+}
+
+template <typename T>
+inline void gamepadLinkTxAttach(T *object, void (T::*method)())
+{
+    HostBoard::linkTxCallback.attach(object, method);
+    HostBoard::linkTxEnable(false);
+}
+
+inline void gamepadLinkPut(uint8_t byte)
+{
+    HostBoard::linkWrite(&byte, 1);
+}
+
+inline ble_error_t gamepadGattWrite(BLEDevice &ble, GattAttribute::Handle_t handle, const uint8_t *data, uint16_t length, bool localOnly = false)
+{
+    return ble.gattServer().write(handle, data, length, localOnly);
+}
+
+inline bool gamepadAdvertiseDirected(GamepadPeerAddress &peer)
+{
+    return BLE::Instance().gap().startDirectedAdvertising(peer.addr);
+}
+
+inline bool gamepadServiceChanged(Gap::Handle_t connection)
+{
+    GattServer &server = BLE::Instance().gattServer();
+    if (!server.isConnected)
+    {
+        return false;
+    }
+    server.serviceChangedIndications++;
+    return true;
+}
+
+inline void gamepadRaiseEvent(uint16_t id, uint16_t value)
+{
+    HostBoard::raiseEvent(id, value);
+}
+
+template <typename T>
+inline void gamepadListen(uint16_t id, uint16_t value, T *object, void (T::*method)(GamepadEvent))
+{
+    HostCallback<GamepadEvent> callback;
+    callback.attach(object, method);
+    HostBoard::listen(id, value, callback);
+}
+
+inline void gamepadStartFiber(void (*entry)(void *), void *param)
+{
+    HostScheduler::startFiber(entry, param);
+}
+
+/**
+ * Sleep in whole scheduler ticks, waking on a tick as the DAL does: the first one after now, and after the time
+ */
+inline void gamepadSleep(uint32_t ms)
+{
+    uint64_t tick = GAMEPAD_SLEEP_TICK_MS * 1000ULL;
+    uint64_t now = HostScheduler::now();
+    uint64_t wake = (now + ms * 1000ULL + tick - 1) / tick * tick;
+    HostScheduler::sleepUntil(wake > now ? wake : wake + tick);
+}
+
+/**
+ * Let the other fibers run. Simulated time only moves while every fiber waits, so a yield waits a little.
+ */
+inline void gamepadYield()
+{
+    HostScheduler::sleepUntil(HostScheduler::now() + HostScheduler::YIELD_US);
+}
+
+inline bool gamepadStorageGet(const char *key, void *value, uint8_t size)
+{
+    return HostBoard::storageGet(key, value, size);
+}
+
+inline void gamepadStoragePut(const char *key, const void *value, uint8_t size)
+{
+    HostBoard::storagePut(key, value, size);
+}
+
+inline void gamepadFlashErase(uint32_t *page)
+{
+    memset(page, 0xff, HostBoard::FLASH_PAGE_WORDS * sizeof(uint32_t));
+}
+
+/**
+ * Flash only clears bits
+ */
+inline bool gamepadFlashWrite(uint32_t *address, const void *data, uint32_t length)
+{
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    uint8_t *flash = reinterpret_cast<uint8_t *>(address);
+    for (uint32_t i = 0; i < length; i++)
+    {
+        flash[i] &= bytes[i];
+    }
+    return true;
+}
+
+inline void gamepadDisplayPixel(int16_t x, int16_t y, bool on)
+{
+    uint32_t bit = 1UL << (y * 5 + x);
+    HostBoard::display = on ? HostBoard::display | bit : HostBoard::display & ~bit;
+}
+
+inline void gamepadAccelerometerPeriod(uint16_t period)
+{
+    HostBoard::accelerometerPeriod = period;
+}
+
+inline void gamepadAccelerometerRead(int16_t *sample)
+{
+    memcpy(sample, HostBoard::accelerometer, sizeof(HostBoard::accelerometer));
+}
+
+inline void gamepadSerialSend(const uint8_t *data, uint16_t length)
+{
+    HostBoard::serialWrite(data, length);
+}
+
+/**
+ * Wait for a byte in ticks, as a fiber sleeping on the serial port does
+ */
+inline uint8_t gamepadSerialRead()
+{
+    uint8_t byte;
+    while (!HostBoard::serialRead(byte))
+    {
+        gamepadSleep(GAMEPAD_SLEEP_TICK_MS);
+    }
+    return byte;
+}
+
+#endif /* __GAMEPAD_HOST_HAL_H__ */
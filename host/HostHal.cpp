@@ -0,0 +1,416 @@
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "GamepadHostHal.h"
+
+// the service defines it only when built with analog axes
+extern "C" void ADC_IRQHandler(void) __attribute__((weak));
+
+namespace
+{
+
+const uint8_t STORAGE_KEYS = 8;
+const uint8_t STORAGE_KEY_BYTES = 16;
+const uint8_t STORAGE_VALUE_BYTES = 32;
+const uint8_t LISTENERS = 16;
+const uint8_t EVENTS = 32;
+const uint16_t SERIAL_BYTES = 8192;
+const uint16_t LINK_BYTES = 1024;
+const uint8_t LINK_TTYS = 4;
+const uint32_t LINK_POLL_US = 50; // under half a byte at 115200 baud
+
+struct StoredValue
+{
+    bool used;
+    char key[STORAGE_KEY_BYTES];
+    uint8_t value[STORAGE_VALUE_BYTES];
+};
+
+struct Listener
+{
+    uint16_t id;
+    uint16_t value;
+    HostCallback<GamepadEvent> callback;
+};
+
+/**
+ * A byte queue between the test and the service
+ */
+template <uint16_t SIZE>
+struct ByteQueue
+{
+    uint8_t data[SIZE];
+    uint16_t head;
+    uint16_t count;
+
+    void put(const uint8_t *bytes, uint32_t length)
+    {
+        for (uint32_t i = 0; i < length && count < SIZE; i++)
+        {
+            data[(head + count++) % SIZE] = bytes[i];
+        }
+    }
+
+    bool get(uint8_t &byte)
+    {
+        if (count == 0)
+        {
+            return false;
+        }
+        byte = data[head];
+        head = (head + 1) % SIZE;
+        count--;
+        return true;
+    }
+
+    uint32_t take(uint8_t *bytes, uint32_t capacity)
+    {
+        uint32_t taken = 0;
+        while (taken < capacity && get(bytes[taken]))
+        {
+            taken++;
+        }
+        return taken;
+    }
+};
+
+StoredValue storage[STORAGE_KEYS];
+Listener listeners[LISTENERS];
+uint8_t listenerCount = 0;
+GamepadEvent events[EVENTS];
+uint8_t eventCount = 0;
+ByteQueue<SERIAL_BYTES> serialIn;
+ByteQueue<SERIAL_BYTES> serialOut;
+ByteQueue<LINK_BYTES> linkIn;
+ByteQueue<LINK_BYTES> linkOut;
+
+// the terminals backing the link, and the wall clock the simulated one is paced to while there are any
+int linkTtys[LINK_TTYS];
+uint8_t linkTtyCount = 0;
+HostTicker linkPoller;
+uint64_t paceWallStart = 0;
+uint64_t paceSimulatedStart = 0;
+
+/**
+ * Deliver the raised events. The DAL runs listeners in a fiber; here they run from the scheduler,
+ * after the interrupts, and must not sleep.
+ */
+void dispatchEvents()
+{
+    for (uint8_t i = 0; i < eventCount; i++)
+    {
+        for (uint8_t j = 0; j < listenerCount; j++)
+        {
+            if (listeners[j].id == events[i].source && listeners[j].value == events[i].value)
+            {
+                listeners[j].callback.call(events[i]);
+            }
+        }
+    }
+    eventCount = 0;
+}
+
+void onLinkReceived()
+{
+    HostBoard::linkCallback.call();
+}
+
+// the simulated UART takes each byte at once, so its TX interrupt runs again as long as it is enabled
+bool linkTxIsEnabled = false;
+
+void onLinkTxReady()
+{
+    if (linkTxIsEnabled)
+    {
+        HostBoard::linkTxCallback.call();
+    }
+    if (linkTxIsEnabled)
+    {
+        HostScheduler::pend(&onLinkTxReady);
+    }
+}
+
+void onAdcInterrupt()
+{
+    if (ADC_IRQHandler != NULL)
+    {
+        ADC_IRQHandler();
+    }
+}
+
+uint64_t wallClockUs()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+/**
+ * Wait for the wall clock to catch up with the simulated one, then raise the link interrupt if a terminal has bytes
+ */
+void pollLinkTtys()
+{
+    uint64_t due = paceWallStart + (HostScheduler::now() - paceSimulatedStart);
+    uint64_t wall = wallClockUs();
+    if (wall < due)
+    {
+        usleep(due - wall);
+    }
+
+    pollfd ttys[LINK_TTYS];
+    for (uint8_t i = 0; i < linkTtyCount; i++)
+    {
+        ttys[i].fd = linkTtys[i];
+        ttys[i].events = POLLIN;
+        ttys[i].revents = 0;
+    }
+    if (poll(ttys, linkTtyCount, 0) > 0)
+    {
+        HostScheduler::pend(&onLinkReceived);
+    }
+}
+
+/**
+ * Add a terminal to the link: raw bytes, without blocking
+ */
+bool addLinkTty(int tty)
+{
+    if (tty < 0)
+    {
+        return false;
+    }
+    if (linkTtyCount == LINK_TTYS)
+    {
+        close(tty);
+        return false;
+    }
+    termios settings;
+    if (tcgetattr(tty, &settings) == 0)
+    {
+        cfmakeraw(&settings);
+        tcsetattr(tty, TCSANOW, &settings);
+    }
+    fcntl(tty, F_SETFL, fcntl(tty, F_GETFL) | O_NONBLOCK);
+    linkTtys[linkTtyCount++] = tty;
+
+    if (!linkPoller.isArmed())
+    {
+        paceWallStart = wallClockUs();
+        paceSimulatedStart = HostScheduler::now();
+        linkPoller.attach_us(&pollLinkTtys, LINK_POLL_US);
+    }
+    return true;
+}
+}
+
+uint32_t HostBoard::pinLevels = 0;
+uint32_t HostBoard::drivenPins = 0;
+uint32_t HostBoard::pullUps = 0;
+uint32_t HostBoard::outputs = 0;
+uint32_t HostBoard::supplyMillivolts = 3000;
+uint16_t HostBoard::analogInputs[8] = {512, 512, 512, 512, 512, 512, 512, 512};
+int16_t HostBoard::accelerometer[3] = {0, 0, -1000};
+uint16_t HostBoard::accelerometerPeriod = 0;
+uint32_t HostBoard::display = 0;
+uint32_t HostBoard::flash[HostBoard::FLASH_PAGES][HostBoard::FLASH_PAGE_WORDS];
+uint8_t HostBoard::adcInput = 0;
+
+// flash starts erased
+static struct FlashEraser
+{
+    FlashEraser()
+    {
+        memset(HostBoard::flash, 0xff, sizeof(HostBoard::flash));
+    }
+} flashEraser;
+
+HostTimeout HostBoard::adcTimer;
+HostCallback<> HostBoard::linkCallback;
+HostCallback<> HostBoard::linkTxCallback;
+
+void HostBoard::reset()
+{
+    memset(storage, 0, sizeof(storage));
+    listenerCount = 0;
+    eventCount = 0;
+    serialIn.head = serialIn.count = 0;
+    serialOut.head = serialOut.count = 0;
+    linkIn.head = linkIn.count = 0;
+    linkOut.head = linkOut.count = 0;
+    memset(flash, 0xff, sizeof(flash));
+    pinLevels = 0;
+    drivenPins = 0;
+    pullUps = 0;
+    outputs = 0;
+    display = 0;
+    linkCallback.detach();
+    linkTxCallback.detach();
+    linkTxIsEnabled = false;
+    linkPoller.detach();
+    for (uint8_t i = 0; i < linkTtyCount; i++)
+    {
+        close(linkTtys[i]);
+    }
+    linkTtyCount = 0;
+}
+
+bool HostBoard::storageGet(const char *key, void *value, uint8_t size)
+{
+    for (uint8_t i = 0; i < STORAGE_KEYS; i++)
+    {
+        if (storage[i].used && strncmp(storage[i].key, key, STORAGE_KEY_BYTES) == 0)
+        {
+            memcpy(value, storage[i].value, size < STORAGE_VALUE_BYTES ? size : STORAGE_VALUE_BYTES);
+            return true;
+        }
+    }
+    return false;
+}
+
+void HostBoard::storagePut(const char *key, const void *value, uint8_t size)
+{
+    StoredValue *slot = NULL;
+    for (uint8_t i = 0; i < STORAGE_KEYS && slot == NULL; i++)
+    {
+        if (storage[i].used && strncmp(storage[i].key, key, STORAGE_KEY_BYTES) == 0)
+        {
+            slot = &storage[i];
+        }
+    }
+    for (uint8_t i = 0; i < STORAGE_KEYS && slot == NULL; i++)
+    {
+        if (!storage[i].used)
+        {
+            slot = &storage[i];
+        }
+    }
+    if (slot == NULL)
+    {
+        return;
+    }
+    slot->used = true;
+    strncpy(slot->key, key, STORAGE_KEY_BYTES - 1);
+    memcpy(slot->value, value, size < STORAGE_VALUE_BYTES ? size : STORAGE_VALUE_BYTES);
+}
+
+void HostBoard::serialInput(const uint8_t *data, uint32_t length)
+{
+    serialIn.put(data, length);
+}
+
+uint32_t HostBoard::serialOutput(uint8_t *data, uint32_t capacity)
+{
+    return serialOut.take(data, capacity);
+}
+
+bool HostBoard::serialRead(uint8_t &byte)
+{
+    return serialIn.get(byte);
+}
+
+void HostBoard::serialWrite(const uint8_t *data, uint16_t length)
+{
+    serialOut.put(data, length);
+}
+
+void HostBoard::linkInput(const uint8_t *data, uint32_t length)
+{
+    linkIn.put(data, length);
+    HostScheduler::pend(&onLinkReceived);
+}
+
+uint32_t HostBoard::linkOutput(uint8_t *data, uint32_t capacity)
+{
+    return linkOut.take(data, capacity);
+}
+
+const char *HostBoard::linkOpenPty()
+{
+    int pty = posix_openpt(O_RDWR | O_NOCTTY);
+    if (pty < 0)
+    {
+        return NULL;
+    }
+    const char *path = grantpt(pty) == 0 && unlockpt(pty) == 0 ? ptsname(pty) : NULL;
+    if (path == NULL)
+    {
+        close(pty);
+        return NULL;
+    }
+    return addLinkTty(pty) ? path : NULL;
+}
+
+bool HostBoard::linkOpenTty(const char *path)
+{
+    return addLinkTty(open(path, O_RDWR | O_NOCTTY));
+}
+
+bool HostBoard::linkRead(uint8_t &byte)
+{
+    if (linkTtyCount == 0)
+    {
+        return linkIn.get(byte);
+    }
+    for (uint8_t i = 0; i < linkTtyCount; i++)
+    {
+        if (read(linkTtys[i], &byte, 1) == 1)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void HostBoard::linkWrite(const uint8_t *data, uint8_t length)
+{
+    if (linkTtyCount == 0)
+    {
+        linkOut.put(data, length);
+        return;
+    }
+    // a full terminal loses the bytes, as a line nobody listens to
+    for (uint8_t i = 0; i < linkTtyCount; i++)
+    {
+        ssize_t written = write(linkTtys[i], data, length);
+        (void)written;
+    }
+}
+
+void HostBoard::linkTxEnable(bool enable)
+{
+    linkTxIsEnabled = enable;
+    if (enable)
+    {
+        HostScheduler::pend(&onLinkTxReady);
+    }
+}
+
+void HostBoard::raiseEvent(uint16_t id, uint16_t value)
+{
+    if (eventCount < EVENTS)
+    {
+        events[eventCount].source = id;
+        events[eventCount].value = value;
+        eventCount++;
+    }
+    HostScheduler::pend(&dispatchEvents);
+}
+
+void HostBoard::listen(uint16_t id, uint16_t value, const HostCallback<GamepadEvent> &callback)
+{
+    if (listenerCount < LISTENERS)
+    {
+        listeners[listenerCount].id = id;
+        listeners[listenerCount].value = value;
+        listeners[listenerCount].callback = callback;
+        listenerCount++;
+    }
+}
+
+void HostBoard::onAdcEnd()
+{
+    HostScheduler::pend(&onAdcInterrupt);
+}
@@ -0,0 +1,298 @@
+#include <stdlib.h>
+#include <ucontext.h>
+#include "HostScheduler.h"
+
+namespace
+{
+
+const uint8_t MAX_PENDED = 8;
+const uint8_t MAX_FIBERS = 16;
+const size_t FIBER_STACK_BYTES = 256 * 1024;
+
+enum FiberState
+{
+    FIBER_FREE,
+    FIBER_READY,
+    FIBER_SLEEPING,
+    FIBER_FINISHED
+};
+
+struct HostFiber
+{
+    FiberState state;
+    uint64_t wake;
+    void (*entry)(void *);
+    void *param;
+    ucontext_t context;
+    char *stack;
+};
+
+uint64_t simulatedTime = 0;
+uint64_t timerOrder = 0;
+HostTimer *timers = NULL;
+
+void (*pended[MAX_PENDED])();
+uint8_t pendedCount = 0;
+
+HostFiber fibers[MAX_FIBERS];
+int8_t currentFiber = -1;
+ucontext_t schedulerContext;
+
+void fiberMain(int index)
+{
+    fibers[index].entry(fibers[index].param);
+    fibers[index].state = FIBER_FINISHED;
+    // returns to schedulerContext through uc_link
+}
+
+/**
+ * Switch to a fiber until it sleeps or returns
+ */
+void resume(int8_t index)
+{
+    HostFiber &fiber = fibers[index];
+    fiber.state = FIBER_READY;
+    currentFiber = index;
+    swapcontext(&schedulerContext, &fiber.context);
+    currentFiber = -1;
+    if (fiber.state == FIBER_FINISHED)
+    {
+        free(fiber.stack);
+        fiber.stack = NULL;
+        fiber.state = FIBER_FREE;
+    }
+}
+}
+
+HostTimer::HostTimer(bool periodic) : periodic(periodic), armed(false), period(0), deadline(0), order(0), next(NULL)
+{
+}
+
+HostTimer::~HostTimer()
+{
+    detach();
+}
+
+void HostTimer::arm(uint32_t delay)
+{
+    if (!armed)
+    {
+        HostScheduler::add(this);
+    }
+    armed = true;
+    period = periodic && delay == 0 ? 1 : delay;
+    deadline = simulatedTime + delay;
+    order = ++timerOrder;
+}
+
+void HostTimer::detach()
+{
+    if (armed)
+    {
+        HostScheduler::remove(this);
+    }
+    armed = false;
+    callback.detach();
+}
+
+void HostScheduler::add(HostTimer *timer)
+{
+    timer->next = timers;
+    timers = timer;
+}
+
+void HostScheduler::remove(HostTimer *timer)
+{
+    for (HostTimer **link = &timers; *link != NULL; link = &(*link)->next)
+    {
+        if (*link == timer)
+        {
+            *link = timer->next;
+            timer->next = NULL;
+            return;
+        }
+    }
+}
+
+uint64_t HostScheduler::now()
+{
+    return simulatedTime;
+}
+
+void HostScheduler::pend(void (*handler)())
+{
+    for (uint8_t i = 0; i < pendedCount; i++)
+    {
+        if (pended[i] == handler)
+        {
+            return;
+        }
+    }
+    if (pendedCount < MAX_PENDED)
+    {
+        pended[pendedCount++] = handler;
+    }
+}
+
+void HostScheduler::startFiber(void (*entry)(void *), void *param)
+{
+    for (int8_t i = 0; i < MAX_FIBERS; i++)
+    {
+        HostFiber &fiber = fibers[i];
+        if (fiber.state != FIBER_FREE)
+        {
+            continue;
+        }
+        fiber.entry = entry;
+        fiber.param = param;
+        fiber.wake = simulatedTime;
+        fiber.stack = static_cast<char *>(malloc(FIBER_STACK_BYTES));
+        getcontext(&fiber.context);
+        fiber.context.uc_stack.ss_sp = fiber.stack;
+        fiber.context.uc_stack.ss_size = FIBER_STACK_BYTES;
+        fiber.context.uc_link = &schedulerContext;
+        makecontext(&fiber.context, reinterpret_cast<void (*)()>(&fiberMain), 1, (int)i);
+        fiber.state = FIBER_SLEEPING;
+        return;
+    }
+    abort();
+}
+
+void HostScheduler::sleepUntil(uint64_t time)
+{
+    if (currentFiber < 0)
+    {
+        runUntil(time);
+        return;
+    }
+    HostFiber &fiber = fibers[currentFiber];
+    fiber.wake = time;
+    fiber.state = FIBER_SLEEPING;
+    swapcontext(&fiber.context, &schedulerContext);
+}
+
+bool HostScheduler::inFiber()
+{
+    return currentFiber >= 0;
+}
+
+void HostScheduler::runPending()
+{
+    bool progress = true;
+    while (progress)
+    {
+        progress = false;
+        while (pendedCount > 0)
+        {
+            void (*handler)() = pended[0];
+            pendedCount--;
+            memmove(pended, pended + 1, pendedCount * sizeof(pended[0]));
+            handler();
+            progress = true;
+        }
+        for (int8_t i = 0; i < MAX_FIBERS; i++)
+        {
+            if (fibers[i].state == FIBER_SLEEPING && fibers[i].wake <= simulatedTime)
+            {
+                resume(i);
+                progress = true;
+                // interrupts pended by the fiber go first
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * Fire the earliest timer, or wake the earliest fiber, due by `limit`
+ * @return false if nothing is due
+ */
+bool HostScheduler::runDue(uint64_t limit)
+{
+    HostTimer *first = NULL;
+    for (HostTimer *timer = timers; timer != NULL; timer = timer->next)
+    {
+        if (timer->deadline <= limit &&
+            (first == NULL || timer->deadline < first->deadline ||
+             (timer->deadline == first->deadline && timer->order < first->order)))
+        {
+            first = timer;
+        }
+    }
+    uint64_t wake = limit + 1;
+    for (uint8_t i = 0; i < MAX_FIBERS; i++)
+    {
+        if (fibers[i].state == FIBER_SLEEPING && fibers[i].wake < wake)
+        {
+            wake = fibers[i].wake;
+        }
+    }
+
+    // timers first: they are interrupts
+    if (first != NULL && first->deadline <= wake)
+    {
+        if (first->deadline > simulatedTime)
+        {
+            simulatedTime = first->deadline;
+        }
+        if (first->periodic)
+        {
+            first->deadline += first->period;
+            first->order = ++timerOrder;
+        }
+        else
+        {
+            first->armed = false;
+            remove(first);
+        }
+        first->callback.call();
+        return true;
+    }
+    if (wake <= limit)
+    {
+        if (wake > simulatedTime)
+        {
+            simulatedTime = wake;
+        }
+        return true;
+    }
+    return false;
+}
+
+void HostScheduler::runUntil(uint64_t time)
+{
+    runPending();
+    while (runDue(time))
+    {
+        runPending();
+    }
+    if (time > simulatedTime)
+    {
+        simulatedTime = time;
+    }
+    runPending();
+}
+
+void HostScheduler::run(uint64_t duration)
+{
+    runUntil(simulatedTime + duration);
+}
+
+void HostScheduler::reset()
+{
+    while (timers != NULL)
+    {
+        HostTimer *timer = timers;
+        timers = timer->next;
+        timer->armed = false;
+        timer->next = NULL;
+    }
+    pendedCount = 0;
+    for (uint8_t i = 0; i < MAX_FIBERS; i++)
+    {
+        free(fibers[i].stack);
+        fibers[i].stack = NULL;
+        fibers[i].state = FIBER_FREE;
+    }
+    simulatedTime = 0;
+}
@@ -0,0 +1,209 @@
+#ifndef __HOST_SCHEDULER_H__
+#define __HOST_SCHEDULER_H__
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * A callback to a method or a function, stored without allocating, so that arming a timer
+ * in the report path costs the same on the host as on the device.
+ */
+template <typename... Args>
+class HostCallback
+{
+  public:
+    HostCallback() : object(NULL), thunk(NULL)
+    {
+    }
+
+    template <typename T>
+    void attach(T *target, void (T::*method)(Args...))
+    {
+        static_assert(sizeof(method) <= sizeof(storage), "HostCallback can not store this method");
+        object = target;
+        memcpy(storage, &method, sizeof(method));
+        thunk = &callMethod<T>;
+    }
+
+    void attach(void (*function)(Args...))
+    {
+        object = NULL;
+        memcpy(storage, &function, sizeof(function));
+        thunk = function != NULL ? &callFunction : NULL;
+    }
+
+    void detach()
+    {
+        thunk = NULL;
+    }
+
+    bool isAttached() const
+    {
+        return thunk != NULL;
+    }
+
+    void call(Args... args) const
+    {
+        if (thunk != NULL)
+        {
+            thunk(object, storage, args...);
+        }
+    }
+
+  private:
+    template <typename T>
+    static void callMethod(void *target, const unsigned char *stored, Args... args)
+    {
+        void (T::*method)(Args...);
+        memcpy(&method, stored, sizeof(method));
+        (static_cast<T *>(target)->*method)(args...);
+    }
+
+    static void callFunction(void *, const unsigned char *stored, Args... args)
+    {
+        void (*function)(Args...);
+        memcpy(&function, stored, sizeof(function));
+        function(args...);
+    }
+
+    void *object;
+    void (*thunk)(void *, const unsigned char *, Args...);
+    alignas(void *) unsigned char storage[2 * sizeof(void *)];
+};
+
+/**
+ * A timer of the simulated clock, calling back from the scheduler as an interrupt would.
+ * Timers due at the same time fire in the order they were armed.
+ */
+class HostTimer
+{
+  public:
+    explicit HostTimer(bool periodic);
+    ~HostTimer();
+
+    template <typename T>
+    void attach_us(T *object, void (T::*method)(), uint32_t delay)
+    {
+        callback.attach(object, method);
+        arm(delay);
+    }
+
+    void attach_us(void (*function)(), uint32_t delay)
+    {
+        callback.attach(function);
+        arm(delay);
+    }
+
+    void detach();
+
+    bool isArmed() const
+    {
+        return armed;
+    }
+
+  private:
+    friend class HostScheduler;
+
+    void arm(uint32_t delay);
+
+    bool periodic;
+    bool armed;
+    uint32_t period;
+    uint64_t deadline;
+    uint64_t order;
+    HostCallback<> callback;
+    HostTimer *next;
+};
+
+/**
+ * One-shot timer: `attach_us(object, method, delay)`, `detach()`
+ */
+class HostTimeout : public HostTimer
+{
+  public:
+    HostTimeout() : HostTimer(false)
+    {
+    }
+};
+
+/**
+ * Periodic timer: `attach_us(object, method, period)`, `detach()`
+ */
+class HostTicker : public HostTimer
+{
+  public:
+    HostTicker() : HostTimer(true)
+    {
+    }
+};
+
+/**
+ * The discrete-event core of the host build: a simulated microsecond clock, the timers,
+ * the pended interrupts and cooperative fibers.
+ *
+ * Nothing runs concurrently: time only advances in run(), which fires the timers in time order.
+ * After each of them, the pended interrupts run, then the fibers that are due, until none is left.
+ * The calling code is the main fiber: it sets inputs between calls to run().
+ */
+class HostScheduler
+{
+  public:
+    /**
+     * Time a yielding fiber waits(microseconds): the cost of a context switch and the other fibers
+     */
+    static const uint32_t YIELD_US = 20;
+
+    /**
+     * Simulated time since the start(microseconds)
+     */
+    static uint64_t now();
+
+    /**
+     * Advance the simulated time to `time`, running everything due until then
+     */
+    static void runUntil(uint64_t time);
+
+    /**
+     * Advance the simulated time by `duration`(microseconds)
+     */
+    static void run(uint64_t duration);
+
+    /**
+     * Run the pended interrupts, the message bus events and the due fibers, without advancing the time
+     */
+    static void runPending();
+
+    /**
+     * Pend an interrupt handler: it runs once, before the time advances, however many times it is pended
+     */
+    static void pend(void (*handler)());
+
+    /**
+     * Start a fiber. It runs from the next call to the scheduler.
+     */
+    static void startFiber(void (*entry)(void *), void *param);
+
+    /**
+     * Sleep the calling fiber until `time`. From the main fiber, run the scheduler until then.
+     */
+    static void sleepUntil(uint64_t time);
+
+    /**
+     * @return true if called from a fiber started by startFiber()
+     */
+    static bool inFiber();
+
+    /**
+     * Forget the timers, the pended interrupts and the fibers, and restart the clock at 0
+     */
+    static void reset();
+
+  private:
+    friend class HostTimer;
+
+    static void add(HostTimer *timer);
+    static void remove(HostTimer *timer);
+    static bool runDue(uint64_t limit);
+};
+
+#endif /* __HOST_SCHEDULER_H__ */
@@ -0,0 +1,520 @@
+#include "MockBle.h"
+
+BLE &BLE::Instance()
+{
+    static BLE instance;
+    return instance;
+}
+
+Gap::Gap()
+    : isAdvertising(false), isDirected(false), advertisingType(GapAdvertisingParams::ADV_CONNECTABLE_UNDIRECTED),
+      advertisingInterval(0), advertisingTimeout(0), advertisingPolicy(ADV_POLICY_IGNORE_WHITELIST), whitelistSize(0),
+      advertisingStarts(0), advertisingPayloadLength(0), connectionParamsRequests(0), radioNotificationIsEnabled(false)
+{
+    memset(advertisingPayload, 0, sizeof(advertisingPayload));
+    memset(&preferredConnectionParams, 0, sizeof(preferredConnectionParams));
+    memset(&requestedConnectionParams, 0, sizeof(requestedConnectionParams));
+}
+
+ble_error_t Gap::stopAdvertising()
+{
+    isAdvertising = false;
+    isDirected = false;
+    advertisingTimer.detach();
+    return BLE_ERROR_NONE;
+}
+
+ble_error_t Gap::startAdvertising()
+{
+    if (BLE::Instance().gattServer().isConnected)
+    {
+        return BLE_ERROR_INVALID_STATE;
+    }
+    isAdvertising = true;
+    isDirected = false;
+    advertisingStarts++;
+    if (advertisingTimeout != 0)
+    {
+        advertisingTimer.attach_us(this, &Gap::onAdvertisingTimeout, advertisingTimeout * 1000000UL);
+    }
+    else
+    {
+        advertisingTimer.detach();
+    }
+    return BLE_ERROR_NONE;
+}
+
+bool Gap::startDirectedAdvertising(const uint8_t *peer)
+{
+    if (BLE::Instance().gattServer().isConnected)
+    {
+        return false;
+    }
+    isAdvertising = true;
+    isDirected = true;
+    advertisingStarts++;
+    // high duty cycle directed advertising lasts 1.28 seconds
+    advertisingTimer.attach_us(this, &Gap::onAdvertisingTimeout, 1280000UL);
+    return true;
+}
+
+void Gap::onAdvertisingTimeout()
+{
+    isAdvertising = false;
+    isDirected = false;
+    timeoutCallback.call(TIMEOUT_SRC_ADVERTISING);
+}
+
+void Gap::clearAdvertisingPayload()
+{
+    advertisingPayloadLength = 0;
+}
+
+ble_error_t Gap::accumulateAdvertisingPayload(uint8_t flags)
+{
+    return accumulateAdvertisingPayload((GapAdvertisingData::DataType_t)0x01, &flags, 1);
+}
+
+ble_error_t Gap::accumulateAdvertisingPayload(GapAdvertisingData::Appearance_t appearance)
+{
+    uint8_t value[] = {(uint8_t)appearance, (uint8_t)(appearance >> 8)};
+    return accumulateAdvertisingPayload((GapAdvertisingData::DataType_t)0x19, value, sizeof(value));
+}
+
+ble_error_t Gap::accumulateAdvertisingPayload(GapAdvertisingData::DataType_t type, const uint8_t *data, uint8_t length)
+{
+    if (advertisingPayloadLength + 2U + length > sizeof(advertisingPayload))
+    {
+        return BLE_ERROR_BUFFER_OVERFLOW;
+    }
+    advertisingPayload[advertisingPayloadLength++] = length + 1;
+    advertisingPayload[advertisingPayloadLength++] = (uint8_t)type;
+    memcpy(advertisingPayload + advertisingPayloadLength, data, length);
+    advertisingPayloadLength += length;
+    return BLE_ERROR_NONE;
+}
+
+void Gap::setAdvertisingType(GapAdvertisingParams::AdvertisingType_t type)
+{
+    advertisingType = type;
+}
+
+void Gap::setAdvertisingInterval(uint16_t interval)
+{
+    advertisingInterval = interval;
+}
+
+void Gap::setAdvertisingTimeout(uint16_t timeout)
+{
+    advertisingTimeout = timeout;
+}
+
+ble_error_t Gap::setAdvertisingPolicyMode(AdvertisingPolicyMode_t mode)
+{
+    advertisingPolicy = mode;
+    return BLE_ERROR_NONE;
+}
+
+ble_error_t Gap::setWhitelist(const Whitelist_t &whitelist)
+{
+    whitelistSize = whitelist.size;
+    return BLE_ERROR_NONE;
+}
+
+ble_error_t Gap::setPreferredConnectionParams(const ConnectionParams_t *params)
+{
+    preferredConnectionParams = *params;
+    return BLE_ERROR_NONE;
+}
+
+ble_error_t Gap::updateConnectionParams(Handle_t handle, const ConnectionParams_t *params)
+{
+    if (!BLE::Instance().gattServer().isConnected)
+    {
+        return BLE_ERROR_INVALID_STATE;
+    }
+    requestedConnectionParams = *params;
+    connectionParamsRequests++;
+    return BLE_ERROR_NONE;
+}
+
+ble_error_t Gap::initRadioNotification()
+{
+    radioNotificationIsEnabled = true;
+    return BLE_ERROR_NONE;
+}
+
+ble_error_t Gap::disconnect(Handle_t handle, DisconnectionReason_t reason)
+{
+    return BLE_ERROR_NOT_IMPLEMENTED;
+}
+
+ble_error_t SecurityManager::getAddressesFromBondTable(Gap::Whitelist_t &addresses) const
+{
+    addresses.size = 0;
+    for (uint8_t i = 0; i < bondCount && addresses.size < addresses.capacity; i++)
+    {
+        addresses.addresses[addresses.size++] = bonds[i];
+    }
+    return BLE_ERROR_NONE;
+}
+
+void SecurityManager::addBond(const uint8_t *address)
+{
+    for (uint8_t i = 0; i < bondCount; i++)
+    {
+        if (memcmp(bonds[i].address, address, sizeof(bonds[i].address)) == 0)
+        {
+            return;
+        }
+    }
+    // the oldest bond makes room, as in the DAL
+    if (bondCount == MAX_BONDS)
+    {
+        memmove(bonds, bonds + 1, (MAX_BONDS - 1) * sizeof(bonds[0]));
+        bondCount--;
+    }
+    bonds[bondCount].type = BLEProtocol::ADDR_TYPE_PUBLIC;
+    memcpy(bonds[bondCount].address, address, sizeof(bonds[bondCount].address));
+    bondCount++;
+}
+
+GattServer::GattServer()
+    : txBuffers(7), txQueued(0), txHead(0), isConnected(false), connectionHandle(0), writes(0), rejectedWrites(0),
+      serviceChangedIndications(0), attributeCount(0), nextHandle(1)
+{
+}
+
+GattServer::Attribute *GattServer::find(GattAttribute::Handle_t handle)
+{
+    for (uint16_t i = 0; i < attributeCount; i++)
+    {
+        if (attributes[i].handle == handle)
+        {
+            return &attributes[i];
+        }
+    }
+    return NULL;
+}
+
+const GattServer::Attribute *GattServer::find(GattAttribute::Handle_t handle) const
+{
+    return const_cast<GattServer *>(this)->find(handle);
+}
+
+void GattServer::addAttribute(GattAttribute &attribute, uint8_t properties)
+{
+    attribute.setHandle(nextHandle++);
+    if (attributeCount == MAX_ATTRIBUTES)
+    {
+        return;
+    }
+    Attribute &stored = attributes[attributeCount++];
+    stored.handle = attribute.getHandle();
+    stored.properties = properties;
+    stored.length = attribute.getLength() < MAX_VALUE_BYTES ? attribute.getLength() : MAX_VALUE_BYTES;
+    memset(stored.value, 0, sizeof(stored.value));
+    if (attribute.getValuePtr() != NULL)
+    {
+        memcpy(stored.value, attribute.getValuePtr(), stored.length);
+    }
+}
+
+/**
+ * Assign handles in the order of the SoftDevice: the service declaration, then for each characteristic
+ * its declaration, its value, its Client Characteristic Configuration if it notifies, and its descriptors
+ */
+ble_error_t GattServer::addService(GattService &service)
+{
+    service.setHandle(nextHandle++);
+    for (uint8_t i = 0; i < service.getCharacteristicCount(); i++)
+    {
+        GattCharacteristic *characteristic = service.getCharacteristic(i);
+        nextHandle++;
+        addAttribute(characteristic->getValueAttribute(), characteristic->getProperties());
+        if (characteristic->getProperties() & (GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_INDICATE))
+        {
+            nextHandle++;
+        }
+        for (uint8_t j = 0; j < characteristic->getDescriptorCount(); j++)
+        {
+            addAttribute(*characteristic->getDescriptor(j), GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ);
+        }
+    }
+    return BLE_ERROR_NONE;
+}
+
+ble_error_t GattServer::write(GattAttribute::Handle_t handle, const uint8_t *data, uint16_t length, bool localOnly)
+{
+    Attribute *attribute = find(handle);
+    if (attribute == NULL)
+    {
+        return BLE_ERROR_INVALID_PARAM;
+    }
+    attribute->length = length < MAX_VALUE_BYTES ? length : MAX_VALUE_BYTES;
+    memcpy(attribute->value, data, attribute->length);
+    if (localOnly)
+    {
+        return BLE_ERROR_NONE;
+    }
+
+    // the host subscribes to every notifying characteristic
+    if (!isConnected || !(attribute->properties & GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY))
+    {
+        return BLE_ERROR_INVALID_STATE;
+    }
+    if (txQueued >= txBuffers || txQueued >= MAX_TX_BUFFERS)
+    {
+        rejectedWrites++;
+        return BLE_STACK_BUSY;
+    }
+    MockNotification &notification = txQueue[(txHead + txQueued) % MAX_TX_BUFFERS];
+    notification.handle = handle;
+    notification.length = length < sizeof(notification.data) ? length : sizeof(notification.data);
+    memcpy(notification.data, data, notification.length);
+    notification.queuedTime = HostScheduler::now();
+    notification.sentTime = 0;
+    txQueued++;
+    writes++;
+    return BLE_ERROR_NONE;
+}
+
+ble_error_t GattServer::read(GattAttribute::Handle_t handle, uint8_t *data, uint16_t *length)
+{
+    Attribute *attribute = find(handle);
+    if (attribute == NULL)
+    {
+        return BLE_ERROR_INVALID_PARAM;
+    }
+    uint16_t copied = *length < attribute->length ? *length : attribute->length;
+    memcpy(data, attribute->value, copied);
+    *length = copied;
+    return BLE_ERROR_NONE;
+}
+
+uint8_t GattServer::getProperties(GattAttribute::Handle_t handle) const
+{
+    const Attribute *attribute = find(handle);
+    return attribute != NULL ? attribute->properties : 0;
+}
+
+namespace
+{
+
+// the air time of the link layer at 1 Mbps, as the nRF51 radio spends it
+const uint32_t RADIO_RAMP_UP_US = 140;
+const uint32_t INTER_FRAME_US = 150;
+const uint8_t NOTIFICATION_HEADER_BYTES = 7;    // L2CAP length and channel, ATT opcode and handle
+
+/**
+ * Air time of a link layer packet: preamble, access address, header, payload and CRC
+ */
+uint32_t packetUs(uint8_t payload)
+{
+    return (1 + 4 + 2 + payload + 3) * 8;
+}
+}
+
+MockCentral::MockCentral(BLE &ble)
+    : packetsPerEvent(6), radioNotificationLeadUs(800), connectionEvents(0), skippedEvents(0), notificationsReceived(0),
+      packetsLost(0), radioOnUs(0), ble(ble), connected(false), interval(6), slaveLatency(0), latencyCount(0),
+      lossPerMille(0), lossState(1), anchor(0), lastRequests(0), observer(NULL), observerContext(NULL)
+{
+    memset(address, 0, sizeof(address));
+}
+
+void MockCentral::setPacketLoss(uint16_t perMille, uint32_t seed)
+{
+    lossPerMille = perMille;
+    lossState = seed != 0 ? seed : 1;
+}
+
+void MockCentral::setObserver(void (*newObserver)(const MockNotification &, void *), void *context)
+{
+    observer = newObserver;
+    observerContext = context;
+}
+
+void MockCentral::connect(const uint8_t *peer, uint16_t newInterval)
+{
+    memcpy(address, peer, sizeof(address));
+    interval = newInterval;
+    slaveLatency = 0;
+    latencyCount = 0;
+    connected = true;
+    ble.gap().stopAdvertising();
+    GattServer &server = ble.gattServer();
+    server.isConnected = true;
+    server.connectionHandle++;
+    server.txQueued = 0;
+
+    Gap::ConnectionParams_t params = {interval, interval, 0, 3200};
+    Gap::ConnectionCallbackParams_t callbackParams;
+    memset(&callbackParams, 0, sizeof(callbackParams));
+    callbackParams.handle = server.connectionHandle;
+    callbackParams.role = Gap::PERIPHERAL;
+    callbackParams.peerAddrType = BLEProtocol::ADDR_TYPE_PUBLIC;
+    memcpy(callbackParams.peerAddr, address, sizeof(address));
+    callbackParams.connectionParams = &params;
+    lastRequests = ble.gap().connectionParamsRequests;
+
+    anchor = HostScheduler::now();
+    scheduleEvents();
+    ble.gap().connectionCallback.call(&callbackParams);
+}
+
+void MockCentral::disconnect()
+{
+    if (!connected)
+    {
+        return;
+    }
+    connected = false;
+    radioTimer.detach();
+    eventTimer.detach();
+    GattServer &server = ble.gattServer();
+    server.isConnected = false;
+    server.txQueued = 0;
+
+    Gap::DisconnectionCallbackParams_t params = {server.connectionHandle, Gap::REMOTE_USER_TERMINATED_CONNECTION};
+    ble.gap().disconnectionCallback.call(&params);
+}
+
+void MockCentral::secure(bool bond)
+{
+    if (bond)
+    {
+        ble.securityManager().addBond(address);
+    }
+    ble.securityManager().linkSecuredCallback.call(ble.gattServer().connectionHandle, SecurityManager::SECURITY_MODE_ENCRYPTION_NO_MITM);
+}
+
+void MockCentral::write(GattAttribute::Handle_t handle, const uint8_t *data, uint16_t length)
+{
+    GattWriteCallbackParams params;
+    params.connHandle = ble.gattServer().connectionHandle;
+    params.handle = handle;
+    params.writeOp = GattWriteCallbackParams::OP_WRITE_CMD;
+    params.offset = 0;
+    params.len = length;
+    params.data = data;
+    ble.gattServer().dataWrittenCallback.call(&params);
+}
+
+/**
+ * A parameters request takes effect at the next event
+ */
+void MockCentral::applyRequest()
+{
+    if (ble.gap().connectionParamsRequests != lastRequests)
+    {
+        lastRequests = ble.gap().connectionParamsRequests;
+        interval = ble.gap().requestedConnectionParams.minConnectionInterval;
+        slaveLatency = ble.gap().requestedConnectionParams.slaveLatency;
+    }
+}
+
+/**
+ * Arm the radio notification and the next connection event, one interval after the anchor
+ */
+void MockCentral::scheduleEvents()
+{
+    anchor += interval * 1250UL;
+    uint64_t now = HostScheduler::now();
+    if (ble.gap().radioNotificationIsEnabled && anchor - radioNotificationLeadUs > now)
+    {
+        radioTimer.attach_us(this, &MockCentral::onRadioNotification, (uint32_t)(anchor - radioNotificationLeadUs - now));
+    }
+    eventTimer.attach_us(this, &MockCentral::onConnectionEvent, (uint32_t)(anchor - now));
+}
+
+/**
+ * The peripheral sleeps through the event if it has nothing queued, and slave latency allows one more
+ */
+bool MockCentral::isSkipping()
+{
+    return ble.gattServer().txQueued == 0 && latencyCount < slaveLatency;
+}
+
+/**
+ * xorshift32: the same losses on every run
+ */
+bool MockCentral::isLost()
+{
+    if (lossPerMille == 0)
+    {
+        return false;
+    }
+    lossState ^= lossState << 13;
+    lossState ^= lossState >> 17;
+    lossState ^= lossState << 5;
+    return lossState % 1000 < lossPerMille;
+}
+
+void MockCentral::onRadioNotification()
+{
+    // the SoftDevice only signals the events it wakes up for
+    if (!isSkipping())
+    {
+        ble.gap().radioNotificationCallback.call(true);
+    }
+}
+
+void MockCentral::onConnectionEvent()
+{
+    GattServer &server = ble.gattServer();
+    if (isSkipping())
+    {
+        latencyCount++;
+        skippedEvents++;
+        applyRequest();
+        scheduleEvents();
+        return;
+    }
+    latencyCount = 0;
+    connectionEvents++;
+    radioOnUs += RADIO_RAMP_UP_US;
+
+    uint8_t sent = 0;
+    uint8_t exchanges = 0;
+    bool lost = false;
+    while (server.txQueued > 0 && exchanges < packetsPerEvent && !lost)
+    {
+        MockNotification &notification = server.txQueue[server.txHead];
+        exchanges++;
+        radioOnUs += packetUs(0) + packetUs(NOTIFICATION_HEADER_BYTES + notification.length) + 2 * INTER_FRAME_US;
+        if (isLost())
+        {
+            // not acknowledged: the event ends, and the packet goes again at the next one
+            packetsLost++;
+            lost = true;
+            continue;
+        }
+        notification.sentTime = HostScheduler::now();
+        server.txHead = (server.txHead + 1) % GattServer::MAX_TX_BUFFERS;
+        server.txQueued--;
+        sent++;
+        notificationsReceived++;
+        if (observer != NULL)
+        {
+            observer(notification, observerContext);
+        }
+    }
+    if (exchanges == 0)
+    {
+        // an empty packet answers the host's
+        radioOnUs += 2 * packetUs(0) + 2 * INTER_FRAME_US;
+    }
+
+    applyRequest();
+    scheduleEvents();
+
+    if (ble.gap().radioNotificationIsEnabled)
+    {
+        ble.gap().radioNotificationCallback.call(false);
+    }
+    if (sent > 0)
+    {
+        server.dataSentCallback.call(sent);
+    }
+}
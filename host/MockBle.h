@@ -0,0 +1,723 @@
+#ifndef __MOCK_BLE_H__
+#define __MOCK_BLE_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+#include "HostScheduler.h"
+
+/**
+ * The subset of mbed BLE_API the services use, over a simulated SoftDevice:
+ * an attribute table, the TX buffers of the notifications, and a link to a simulated host(MockCentral).
+ *
+ * Names and signatures follow BLE_API, so the services compile unchanged. Every notification is
+ * recorded with the time it was queued and the time it reached the host.
+ */
+
+enum ble_error_t
+{
+    BLE_ERROR_NONE = 0,
+    BLE_ERROR_BUFFER_OVERFLOW = 1,
+    BLE_ERROR_NOT_IMPLEMENTED = 2,
+    BLE_ERROR_PARAM_OUT_OF_RANGE = 3,
+    BLE_ERROR_INVALID_PARAM = 4,
+    BLE_STACK_BUSY = 5,
+    BLE_ERROR_INVALID_STATE = 6,
+    BLE_ERROR_NO_MEM = 7,
+    BLE_ERROR_OPERATION_NOT_PERMITTED = 8,
+    BLE_ERROR_INITIALIZATION_INCOMPLETE = 9,
+    BLE_ERROR_ALREADY_INITIALIZED = 10,
+    BLE_ERROR_UNSPECIFIED = 11
+};
+
+class UUID
+{
+  public:
+    typedef uint16_t ShortUUIDBytes_t;
+
+    UUID(ShortUUIDBytes_t uuid) : shortUUID(uuid)
+    {
+        memset(longUUID, 0, sizeof(longUUID));
+    }
+
+    /**
+     * @param string "XXXXXXXX-XXXX-XXXX-XXXX-XXXXXXXXXXXX"
+     */
+    UUID(const char *string) : shortUUID(0)
+    {
+        memset(longUUID, 0, sizeof(longUUID));
+        uint8_t nibbles = 0;
+        for (const char *c = string; *c != '\0' && nibbles < 32; c++)
+        {
+            int value = *c >= '0' && *c <= '9' ? *c - '0' : *c >= 'a' && *c <= 'f' ? *c - 'a' + 10 : *c >= 'A' && *c <= 'F' ? *c - 'A' + 10 : -1;
+            if (value >= 0)
+            {
+                longUUID[nibbles / 2] |= value << (nibbles % 2 ? 0 : 4);
+                nibbles++;
+            }
+        }
+    }
+
+    ShortUUIDBytes_t getShortUUID() const
+    {
+        return shortUUID;
+    }
+
+  private:
+    ShortUUIDBytes_t shortUUID;
+    uint8_t longUUID[16];
+};
+
+class GattAttribute
+{
+  public:
+    typedef uint16_t Handle_t;
+
+    GattAttribute(const UUID &uuid, uint8_t *valuePtr = NULL, uint16_t length = 0, uint16_t maxLength = 0, bool hasVariableLength = true)
+        : uuid(uuid), valuePtr(valuePtr), length(length), maxLength(maxLength), handle(0)
+    {
+    }
+
+    Handle_t getHandle() const
+    {
+        return handle;
+    }
+
+    void setHandle(Handle_t newHandle)
+    {
+        handle = newHandle;
+    }
+
+    const UUID &getUUID() const
+    {
+        return uuid;
+    }
+
+    uint8_t *getValuePtr() const
+    {
+        return valuePtr;
+    }
+
+    uint16_t getLength() const
+    {
+        return length;
+    }
+
+    uint16_t getMaxLength() const
+    {
+        return maxLength;
+    }
+
+  private:
+    UUID uuid;
+    uint8_t *valuePtr;
+    uint16_t length;
+    uint16_t maxLength;
+    Handle_t handle;
+};
+
+namespace BLEProtocol
+{
+enum AddressType_t
+{
+    ADDR_TYPE_PUBLIC = 0,
+    ADDR_TYPE_RANDOM_STATIC
+};
+
+struct Address_t
+{
+    AddressType_t type;
+    uint8_t address[6];
+};
+}
+
+class GapAdvertisingData
+{
+  public:
+    enum Flags_t
+    {
+        LE_LIMITED_DISCOVERABLE = 0x01,
+        LE_GENERAL_DISCOVERABLE = 0x02,
+        BREDR_NOT_SUPPORTED = 0x04
+    };
+
+    enum DataType_t
+    {
+        COMPLETE_LIST_16BIT_SERVICE_IDS = 0x03
+    };
+
+    enum Appearance_t
+    {
+        GAMEPAD = 964
+    };
+};
+
+class GapAdvertisingParams
+{
+  public:
+    enum AdvertisingType_t
+    {
+        ADV_CONNECTABLE_UNDIRECTED,
+        ADV_CONNECTABLE_DIRECTED,
+        ADV_SCANNABLE_UNDIRECTED,
+        ADV_NON_CONNECTABLE_UNDIRECTED
+    };
+};
+
+class Gap
+{
+  public:
+    typedef uint16_t Handle_t;
+    typedef BLEProtocol::AddressType_t AddressType_t;
+    typedef uint8_t Address_t[6];
+
+    enum Role_t
+    {
+        PERIPHERAL = 0,
+        CENTRAL
+    };
+
+    enum AdvertisingPolicyMode_t
+    {
+        ADV_POLICY_IGNORE_WHITELIST = 0,
+        ADV_POLICY_FILTER_SCAN_REQS,
+        ADV_POLICY_FILTER_CONN_REQS,
+        ADV_POLICY_FILTER_ALL_REQS
+    };
+
+    enum TimeoutSource_t
+    {
+        TIMEOUT_SRC_ADVERTISING = 0,
+        TIMEOUT_SRC_SECURITY_REQUEST,
+        TIMEOUT_SRC_SCAN,
+        TIMEOUT_SRC_CONN
+    };
+
+    enum DisconnectionReason_t
+    {
+        CONNECTION_TIMEOUT = 0x08,
+        REMOTE_USER_TERMINATED_CONNECTION = 0x13
+    };
+
+    /**
+     * Intervals in 1.25 milliseconds units, the supervision timeout in 10 milliseconds units
+     */
+    struct ConnectionParams_t
+    {
+        uint16_t minConnectionInterval;
+        uint16_t maxConnectionInterval;
+        uint16_t slaveLatency;
+        uint16_t connectionSupervisionTimeout;
+    };
+
+    struct Whitelist_t
+    {
+        BLEProtocol::Address_t *addresses;
+        uint8_t size;
+        uint8_t capacity;
+    };
+
+    struct ConnectionCallbackParams_t
+    {
+        Handle_t handle;
+        Role_t role;
+        AddressType_t peerAddrType;
+        Address_t peerAddr;
+        AddressType_t ownAddrType;
+        Address_t ownAddr;
+        const ConnectionParams_t *connectionParams;
+    };
+
+    struct DisconnectionCallbackParams_t
+    {
+        Handle_t handle;
+        DisconnectionReason_t reason;
+    };
+
+    Gap();
+
+    ble_error_t stopAdvertising();
+    ble_error_t startAdvertising();
+    void clearAdvertisingPayload();
+    ble_error_t accumulateAdvertisingPayload(uint8_t flags);
+    ble_error_t accumulateAdvertisingPayload(GapAdvertisingData::Appearance_t appearance);
+    ble_error_t accumulateAdvertisingPayload(GapAdvertisingData::DataType_t type, const uint8_t *data, uint8_t length);
+    void setAdvertisingType(GapAdvertisingParams::AdvertisingType_t type);
+    void setAdvertisingInterval(uint16_t interval);
+    void setAdvertisingTimeout(uint16_t timeout);
+    ble_error_t setAdvertisingPolicyMode(AdvertisingPolicyMode_t mode);
+    ble_error_t setWhitelist(const Whitelist_t &whitelist);
+    ble_error_t setPreferredConnectionParams(const ConnectionParams_t *params);
+    ble_error_t updateConnectionParams(Handle_t handle, const ConnectionParams_t *params);
+    ble_error_t initRadioNotification();
+    ble_error_t disconnect(Handle_t handle, DisconnectionReason_t reason);
+
+    template <typename T>
+    void onConnection(T *object, void (T::*method)(const ConnectionCallbackParams_t *))
+    {
+        connectionCallback.attach(object, method);
+    }
+
+    template <typename T>
+    void onDisconnection(T *object, void (T::*method)(const DisconnectionCallbackParams_t *))
+    {
+        disconnectionCallback.attach(object, method);
+    }
+
+    void onTimeout(void (*function)(TimeoutSource_t))
+    {
+        timeoutCallback.attach(function);
+    }
+
+    template <typename T>
+    void onRadioNotification(T *object, void (T::*method)(bool))
+    {
+        radioNotificationCallback.attach(object, method);
+    }
+
+    /**
+     * Start directed advertising, as sd_ble_gap_adv_start() does
+     */
+    bool startDirectedAdvertising(const uint8_t *peer);
+
+    // state of the simulated SoftDevice, for MockCentral and the tests
+
+    bool isAdvertising;
+    bool isDirected;
+    GapAdvertisingParams::AdvertisingType_t advertisingType;
+    uint16_t advertisingInterval;      // milliseconds
+    uint16_t advertisingTimeout;       // seconds, 0 for none
+    AdvertisingPolicyMode_t advertisingPolicy;
+    uint8_t whitelistSize;
+    uint32_t advertisingStarts;
+    uint8_t advertisingPayload[31];
+    uint8_t advertisingPayloadLength;
+    ConnectionParams_t preferredConnectionParams;
+    ConnectionParams_t requestedConnectionParams;
+    uint32_t connectionParamsRequests;
+    bool radioNotificationIsEnabled;
+
+    HostCallback<const ConnectionCallbackParams_t *> connectionCallback;
+    HostCallback<const DisconnectionCallbackParams_t *> disconnectionCallback;
+    HostCallback<TimeoutSource_t> timeoutCallback;
+    HostCallback<bool> radioNotificationCallback;
+
+  private:
+    void onAdvertisingTimeout();
+
+    HostTimeout advertisingTimer;
+};
+
+class SecurityManager
+{
+  public:
+    enum SecurityIOCapabilities_t
+    {
+        IO_CAPS_DISPLAY_ONLY = 0x00,
+        IO_CAPS_DISPLAY_YESNO = 0x01,
+        IO_CAPS_KEYBOARD_ONLY = 0x02,
+        IO_CAPS_NONE = 0x03,
+        IO_CAPS_KEYBOARD_DISPLAY = 0x04
+    };
+
+    enum SecurityMode_t
+    {
+        SECURITY_MODE_NO_ACCESS,
+        SECURITY_MODE_ENCRYPTION_OPEN_LINK,
+        SECURITY_MODE_ENCRYPTION_NO_MITM,
+        SECURITY_MODE_ENCRYPTION_WITH_MITM,
+        SECURITY_MODE_SIGNED_NO_MITM,
+        SECURITY_MODE_SIGNED_WITH_MITM
+    };
+
+    static const uint8_t MAX_BONDS = 4;
+
+    SecurityManager() : bondCount(0)
+    {
+    }
+
+    ble_error_t init(bool enableBonding = true, bool requireMITM = true, SecurityIOCapabilities_t iocaps = IO_CAPS_NONE)
+    {
+        return BLE_ERROR_NONE;
+    }
+
+    void onLinkSecured(void (*function)(Gap::Handle_t, SecurityMode_t))
+    {
+        linkSecuredCallback.attach(function);
+    }
+
+    ble_error_t getAddressesFromBondTable(Gap::Whitelist_t &addresses) const;
+
+    /**
+     * Add a host to the bond table, as pairing with bonding does
+     */
+    void addBond(const uint8_t *address);
+
+    HostCallback<Gap::Handle_t, SecurityMode_t> linkSecuredCallback;
+
+  private:
+    BLEProtocol::Address_t bonds[MAX_BONDS];
+    uint8_t bondCount;
+};
+
+class GattWriteCallbackParams
+{
+  public:
+    enum WriteOp_t
+    {
+        OP_INVALID = 0x00,
+        OP_WRITE_REQ = 0x01,
+        OP_WRITE_CMD = 0x02
+    };
+
+    uint16_t connHandle;
+    GattAttribute::Handle_t handle;
+    WriteOp_t writeOp;
+    uint16_t offset;
+    uint16_t len;
+    const uint8_t *data;
+};
+
+class GattCharacteristic
+{
+  public:
+    enum
+    {
+        UUID_BATTERY_LEVEL_CHAR = 0x2A19,
+        UUID_HID_CONTROL_POINT_CHAR = 0x2A4C,
+        UUID_HID_INFORMATION_CHAR = 0x2A4A,
+        UUID_MANUFACTURER_NAME_STRING_CHAR = 0x2A29,
+        UUID_MODEL_NUMBER_STRING_CHAR = 0x2A24,
+        UUID_PNP_ID_CHAR = 0x2A50,
+        UUID_PROTOCOL_MODE_CHAR = 0x2A4E,
+        UUID_REPORT_CHAR = 0x2A4D,
+        UUID_REPORT_MAP_CHAR = 0x2A4B
+    };
+
+    enum Properties_t
+    {
+        BLE_GATT_CHAR_PROPERTIES_NONE = 0x00,
+        BLE_GATT_CHAR_PROPERTIES_BROADCAST = 0x01,
+        BLE_GATT_CHAR_PROPERTIES_READ = 0x02,
+        BLE_GATT_CHAR_PROPERTIES_WRITE_WITHOUT_RESPONSE = 0x04,
+        BLE_GATT_CHAR_PROPERTIES_WRITE = 0x08,
+        BLE_GATT_CHAR_PROPERTIES_NOTIFY = 0x10,
+        BLE_GATT_CHAR_PROPERTIES_INDICATE = 0x20
+    };
+
+    GattCharacteristic(const UUID &uuid, uint8_t *valuePtr = NULL, uint16_t length = 0, uint16_t maxLength = 0,
+                       uint8_t properties = BLE_GATT_CHAR_PROPERTIES_NONE, GattAttribute *descriptors[] = NULL,
+                       unsigned numDescriptors = 0, bool hasVariableLength = true)
+        : valueAttribute(uuid, valuePtr, length, maxLength, hasVariableLength), properties(properties),
+          descriptors(descriptors), descriptorCount(numDescriptors), security(SecurityManager::SECURITY_MODE_ENCRYPTION_OPEN_LINK)
+    {
+    }
+
+    void requireSecurity(SecurityManager::SecurityMode_t mode)
+    {
+        security = mode;
+    }
+
+    GattAttribute &getValueAttribute()
+    {
+        return valueAttribute;
+    }
+
+    GattAttribute::Handle_t getValueHandle() const
+    {
+        return valueAttribute.getHandle();
+    }
+
+    uint8_t getProperties() const
+    {
+        return properties;
+    }
+
+    uint8_t getDescriptorCount() const
+    {
+        return descriptorCount;
+    }
+
+    GattAttribute *getDescriptor(uint8_t index)
+    {
+        return index < descriptorCount ? descriptors[index] : NULL;
+    }
+
+  private:
+    GattAttribute valueAttribute;
+    uint8_t properties;
+    GattAttribute **descriptors;
+    uint8_t descriptorCount;
+    SecurityManager::SecurityMode_t security;
+};
+
+template <typename T>
+class ReadOnlyGattCharacteristic : public GattCharacteristic
+{
+  public:
+    ReadOnlyGattCharacteristic(const UUID &uuid, T *valuePtr, uint8_t additionalProperties = BLE_GATT_CHAR_PROPERTIES_NONE,
+                               GattAttribute *descriptors[] = NULL, unsigned numDescriptors = 0)
+        : GattCharacteristic(uuid, reinterpret_cast<uint8_t *>(valuePtr), sizeof(T), sizeof(T),
+                             BLE_GATT_CHAR_PROPERTIES_READ | additionalProperties, descriptors, numDescriptors, false)
+    {
+    }
+};
+
+class GattService
+{
+  public:
+    enum
+    {
+        UUID_BATTERY_SERVICE = 0x180F,
+        UUID_DEVICE_INFORMATION_SERVICE = 0x180A,
+        UUID_HUMAN_INTERFACE_DEVICE_SERVICE = 0x1812
+    };
+
+    GattService(const UUID &uuid, GattCharacteristic *characteristics[], unsigned numCharacteristics)
+        : uuid(uuid), characteristics(characteristics), characteristicCount(numCharacteristics), handle(0)
+    {
+    }
+
+    uint16_t getHandle() const
+    {
+        return handle;
+    }
+
+    void setHandle(uint16_t newHandle)
+    {
+        handle = newHandle;
+    }
+
+    uint8_t getCharacteristicCount() const
+    {
+        return characteristicCount;
+    }
+
+    GattCharacteristic *getCharacteristic(uint8_t index)
+    {
+        return index < characteristicCount ? characteristics[index] : NULL;
+    }
+
+  private:
+    UUID uuid;
+    GattCharacteristic **characteristics;
+    uint8_t characteristicCount;
+    uint16_t handle;
+};
+
+/**
+ * A notification, as queued in a TX buffer and as received by the host
+ */
+struct MockNotification
+{
+    GattAttribute::Handle_t handle;
+    uint8_t length;
+    uint8_t data[20];
+    uint64_t queuedTime;               // microseconds of the simulated clock
+    uint64_t sentTime;                 // end of the connection event that delivered it
+};
+
+class GattServer
+{
+  public:
+    static const uint16_t MAX_ATTRIBUTES = 96;
+    static const uint16_t MAX_VALUE_BYTES = 96;
+    static const uint8_t MAX_TX_BUFFERS = 16;
+
+    GattServer();
+
+    ble_error_t addService(GattService &service);
+
+    /**
+     * Update an attribute value, and queue a notification in a free TX buffer unless `localOnly`
+     */
+    ble_error_t write(GattAttribute::Handle_t handle, const uint8_t *data, uint16_t length, bool localOnly = false);
+
+    ble_error_t read(GattAttribute::Handle_t handle, uint8_t *data, uint16_t *length);
+
+    template <typename T>
+    void onDataSent(T *object, void (T::*method)(unsigned))
+    {
+        dataSentCallback.attach(object, method);
+    }
+
+    template <typename T>
+    void onDataWritten(T *object, void (T::*method)(const GattWriteCallbackParams *))
+    {
+        dataWrittenCallback.attach(object, method);
+    }
+
+    /**
+     * @return the properties of the characteristic with this value handle, 0 if none
+     */
+    uint8_t getProperties(GattAttribute::Handle_t handle) const;
+
+    // state of the simulated SoftDevice, for MockCentral and the tests
+
+    uint8_t txBuffers;                 // TX buffers for notifications, as sd_ble_tx_buffer_count_get() reports them
+    uint8_t txQueued;
+    MockNotification txQueue[MAX_TX_BUFFERS];
+    uint8_t txHead;
+    bool isConnected;
+    Gap::Handle_t connectionHandle;
+    uint32_t writes;
+    uint32_t rejectedWrites;           // BLE_STACK_BUSY
+    uint32_t serviceChangedIndications;
+
+    HostCallback<unsigned> dataSentCallback;
+    HostCallback<const GattWriteCallbackParams *> dataWrittenCallback;
+
+  private:
+    struct Attribute
+    {
+        GattAttribute::Handle_t handle;
+        uint8_t properties;
+        uint16_t length;
+        uint8_t value[MAX_VALUE_BYTES];
+    };
+
+    Attribute *find(GattAttribute::Handle_t handle);
+    const Attribute *find(GattAttribute::Handle_t handle) const;
+    void addAttribute(GattAttribute &attribute, uint8_t properties);
+
+    Attribute attributes[MAX_ATTRIBUTES];
+    uint16_t attributeCount;
+    uint16_t nextHandle;
+};
+
+class BLE
+{
+  public:
+    /**
+     * The simulated SoftDevice is a singleton, as on the device
+     */
+    static BLE &Instance();
+
+    ble_error_t init()
+    {
+        return BLE_ERROR_NONE;
+    }
+
+    Gap &gap()
+    {
+        return gapInstance;
+    }
+
+    GattServer &gattServer()
+    {
+        return gattServerInstance;
+    }
+
+    SecurityManager &securityManager()
+    {
+        return securityManagerInstance;
+    }
+
+    ble_error_t addService(GattService &service)
+    {
+        return gattServerInstance.addService(service);
+    }
+
+  private:
+    BLE()
+    {
+    }
+
+    Gap gapInstance;
+    GattServer gattServerInstance;
+    SecurityManager securityManagerInstance;
+};
+
+typedef BLE BLEDevice;
+
+/**
+ * The simulated host of the link. Once connected, a connection event happens every connection interval:
+ * the radio notification fires before it, then up to `packetsPerEvent` notifications are taken from
+ * the TX buffers, received by the host, and their buffers freed with onDataSent.
+ *
+ * The host grants the shortest interval and the slave latency of each connection parameters request.
+ * With slave latency, the peripheral sleeps through up to that many events while it has nothing to send.
+ * A lost packet is not acknowledged: it ends the event and is sent again at the next one.
+ */
+class MockCentral
+{
+  public:
+    explicit MockCentral(BLE &ble);
+
+    /**
+     * Connect, with the connection interval in 1.25 milliseconds units
+     */
+    void connect(const uint8_t *address, uint16_t interval = 6);
+
+    void disconnect();
+
+    /**
+     * Encrypt the link, bonding first if `bond`
+     */
+    void secure(bool bond);
+
+    /**
+     * Write a characteristic value, as a write command
+     */
+    void write(GattAttribute::Handle_t handle, const uint8_t *data, uint16_t length);
+
+    /**
+     * Call `observer(notification, context)` for every notification the host receives
+     */
+    void setObserver(void (*observer)(const MockNotification &, void *), void *context);
+
+    /**
+     * Lose this share of the packets the peripheral sends, from a fixed pseudo-random sequence
+     */
+    void setPacketLoss(uint16_t perMille, uint32_t seed = 1);
+
+    bool isConnected() const
+    {
+        return connected;
+    }
+
+    uint16_t getInterval() const
+    {
+        return interval;
+    }
+
+    uint16_t getSlaveLatency() const
+    {
+        return slaveLatency;
+    }
+
+    // link parameters and statistics
+
+    uint8_t packetsPerEvent;
+    uint32_t radioNotificationLeadUs;  // microseconds between the radio notification and the connection event
+    uint32_t connectionEvents;         // events the peripheral woke up for
+    uint32_t skippedEvents;            // events slept through with slave latency
+    uint32_t notificationsReceived;
+    uint32_t packetsLost;
+    uint64_t radioOnUs;                // time the peripheral's radio was ramping up, receiving or sending
+
+  private:
+    void onConnectionEvent();
+    void onRadioNotification();
+    void scheduleEvents();
+    void applyRequest();
+    bool isSkipping();
+    bool isLost();
+
+    BLE &ble;
+    bool connected;
+    uint16_t interval;
+    uint16_t slaveLatency;
+    uint16_t latencyCount;             // events slept through in a row
+    uint16_t lossPerMille;
+    uint32_t lossState;
+    uint8_t address[6];
+    uint64_t anchor;
+    uint32_t lastRequests;
+    HostTimeout radioTimer;
+    HostTimeout eventTimer;
+    void (*observer)(const MockNotification &, void *);
+    void *observerContext;
+};
+
+#endif /* __MOCK_BLE_H__ */
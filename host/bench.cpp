@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+#include <chrono>
+#include <algorithm>
+#include "GamepadHostHal.h"
+#include "BluetoothGamepadService.h"
+
+/**
+ * Cost of the report path of the service on the host: encoding, the report interrupt, and allocations.
+ * The times are host CPU times, a lower bound of the cycles on the nRF51; the latencies are simulated.
+ */
+
+static uint32_t allocations = 0;
+
+// the replacements below pair malloc and free themselves
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void *operator new(size_t size)
+{
+    allocations++;
+    void *memory = malloc(size ? size : 1);
+    if (memory == NULL)
+    {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *memory) noexcept
+{
+    free(memory);
+}
+
+void operator delete[](void *memory) noexcept
+{
+    free(memory);
+}
+
+namespace
+{
+
+const uint32_t ENCODE_LOOPS = 10000000;
+const uint32_t REPORTS = 20000;
+const uint8_t CENTRAL_ADDRESS[6] = {1, 2, 3, 4, 5, 6};
+
+typedef std::chrono::steady_clock BenchClock;
+
+uint64_t latencies[REPORTS];
+uint32_t latencyCount = 0;
+
+void onNotification(const MockNotification &notification, void *)
+{
+    if (latencyCount < REPORTS)
+    {
+        latencies[latencyCount++] = notification.sentTime - notification.queuedTime;
+    }
+}
+
+double nanosecondsSince(BenchClock::time_point start, uint32_t count)
+{
+    return std::chrono::duration<double, std::nano>(BenchClock::now() - start).count() / count;
+}
+
+uint64_t percentile(uint8_t percent)
+{
+    return latencies[(latencyCount - 1) * percent / 100];
+}
+}
+
+int main()
+{
+    HostBoard::reset();
+    BLE &ble = BLE::Instance();
+
+    uint32_t constructionAllocations = allocations;
+    BluetoothGamepadService *service = new BluetoothGamepadService(&ble);
+    constructionAllocations = allocations - constructionAllocations;
+
+    MockCentral central(ble);
+    central.setObserver(&onNotification, NULL);
+    central.connect(CENTRAL_ADDRESS);
+    HostScheduler::run(100000);
+    latencyCount = 0;
+
+    // encoding of the buttons into the input report
+    uint8_t report[GamepadInputReport::size] = {0};
+    uint32_t checksum = 0;
+    BenchClock::time_point start = BenchClock::now();
+    for (uint32_t i = 0; i < ENCODE_LOOPS; i++)
+    {
+        gamepadPutButtons<GamepadInputReport>(report, (uint8_t)i);
+        checksum += report[GamepadInputReport::size - 1];
+    }
+    double encodeNs = nanosecondsSince(start, ENCODE_LOOPS);
+
+    // one button edge per connection interval: the input call, then the report interrupt sending it
+    uint32_t pathAllocations = allocations;
+    uint32_t writes = ble.gattServer().writes;
+    uint64_t inputNs = 0;
+    uint64_t interruptNs = 0;
+    for (uint32_t i = 0; i < REPORTS; i++)
+    {
+        start = BenchClock::now();
+        service->setButtons(i & 1 ? GAMEPAD_BUTTON_A : 0);
+        inputNs += std::chrono::duration_cast<std::chrono::nanoseconds>(BenchClock::now() - start).count();
+
+        // the report timeout, the report interrupt it pends, and the write to the stack, alone
+        start = BenchClock::now();
+        HostScheduler::runUntil(HostScheduler::now() + 1);
+        interruptNs += std::chrono::duration_cast<std::chrono::nanoseconds>(BenchClock::now() - start).count();
+
+        HostScheduler::run(central.getInterval() * 1250);
+    }
+    writes = ble.gattServer().writes - writes;
+    pathAllocations = allocations - pathAllocations;
+
+    std::sort(latencies, latencies + latencyCount);
+    printf("encode:               %.2f ns/report (checksum %u)\n", encodeNs, checksum & 0xff);
+    printf("setButtons:           %.1f ns/call\n", (double)inputNs / REPORTS);
+    printf("report path:          %.1f ns/report, timer to write\n", (double)interruptNs / REPORTS);
+    printf("reports written:      %u for %u edges, %u rejected\n", writes, REPORTS, ble.gattServer().rejectedWrites);
+    printf("queued to sent:       p50 %llu us, p99 %llu us, max %llu us\n", (unsigned long long)percentile(50),
+           (unsigned long long)percentile(99), (unsigned long long)latencies[latencyCount - 1]);
+    printf("allocations:          %u constructing, %u in the report path\n", constructionAllocations, pathAllocations);
+
+    // the report path runs in interrupts: it must never allocate
+    return pathAllocations == 0 && writes >= REPORTS ? 0 : 1;
+}
@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "GamepadHostHal.h"
+#include "BluetoothGamepadService.h"
+
+/**
+ * The hub and its satellites as separate processes over pseudo-terminals: each satellite is a child process
+ * running HubSatellite on a simulated board of its own, wired to the hub by a terminal of its own.
+ * The clocks of the processes are paced to the wall clock, so the satellites answer the polls in their slots.
+ *
+ * Every satellite plays a sequence of button states; each must reach the host in order, as the report of its player.
+ * The terminals carry bytes, not levels: the polling and the frames are covered, not the open-drain line.
+ */
+
+#if GAMEPAD_HUB_PLAYERS < 2
+#error "hublink needs the hub: build with GAMEPAD_HUB_PLAYERS=2 or more"
+#endif
+
+namespace
+{
+
+const uint8_t PLAYERS = GAMEPAD_HUB_PLAYERS;
+const uint8_t STEPS = 8;
+const uint32_t SETTLE_US = 300000;
+const uint32_t STEP_US = 100000;
+const uint32_t HUB_RUN_US = SETTLE_US + STEPS * STEP_US + 500000;
+const uint32_t MAX_RECEIVED = 4096;
+const uint8_t CENTRAL_ADDRESS[6] = {1, 2, 3, 4, 5, 6};
+
+// each player plays its own two buttons, so that its reports differ from those of any other player
+const uint8_t PLAYER_BUTTONS[HUB_LINK_MAX_PLAYERS][2] = {
+    {GAMEPAD_BUTTON_A, GAMEPAD_BUTTON_B},
+    {GAMEPAD_BUTTON_SELECT, GAMEPAD_BUTTON_START},
+    {GAMEPAD_BUTTON_UP, GAMEPAD_BUTTON_RIGHT},
+    {GAMEPAD_BUTTON_DOWN, GAMEPAD_BUTTON_LEFT},
+};
+
+typedef GamepadPlayerReport<0> PlayerReport;
+
+struct Received
+{
+    GattAttribute::Handle_t handle;
+    uint8_t data[PlayerReport::size];
+};
+
+Received received[MAX_RECEIVED];
+uint32_t receivedCount = 0;
+
+/**
+ * The first button, both, then the second: every step changes the report
+ */
+uint8_t buttonsAt(uint8_t player, uint8_t step)
+{
+    switch (step % 3)
+    {
+    case 0:
+        return PLAYER_BUTTONS[player][0];
+    case 1:
+        return PLAYER_BUTTONS[player][0] | PLAYER_BUTTONS[player][1];
+    default:
+        return PLAYER_BUTTONS[player][1];
+    }
+}
+
+void onNotification(const MockNotification &notification, void *)
+{
+    if (notification.length == PlayerReport::size && receivedCount < MAX_RECEIVED)
+    {
+        received[receivedCount].handle = notification.handle;
+        memcpy(received[receivedCount].data, notification.data, PlayerReport::size);
+        receivedCount++;
+    }
+}
+
+/**
+ * A satellite board, in its own process: it answers the hub's polls while playing its steps
+ */
+void runSatellite(uint8_t player, const char *path)
+{
+    HostBoard::reset();
+    HostScheduler::reset();
+    if (!HostBoard::linkOpenTty(path))
+    {
+        fprintf(stderr, "satellite %u: can not open %s\n", player, path);
+        _exit(1);
+    }
+    static HubSatellite<PlayerReport::size> satellite;
+    satellite.start(player, NC, NC, 115200);
+
+    HostScheduler::run(SETTLE_US);
+    for (uint8_t step = 0; step < STEPS; step++)
+    {
+        uint8_t report[PlayerReport::size] = {0};
+        gamepadPutButtons<PlayerReport>(report, buttonsAt(player, step));
+        satellite.setReport(report);
+        HostScheduler::run(STEP_US);
+    }
+    // held until the hub is done
+    HostScheduler::run(HUB_RUN_US);
+    _exit(0);
+}
+
+/**
+ * @return the steps of a player the host received in order, on the handle of the first one
+ */
+uint8_t matchSteps(uint8_t player)
+{
+    uint8_t matched = 0;
+    GattAttribute::Handle_t handle = 0;
+    for (uint32_t i = 0; i < receivedCount && matched < STEPS; i++)
+    {
+        uint8_t expected[PlayerReport::size] = {0};
+        gamepadPutButtons<PlayerReport>(expected, buttonsAt(player, matched));
+        if ((matched == 0 || received[i].handle == handle) && memcmp(received[i].data, expected, sizeof(expected)) == 0)
+        {
+            handle = received[i].handle;
+            matched++;
+        }
+    }
+    return matched;
+}
+}
+
+int main()
+{
+    HostBoard::reset();
+    pid_t satellites[PLAYERS];
+    for (uint8_t player = 0; player < PLAYERS; player++)
+    {
+        const char *path = HostBoard::linkOpenPty();
+        if (path == NULL)
+        {
+            fprintf(stderr, "hub: no pseudo-terminal\n");
+            return 1;
+        }
+        fflush(stdout);
+        satellites[player] = fork();
+        if (satellites[player] == 0)
+        {
+            runSatellite(player, path);
+        }
+    }
+
+    BLE &ble = BLE::Instance();
+    BluetoothGamepadService *service = new BluetoothGamepadService(&ble);
+    MockCentral central(ble);
+    central.setObserver(&onNotification, NULL);
+    central.connect(CENTRAL_ADDRESS);
+    service->startHub(NC, NC, 115200);
+    HostScheduler::run(HUB_RUN_US);
+
+    bool passed = true;
+    for (uint8_t player = 0; player < PLAYERS; player++)
+    {
+        kill(satellites[player], SIGKILL);
+        waitpid(satellites[player], NULL, 0);
+        uint8_t matched = matchSteps(player);
+        printf("player %u:          %u/%u button changes reported in order\n", player, matched, STEPS);
+        passed = passed && matched == STEPS;
+    }
+    printf("frames:            %u, %u errors, %u lost\n", service->getHubStat(GAMEPAD_HUB_FRAMES),
+           service->getHubStat(GAMEPAD_HUB_ERRORS), service->getHubStat(GAMEPAD_HUB_LOST));
+    printf("frame to queued:   avg %u us, max %u us\n", service->getHubStat(GAMEPAD_HUB_LATENCY_AVG_US),
+           service->getHubStat(GAMEPAD_HUB_LATENCY_MAX_US));
+
+    // every poll is answered by its player alone: one frame per slot
+    uint32_t polls = HUB_RUN_US / GAMEPAD_HUB_POLL_US;
+    passed = passed && service->getHubStat(GAMEPAD_HUB_FRAMES) > polls / 2;
+    return passed ? 0 : 1;
+}
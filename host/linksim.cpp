@@ -0,0 +1,336 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include "GamepadHostHal.h"
+#include "BluetoothGamepadService.h"
+
+/**
+ * Discrete-event simulation of the link: the real service, on the simulated clock, against MockCentral
+ * with its connection events, slave latency, TX buffers and packet loss.
+ *
+ * Input timelines are replayed through setButtons() under each report policy, and every input edge is
+ * matched in order against the reports the host received: the latency is from the edge to the
+ * connection event that delivered it, and an edge no report shows within a second is dropped.
+ *
+ *   linksim [-l loss per mille] [-t TX buffers] [-p packets per event] [timeline file]
+ *
+ * A timeline file has one "<microseconds> <button state>" line per input change, '#' starts a comment.
+ */
+
+namespace
+{
+
+const uint32_t MAX_INPUTS = 8192;
+const uint32_t MAX_RECEIVED = 65536;
+const uint8_t CENTRAL_ADDRESS[6] = {1, 2, 3, 4, 5, 6};
+const uint32_t SETTLE_US = 200000;
+const uint32_t DRAIN_US = 2000000;
+const uint32_t MATCH_WINDOW_US = 1000000;
+
+struct Input
+{
+    uint64_t time;
+    uint8_t buttons;
+};
+
+struct Timeline
+{
+    const char *name;
+    Input inputs[MAX_INPUTS];
+    uint32_t count;
+};
+
+struct Received
+{
+    uint64_t time;
+    uint8_t data[GamepadInputReport::size];
+};
+
+enum Policy
+{
+    POLICY_TICKER,    // a report every 7.5 milliseconds, changed or not
+    POLICY_ON_CHANGE, // on change, at most every 7.5 milliseconds
+    POLICY_ON_RADIO,  // on change, just before the next connection event
+    POLICIES
+};
+
+const char *const POLICY_NAMES[POLICIES] = {"ticker", "on-change", "on-radio"};
+
+struct LinkConfig
+{
+    uint16_t lossPerMille;
+    uint8_t txBuffers;
+    uint8_t packetsPerEvent;
+};
+
+Timeline timeline;
+Received received[MAX_RECEIVED];
+uint32_t receivedCount = 0;
+uint64_t latencies[MAX_INPUTS];
+
+/**
+ * A fixed pseudo-random sequence, so that every run replays the same input
+ */
+uint32_t randomState = 1;
+
+uint32_t randomBetween(uint32_t low, uint32_t high)
+{
+    randomState = randomState * 1103515245 + 12345;
+    return low + (randomState >> 8) % (high - low + 1);
+}
+
+void addInput(uint64_t time, uint8_t buttons)
+{
+    if (timeline.count < MAX_INPUTS)
+    {
+        timeline.inputs[timeline.count].time = time;
+        timeline.inputs[timeline.count].buttons = buttons;
+        timeline.count++;
+    }
+}
+
+/**
+ * Single presses of A, 30..80 ms long, 100..600 ms apart
+ */
+void makeTaps()
+{
+    timeline.name = "taps";
+    timeline.count = 0;
+    uint64_t time = 0;
+    for (uint16_t i = 0; i < 300; i++)
+    {
+        time += randomBetween(100, 600) * 1000;
+        addInput(time, GAMEPAD_BUTTON_A);
+        time += randomBetween(30, 80) * 1000;
+        addInput(time, 0);
+    }
+}
+
+/**
+ * A and B changing every 2..20 ms: faster than the connection interval
+ */
+void makeMash()
+{
+    timeline.name = "mash";
+    timeline.count = 0;
+    uint64_t time = 0;
+    uint8_t buttons = 0;
+    for (uint16_t i = 0; i < 2000; i++)
+    {
+        time += randomBetween(2, 20) * 1000;
+        buttons ^= randomBetween(0, 1) ? GAMEPAD_BUTTON_A : GAMEPAD_BUTTON_B;
+        addInput(time, buttons);
+    }
+}
+
+/**
+ * Bursts of taps on A and RIGHT, separated by pauses longer than the idle timeout
+ */
+void makeBursts()
+{
+    timeline.name = "bursts";
+    timeline.count = 0;
+    uint64_t time = 0;
+    for (uint16_t burst = 0; burst < 12; burst++)
+    {
+        time += randomBetween(GAMEPAD_IDLE_TIMEOUT_MS + 1000, GAMEPAD_IDLE_TIMEOUT_MS + 3000) * 1000ULL;
+        for (uint8_t i = 0; i < 10; i++)
+        {
+            addInput(time, i & 1 ? GAMEPAD_BUTTON_RIGHT : GAMEPAD_BUTTON_A);
+            time += randomBetween(20, 60) * 1000;
+            addInput(time, 0);
+            time += randomBetween(20, 60) * 1000;
+        }
+    }
+}
+
+bool loadTimeline(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        return false;
+    }
+    timeline.name = path;
+    timeline.count = 0;
+    char line[128];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        unsigned long long time;
+        unsigned int buttons;
+        if (line[0] != '#' && sscanf(line, "%llu %i", &time, &buttons) == 2)
+        {
+            addInput(time, (uint8_t)buttons);
+        }
+    }
+    fclose(file);
+    return timeline.count > 0;
+}
+
+void onNotification(const MockNotification &notification, void *)
+{
+    // the gamepad input report is the only report of its size in this configuration
+    if (notification.length == GamepadInputReport::size && receivedCount < MAX_RECEIVED)
+    {
+        received[receivedCount].time = notification.sentTime;
+        memcpy(received[receivedCount].data, notification.data, GamepadInputReport::size);
+        receivedCount++;
+    }
+}
+
+uint64_t percentile(uint32_t count, uint8_t percent)
+{
+    return count == 0 ? 0 : latencies[(count - 1) * percent / 100];
+}
+
+/**
+ * Replay the timeline under one policy, then print a line of results.
+ * Runs in a child process: the service is a singleton with static storage, started once per process.
+ */
+void simulate(Policy policy, const LinkConfig &config)
+{
+    HostBoard::reset();
+    BLE &ble = BLE::Instance();
+    ble.gattServer().txBuffers = config.txBuffers;
+    BluetoothGamepadService *service = new BluetoothGamepadService(&ble);
+
+    MockCentral central(ble);
+    central.packetsPerEvent = config.packetsPerEvent;
+    central.setPacketLoss(config.lossPerMille);
+    central.setObserver(&onNotification, NULL);
+    central.connect(CENTRAL_ADDRESS);
+
+    switch (policy)
+    {
+        case POLICY_TICKER:
+            service->setReportInterval(GAMEPAD_REPORT_MIN_INTERVAL_US, GAMEPAD_REPORT_MIN_INTERVAL_US);
+            break;
+        case POLICY_ON_CHANGE:
+            service->setReportInterval(GAMEPAD_REPORT_MIN_INTERVAL_US, 0);
+            break;
+        case POLICY_ON_RADIO:
+            service->setReportInterval(GAMEPAD_REPORT_MIN_INTERVAL_US, 0);
+            service->setReportMode(GAMEPAD_REPORT_ON_RADIO);
+            break;
+        default:
+            break;
+    }
+    HostScheduler::run(SETTLE_US);
+    receivedCount = 0;
+
+    uint64_t start = HostScheduler::now();
+    uint32_t radioEvents = central.connectionEvents;
+    uint32_t skippedEvents = central.skippedEvents;
+    uint32_t packetsLost = central.packetsLost;
+    uint64_t radioOnUs = central.radioOnUs;
+    uint32_t rejected = ble.gattServer().rejectedWrites;
+    for (uint32_t i = 0; i < timeline.count; i++)
+    {
+        HostScheduler::runUntil(start + timeline.inputs[i].time);
+        service->setButtons(timeline.inputs[i].buttons);
+    }
+    HostScheduler::run(DRAIN_US);
+    uint64_t duration = HostScheduler::now() - start;
+
+    // match the edges in order: the service keeps their order, and a dropped edge never shows
+    uint32_t matched = 0;
+    uint32_t next = 0;
+    for (uint32_t i = 0; i < timeline.count; i++)
+    {
+        uint8_t expected[GamepadInputReport::size] = {0};
+        gamepadPutButtons<GamepadInputReport>(expected, timeline.inputs[i].buttons);
+        for (uint32_t j = next; j < receivedCount; j++)
+        {
+            if (received[j].time >= start + timeline.inputs[i].time + MATCH_WINDOW_US)
+            {
+                break;
+            }
+            if (received[j].time >= start + timeline.inputs[i].time &&
+                memcmp(received[j].data, expected, sizeof(expected)) == 0)
+            {
+                latencies[matched++] = received[j].time - start - timeline.inputs[i].time;
+                next = j + 1;
+                break;
+            }
+        }
+    }
+    std::sort(latencies, latencies + matched);
+
+    printf("%-8s %-10s %5u %5u %6.1f %6.1f %6.1f %6.1f %7u %7u %6u %6u %7.2f\n", timeline.name, POLICY_NAMES[policy],
+           timeline.count, timeline.count - matched, percentile(matched, 50) / 1000.0, percentile(matched, 90) / 1000.0,
+           percentile(matched, 99) / 1000.0, percentile(matched, 100) / 1000.0, central.connectionEvents - radioEvents,
+           central.skippedEvents - skippedEvents, central.packetsLost - packetsLost,
+           ble.gattServer().rejectedWrites - rejected, (central.radioOnUs - radioOnUs) * 1000.0 / duration);
+}
+
+void runPolicies(const LinkConfig &config)
+{
+    for (uint8_t policy = 0; policy < POLICIES; policy++)
+    {
+        fflush(stdout);
+        pid_t child = fork();
+        if (child == 0)
+        {
+            simulate((Policy)policy, config);
+            fflush(stdout);
+            _exit(0);
+        }
+        int status;
+        waitpid(child, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            printf("%-8s %-10s failed\n", timeline.name, POLICY_NAMES[policy]);
+        }
+    }
+}
+}
+
+int main(int argc, char **argv)
+{
+    LinkConfig config = {0, 7, 6};
+    int option;
+    while ((option = getopt(argc, argv, "l:t:p:")) != -1)
+    {
+        switch (option)
+        {
+            case 'l':
+                config.lossPerMille = atoi(optarg);
+                break;
+            case 't':
+                config.txBuffers = atoi(optarg);
+                break;
+            case 'p':
+                config.packetsPerEvent = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-l loss per mille] [-t TX buffers] [-p packets per event] [timeline]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    printf("loss %u/1000, %u TX buffers, %u packets per event; latencies in ms, radio-on in ms per second\n",
+           config.lossPerMille, config.txBuffers, config.packetsPerEvent);
+    printf("%-8s %-10s %5s %5s %6s %6s %6s %6s %7s %7s %6s %6s %7s\n", "timeline", "policy", "edges", "drops", "p50",
+           "p90", "p99", "max", "events", "skipped", "lost", "busy", "radio");
+    if (optind < argc)
+    {
+        if (!loadTimeline(argv[optind]))
+        {
+            fprintf(stderr, "%s: no input in %s\n", argv[0], argv[optind]);
+            return 1;
+        }
+        runPolicies(config);
+        return 0;
+    }
+
+    void (*const timelines[])() = {&makeTaps, &makeMash, &makeBursts};
+    for (uint8_t i = 0; i < sizeof(timelines) / sizeof(timelines[0]); i++)
+    {
+        randomState = 1;
+        timelines[i]();
+        runPolicies(config);
+    }
+    return 0;
+}
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include "GamepadHostHal.h"
+#include "BluetoothGamepadService.h"
+
+/**
+ * Replay an input trace through the service and the mock BLE stack, as playTrace() does on the micro:bit.
+ *
+ *   replay [trace file]
+ *
+ * The file is what sendTrace() writes to the serial port. Without one, a trace is recorded here first and
+ * exported, so that the export, receiveTrace() and the player are all covered.
+ * Every button event must reach the host in order, written within a millisecond of its time in the trace
+ * when the events are further apart than the minimum report interval.
+ */
+
+#if !GAMEPAD_TRACE_EVENTS
+#error "replay needs the trace recorder: build with GAMEPAD_TRACE_EVENTS"
+#endif
+
+namespace
+{
+
+const uint16_t MAX_EVENTS = GAMEPAD_TRACE_EVENTS;
+const uint32_t MAX_TRACE_BYTES = sizeof(InputTraceHeader) + MAX_EVENTS * sizeof(InputTraceEvent);
+const uint8_t CENTRAL_ADDRESS[6] = {1, 2, 3, 4, 5, 6};
+const uint32_t MAX_ERROR_US = 1000;
+const uint32_t DRAIN_US = 1000000;
+
+struct Received
+{
+    uint64_t queuedTime;
+    uint64_t sentTime;
+    uint8_t data[GamepadInputReport::size];
+};
+
+Received received[MAX_EVENTS * 2];
+uint16_t receivedCount = 0;
+uint64_t errors[MAX_EVENTS];
+uint64_t latencies[MAX_EVENTS];
+
+void onNotification(const MockNotification &notification, void *)
+{
+    if (notification.length == GamepadInputReport::size && receivedCount < MAX_EVENTS * 2)
+    {
+        received[receivedCount].queuedTime = notification.queuedTime;
+        received[receivedCount].sentTime = notification.sentTime;
+        memcpy(received[receivedCount].data, notification.data, GamepadInputReport::size);
+        receivedCount++;
+    }
+}
+
+uint32_t loadTrace(const char *path, uint8_t *trace)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        return 0;
+    }
+    uint32_t length = fread(trace, 1, MAX_TRACE_BYTES, file);
+    fclose(file);
+    return length;
+}
+
+/**
+ * Record taps with uneven timing, and export them as the micro:bit does.
+ * They are further apart than the minimum report interval, so that each is written as soon as it is replayed.
+ */
+uint32_t recordTrace(BluetoothGamepadService &service, uint8_t *trace)
+{
+    service.recordTrace(true);
+    uint32_t state = 1;
+    for (uint16_t i = 0; i < MAX_EVENTS / 2; i++)
+    {
+        state = state * 1103515245 + 12345;
+        HostScheduler::run(GAMEPAD_REPORT_MIN_INTERVAL_US + (state >> 8) % 120000);
+        service.setButtons(i & 1 ? 0 : GAMEPAD_BUTTON_A << ((state >> 4) & 3));
+    }
+    service.recordTrace(false);
+    service.sendTrace();
+    return HostBoard::serialOutput(trace, MAX_TRACE_BYTES);
+}
+
+uint64_t percentile(uint64_t *values, uint16_t count, uint8_t percent)
+{
+    return count == 0 ? 0 : values[(count - 1) * percent / 100];
+}
+}
+
+int main(int argc, char **argv)
+{
+    HostBoard::reset();
+    BLE &ble = BLE::Instance();
+    BluetoothGamepadService service(&ble);
+    MockCentral central(ble);
+    central.setObserver(&onNotification, NULL);
+    central.connect(CENTRAL_ADDRESS);
+    HostScheduler::run(100000);
+
+    static uint8_t trace[MAX_TRACE_BYTES];
+    uint32_t length = argc > 1 ? loadTrace(argv[1], trace) : recordTrace(service, trace);
+    const InputTraceHeader *header = reinterpret_cast<const InputTraceHeader *>(trace);
+    if (length < sizeof(InputTraceHeader) || header->count > MAX_EVENTS ||
+        length < sizeof(InputTraceHeader) + header->count * sizeof(InputTraceEvent))
+    {
+        // the events are checked against the trace as written, so the recorder must hold all of them
+        fprintf(stderr, "%s: no trace, or longer than %u events\n", argv[0], MAX_EVENTS);
+        return 1;
+    }
+    HostBoard::serialInput(trace, length);
+    uint16_t count = service.receiveTrace();
+    if (count == 0)
+    {
+        fprintf(stderr, "%s: the service refused the trace\n", argv[0]);
+        return 1;
+    }
+
+    const InputTraceEvent *events = reinterpret_cast<const InputTraceEvent *>(trace + sizeof(InputTraceHeader));
+    uint64_t duration = 0;
+    for (uint16_t i = 1; i < count; i++)
+    {
+        duration += InputTrace<GAMEPAD_TRACE_EVENTS>::delay(events[i]);
+    }
+
+    receivedCount = 0;
+    uint64_t start = HostScheduler::now();
+    service.playTrace();
+    HostScheduler::run(duration + DRAIN_US);
+
+    // the button events in order against the reports: each state change is one report
+    uint16_t buttonEvents = 0;
+    uint16_t matched = 0;
+    uint16_t next = 0;
+    uint64_t time = start;
+    uint8_t buttons = 0;
+    for (uint16_t i = 0; i < count; i++)
+    {
+        if (i > 0)
+        {
+            time += InputTrace<GAMEPAD_TRACE_EVENTS>::delay(events[i]);
+        }
+        if (events[i].kind != INPUT_TRACE_BUTTONS || (uint8_t)events[i].value == buttons)
+        {
+            continue;
+        }
+        buttons = (uint8_t)events[i].value;
+        buttonEvents++;
+
+        uint8_t expected[GamepadInputReport::size] = {0};
+        gamepadPutButtons<GamepadInputReport>(expected, buttons);
+        while (next < receivedCount && memcmp(received[next].data, expected, sizeof(expected)) != 0)
+        {
+            next++;
+        }
+        if (next == receivedCount)
+        {
+            break;
+        }
+        uint64_t queued = received[next].queuedTime;
+        errors[matched] = queued > time ? queued - time : time - queued;
+        latencies[matched] = received[next].sentTime - time;
+        matched++;
+        next++;
+    }
+    std::sort(errors, errors + matched);
+    std::sort(latencies, latencies + matched);
+
+    printf("trace:             %u events, %u button changes, %u reported\n", count, buttonEvents, matched);
+    printf("replay timing:     p50 %llu us, p99 %llu us, max %llu us from the trace\n",
+           (unsigned long long)percentile(errors, matched, 50), (unsigned long long)percentile(errors, matched, 99),
+           (unsigned long long)percentile(errors, matched, 100));
+    printf("event to host:     p50 %llu us, p99 %llu us, max %llu us\n", (unsigned long long)percentile(latencies, matched, 50),
+           (unsigned long long)percentile(latencies, matched, 99), (unsigned long long)percentile(latencies, matched, 100));
+
+    return matched == buttonEvents && percentile(errors, matched, 100) <= MAX_ERROR_US ? 0 : 1;
+}